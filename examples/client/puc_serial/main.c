@@ -1,121 +1,13 @@
 #include <bsmp/client.h>
+#include <bsmp/serial.h>
 
 #include <stdlib.h>
 #include <stdio.h>
-#include <unistd.h>
-#include <fcntl.h>
-#include <string.h>
-
-#define SERIAL_HDR_SIZE         1
-#define SERIAL_CSUM_SIZE        1
-#define SERIAL_PKT_WRAP_SIZE    SERIAL_HDR_SIZE + SERIAL_CSUM_SIZE
-#define PACKET_SIZE             BSMP_MAX_MESSAGE + SERIAL_PKT_WRAP_SIZE
-#define PACKET_HEADER           SERIAL_HDR_SIZE + BSMP_HEADER_SIZE
-
-#ifdef DEBUG
-void print_packet (char* pre, uint8_t *data, uint32_t size)
-{
-    printf("%s: [", pre);
-
-    if(size < 32)
-    {
-        unsigned int i;
-        for(i = 0; i < size; ++i)
-            printf("%02X ", data[i]);
-        printf("]\n");
-    }
-    else
-        printf("%d bytes ]\n", size);
-}
-#else
-#define print_packet(pre,data,size)
-#endif
 
 #define TRY(err, func) \
 do { if((err = func)) { fprintf(stderr, #func": %s\n", bsmp_error_str(err));\
                         return; }}while(0)
 
-char *port;
-int baud, address, serial;
-
-int read_all(int fd, uint8_t *data, uint32_t count)
-{
-    unsigned int read_bytes = 0;
-    unsigned int remaining = count;
-
-    while(remaining)
-    {
-        int ret = read(fd, data + read_bytes, remaining);
-
-        if(ret < 0)
-        {
-            perror("read");
-            return EXIT_FAILURE;
-        }
-
-        remaining -= ret;
-        read_bytes += ret;
-    }
-
-    return EXIT_SUCCESS;
-}
-
-int puc_send(uint8_t *data, uint32_t *count)
-{
-    uint8_t  packet[PACKET_SIZE];
-    uint32_t packet_size = *count + SERIAL_PKT_WRAP_SIZE;
-    uint8_t  *csum = &packet[packet_size - 1];
-
-    *csum = 0;
-    packet[0] = address;
-    *csum -= address;
-
-    unsigned int i;
-    for(i = 0; i < *count; ++i)
-    {
-        packet[i + 1] = data[i];
-        *csum -= data[i];
-    }
-
-    print_packet("SEND", packet, packet_size);
-
-    int ret = write(serial, packet, packet_size);
-
-    if(ret != packet_size)
-    {
-        if(ret < 0)
-            perror("write");
-        return EXIT_FAILURE;
-    }
-
-    return EXIT_SUCCESS;
-}
-
-int puc_recv(uint8_t *data, uint32_t *count)
-{
-    uint8_t packet[PACKET_SIZE] = {0};
-    uint32_t packet_size;
-
-    if(read_all(serial, packet, PACKET_HEADER))
-        return EXIT_FAILURE;
-
-    unsigned int remaining;
-
-    remaining = (packet[2] << 8) + packet[3];
-
-    if(read_all(serial, packet + PACKET_HEADER, remaining + SERIAL_CSUM_SIZE))
-        return EXIT_FAILURE;
-
-    packet_size = PACKET_HEADER + remaining + SERIAL_CSUM_SIZE;
-
-    print_packet("RECV", packet, packet_size);
-
-    *count = packet_size - SERIAL_PKT_WRAP_SIZE;
-    memcpy(data, packet + SERIAL_HDR_SIZE, *count);
-
-    return EXIT_SUCCESS;
-}
-
 void print_vars(struct bsmp_var_info_list *vars)
 {
     unsigned int i;
@@ -255,25 +147,28 @@ int main(int argc, char **argv)
     }
 
     // Get parameters from command line
-    port = argv[1];
-    baud = atoi(argv[2]);
-    address = atoi(argv[3]);
+    char *port = argv[1];
+    int baud = atoi(argv[2]);
+    int address = atoi(argv[3]);
 
     // Open serial port to communicate with the PUC
-    if((serial = open(port, O_RDWR | O_NOCTTY)) < 0)
+    static bsmp_serial_t serial;
+    enum bsmp_err err;
+    if((err = bsmp_serial_open(&serial, port, baud, address)))
     {
-        perror("open");
+        fprintf(stderr, "bsmp_serial_open: %s\n", bsmp_error_str(err));
         return 0;
     }
 
     printf("PUC[%d]  %s @ %d bps\n", address, port, baud);
 
     // Create a new client instance
-    bsmp_client_t bsmp;
+    static bsmp_client_t bsmp;
+    struct bsmp_transport transport;
+    bsmp_serial_transport(&serial, &transport);
 
     // Initialize the client instance (communication must be already working)
-    enum bsmp_err err;
-    if((err = bsmp_client_init(&bsmp, puc_send, puc_recv)))
+    if((err = bsmp_client_init_transport(&bsmp, &transport, 1, NULL)))
     {
         fprintf(stderr, "bsmp_client_init: %s\n", bsmp_error_str(err));
         goto exit;
@@ -370,7 +265,7 @@ int main(int argc, char **argv)
         test_digital(&bsmp, first_digin, first_digout);
 
 exit:
-    close(serial);
+    bsmp_serial_close(&serial);
     puts("Serial port closed");
     return 0;
 
@@ -219,6 +219,20 @@ static bool curve_write_block (struct bsmp_curve *curve, uint16_t block,
     return true;
 }
 
+/*
+ * A Curve whose blocks already live in contiguous memory can skip the copy
+ * made by read_block altogether: it just points to the requested block. The
+ * library then uses this function instead of read_block. We do that for the
+ * big Curve.
+ */
+static bool curve_block_ptr (struct bsmp_curve *curve, uint16_t block,
+                             uint8_t **data, uint16_t *len)
+{
+    *data = &big_curve_memory[block*curve->info.block_size];
+    *len  = curve->info.block_size;
+    return true;
+}
+
 /* Let's declare those Curves already! */
 static struct bsmp_curve little_curve = {
     .info.nblocks = 2,                  // 2 blocks
@@ -234,6 +248,7 @@ static struct bsmp_curve big_curve = {
     .info.block_size = 32768,           // 32768 bytes per block
     .info.writable = false,             // Read-only
     .read_block = curve_read_block,
+    .get_block_ptr = curve_block_ptr,   // Point to blocks, don't copy them
     .user = (void*) "MY AWESOME BIG CURVE"
 };
 
@@ -0,0 +1,236 @@
+// Checks the serial transport over a pseudo terminal pair: the server takes
+// one end, the client the other, without any hardware.
+//
+// Usage: serial_pty
+
+#include <bsmp/server.h>
+#include <bsmp/client.h>
+#include <bsmp/serial.h>
+
+#include <poll.h>
+#include <pthread.h>
+#include <pty.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define ADDRESS     5
+#define BLOCK_SIZE  2000    // Long frames, for the checksum
+
+#define CHECK(x)    do { if(!(x)) { fprintf(stderr, "line %d: %s failed\n", \
+                                            __LINE__, #x); exit(1); } } while(0)
+
+static uint8_t value[4] = {1, 2, 3, 4};
+static uint8_t table[100];
+static struct bsmp_var vars[2] = {
+    {.info = {.size = sizeof(value), .writable = true},  .data = value},
+    {.info = {.size = sizeof(table), .writable = false}, .data = table}
+};
+
+static uint8_t blocks[2*BLOCK_SIZE];
+
+static bool read_block (struct bsmp_curve *curve, uint16_t block,
+                        uint8_t *data, uint16_t *len)
+{
+    (void) curve;
+    memcpy(data, blocks + block*BLOCK_SIZE, BLOCK_SIZE);
+    *len = BLOCK_SIZE;
+    return true;
+}
+
+static bool write_block (struct bsmp_curve *curve, uint16_t block,
+                         uint8_t *data, uint16_t len)
+{
+    (void) curve;
+    memcpy(blocks + block*BLOCK_SIZE, data, len);
+    return true;
+}
+
+static struct bsmp_curve curve = {
+    .info        = {.nblocks = 2, .block_size = BLOCK_SIZE, .writable = true},
+    .read_block  = read_block,
+    .write_block = write_block
+};
+
+static bsmp_server_t server;
+static bsmp_serial_t server_end, client_end;
+static volatile int quit;
+
+// Frame of a variable read, as a client would send it
+static uint32_t read_frame (uint8_t *frame, uint8_t address, uint8_t id)
+{
+    uint8_t msg[] = {0x10, 0x00, 0x01, id};
+    uint8_t csum = address;
+    unsigned int i;
+
+    frame[0] = address;
+    for(i = 0; i < sizeof(msg); ++i)
+        csum += frame[i + 1] = msg[i];
+    frame[i + 1] = -csum;
+
+    return sizeof(msg) + BSMP_SERIAL_WRAP_SIZE;
+}
+
+// Plain sum of the bytes, as other peers compute it
+static uint8_t sum (const uint8_t *data, uint32_t len)
+{
+    uint8_t csum = 0;
+
+    while(len--)
+        csum += *data++;
+
+    return csum;
+}
+
+// Whether the client end gets anything within timeout_ms
+static bool readable (int timeout_ms)
+{
+    struct pollfd pfd = {.fd = client_end.fd, .events = POLLIN};
+    return poll(&pfd, 1, timeout_ms) > 0;
+}
+
+static void *serve (void *arg)
+{
+    (void) arg;
+
+    while(!quit)
+        bsmp_serial_serve(&server_end, &server);
+
+    return NULL;
+}
+
+// Framing, on the server end alone
+static void check_framing (void)
+{
+    uint8_t frames[2*8], *data, address;
+    uint32_t len, size;
+
+    // Two frames in one read are received one after the other
+    size  = read_frame(frames, ADDRESS, 0);
+    size += read_frame(frames + size, ADDRESS, 1);
+    CHECK(write(client_end.fd, frames, size) == size);
+
+    CHECK(!bsmp_serial_recv(&server_end, &address, &data, &len));
+    CHECK(address == ADDRESS && len == 4 && data[3] == 0);
+    CHECK(!bsmp_serial_recv(&server_end, &address, &data, &len));
+    CHECK(address == ADDRESS && len == 4 && data[3] == 1);
+
+    // Leading garbage is dropped up to the next valid frame
+    uint8_t junk[] = {0x11, 0x22, 0x00, 0x05, 0x33};
+    uint32_t errors = server_end.errors;
+
+    CHECK(write(client_end.fd, junk, sizeof(junk)) == sizeof(junk));
+    size = read_frame(frames, ADDRESS, 1);
+    CHECK(write(client_end.fd, frames, size) == size);
+
+    CHECK(!bsmp_serial_recv(&server_end, &address, &data, &len));
+    CHECK(address == ADDRESS && len == 4 && data[3] == 1);
+    CHECK(server_end.errors > errors);
+
+    // Frames to other devices are not answered
+    size = read_frame(frames, ADDRESS + 1, 0);
+    CHECK(write(client_end.fd, frames, size) == size);
+    CHECK(bsmp_serial_serve(&server_end, &server) == BSMP_ERR_TIMEOUT);
+    CHECK(!readable(100));
+
+    // Long frames carry the plain sum of their bytes, both ways
+    static uint8_t frame[BLOCK_SIZE + 8], got[BLOCK_SIZE + 8];
+    unsigned int i;
+
+    frame[0] = ADDRESS;
+    frame[1] = 0x41;                        // Curve block
+    frame[2] = (BLOCK_SIZE + 3) >> 8;
+    frame[3] = (uint8_t)(BLOCK_SIZE + 3);
+    frame[4] = frame[5] = frame[6] = 0;     // Curve 0, block 0
+    for(i = 0; i < BLOCK_SIZE; ++i)
+        frame[7 + i] = i*31 + (i >> 3);
+    size = BLOCK_SIZE + 7 + 1;
+    frame[size - 1] = -sum(frame, size - 1);
+    CHECK(write(client_end.fd, frame, size) == size);
+
+    CHECK(!bsmp_serial_recv(&server_end, &address, &data, &len));
+    CHECK(len == BLOCK_SIZE + 6 && !memcmp(data, frame + 1, len));
+
+    CHECK(!bsmp_serial_send(&server_end, frame + 1, BLOCK_SIZE + 6));
+    for(len = 0; len < size && readable(100); len += i)
+        CHECK((int)(i = read(client_end.fd, got + len, size - len)) > 0);
+    CHECK(len == size && !sum(got, size));
+
+    // Nothing left over
+    CHECK(bsmp_serial_recv(&server_end, &address, &data, &len));
+}
+
+// Requests of a client, answered by a server thread
+static void check_client (void)
+{
+    bsmp_client_t client;
+    struct bsmp_transport transport;
+    pthread_t thread;
+    uint8_t got[sizeof(table)];
+    uint8_t written[4] = {9, 8, 7, 6};
+    unsigned int i;
+
+    CHECK(!pthread_create(&thread, NULL, serve, NULL));
+
+    bsmp_serial_transport(&client_end, &transport);
+    CHECK(!bsmp_client_init_transport(&client, &transport, 1, NULL));
+    CHECK(client.vars.count == 2);
+
+    CHECK(!bsmp_read_var(&client, &client.vars.list[1], got));
+    CHECK(!memcmp(got, table, sizeof(table)));
+
+    CHECK(!bsmp_write_var(&client, &client.vars.list[0], written));
+    CHECK(!memcmp(value, written, sizeof(written)));
+    CHECK(!bsmp_read_var(&client, &client.vars.list[0], got));
+    CHECK(!memcmp(got, written, sizeof(written)));
+
+    // Long frames: a curve that doesn't compress, written and read back
+    static uint8_t curve_in[sizeof(blocks)], curve_out[sizeof(blocks)];
+    uint32_t curve_len;
+
+    for(i = 0; i < sizeof(curve_in); ++i)
+        curve_in[i] = rand();
+
+    CHECK(!bsmp_write_curve(&client, &client.curves.list[0], curve_in,
+                            sizeof(curve_in)));
+    CHECK(!memcmp(blocks, curve_in, sizeof(blocks)));
+    CHECK(!bsmp_read_curve(&client, &client.curves.list[0], curve_out,
+                           &curve_len));
+    CHECK(curve_len == sizeof(curve_out));
+    CHECK(!memcmp(curve_out, curve_in, sizeof(curve_out)));
+
+    quit = 1;
+    pthread_join(thread, NULL);
+}
+
+int main (void)
+{
+    int master, slave;
+    unsigned int i;
+
+    CHECK(!openpty(&master, &slave, NULL, NULL, NULL));
+
+    for(i = 0; i < sizeof(table); ++i)
+        table[i] = i*7;
+
+    bsmp_server_init(&server);
+    bsmp_register_variable(&server, &vars[0]);
+    bsmp_register_variable(&server, &vars[1]);
+    bsmp_register_curve(&server, &curve);
+
+    CHECK(bsmp_serial_attach(&server_end, master, 123, ADDRESS) ==
+          BSMP_ERR_PARAM_OUT_OF_RANGE);
+    CHECK(!bsmp_serial_attach(&server_end, master, 115200, ADDRESS));
+    CHECK(!bsmp_serial_attach(&client_end, slave, 115200, ADDRESS));
+    server_end.timeout_ms = 50;
+
+    check_framing();
+    check_client();
+
+    bsmp_serial_close(&client_end);
+    bsmp_serial_close(&server_end);
+
+    puts("ok");
+    return 0;
+}
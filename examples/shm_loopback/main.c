@@ -0,0 +1,115 @@
+// Round trips of variable reads through shared memory, to a server in a child
+// process, the way a device simulator runs next to the control software.
+//
+// Usage: shm_loopback [reads]
+
+#include <bsmp/server.h>
+#include <bsmp/client.h>
+#include <bsmp/shm.h>
+
+#include <signal.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+static uint8_t value[4];
+static struct bsmp_var var = {
+    .info = {.size = sizeof(value), .writable = false},
+    .data = value
+};
+
+static uint64_t now_ns (void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+static int cmp (const void *a, const void *b)
+{
+    unsigned int x = *(const unsigned int*) a, y = *(const unsigned int*) b;
+    return (x > y) - (x < y);
+}
+
+int main (int argc, char **argv)
+{
+    unsigned int nreads = argc > 1 ? atoi(argv[1]) : 100000;
+    unsigned int i;
+    enum bsmp_err err;
+
+    if(!nreads)
+    {
+        fprintf(stderr, "usage: %s [reads]\n", argv[0]);
+        return 1;
+    }
+
+    bsmp_shm_t server_end, client_end;
+
+    // The child inherits the anonymous segment
+    if((err = bsmp_shm_create(&server_end, NULL)))
+    {
+        fprintf(stderr, "create: %s\n", bsmp_error_str(err));
+        return 1;
+    }
+
+    pid_t pid = fork();
+
+    if(!pid)
+    {
+        bsmp_server_t server;
+
+        bsmp_server_init(&server);
+        bsmp_register_variable(&server, &var);
+
+        for(;;)
+            bsmp_shm_serve(&server_end, &server);
+    }
+
+    if((err = bsmp_shm_attach(&client_end, dup(server_end.fd))))
+    {
+        fprintf(stderr, "attach: %s\n", bsmp_error_str(err));
+        return 1;
+    }
+
+    bsmp_client_t client;
+    struct bsmp_transport transport;
+
+    bsmp_shm_transport(&client_end, &transport);
+
+    if((err = bsmp_client_init_transport(&client, &transport, 1, NULL)))
+    {
+        fprintf(stderr, "client: %s\n", bsmp_error_str(err));
+        return 1;
+    }
+
+    unsigned int *ns = malloc(nreads*sizeof(*ns));
+    unsigned int errors = 0;
+    uint8_t read[4];
+
+    for(i = 0; i < nreads; ++i)
+    {
+        uint64_t start = now_ns();
+
+        if(bsmp_read_var(&client, &client.vars.list[0], read))
+            ++errors;
+
+        ns[i] = now_ns() - start;
+    }
+
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+
+    qsort(ns, nreads, sizeof(*ns), cmp);
+
+    printf("round trip: p50 %.2f us, p99 %.2f us, max %.1f us\n",
+           ns[nreads/2]/1e3, ns[nreads*99/100]/1e3, ns[nreads - 1]/1e3);
+    printf("errors %u, spinning %u us before sleeping\n", errors,
+           client_end.spin_us);
+
+    bsmp_shm_close(&client_end);
+    bsmp_shm_close(&server_end);
+
+    return 0;
+}
@@ -0,0 +1,168 @@
+// Round trips of variable reads over loopback TCP: a server thread, and many
+// clients sharing a pool of connections.
+//
+// Usage: tcp_loopback [clients] [connections] [reads per client]
+
+#include <bsmp/server.h>
+#include <bsmp/client.h>
+#include <bsmp/tcp.h>
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#define MAX_CLIENTS     64
+
+static bsmp_server_t server;
+static bsmp_tcp_server_t tcp;
+static bsmp_tcp_pool_t pool;
+static volatile int quit;
+
+static uint8_t value[4];
+static struct bsmp_var var = {
+    .info = {.size = sizeof(value), .writable = false},
+    .data = value
+};
+
+static unsigned int nreads;
+
+struct client
+{
+    bsmp_client_t           client;
+    struct bsmp_tcp_link    link;
+    pthread_t               thread;
+    unsigned int            *ns;        // Of each round trip
+    unsigned int            errors;
+};
+
+static struct client clients[MAX_CLIENTS];
+
+static uint64_t now_ns (void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+static void *serve (void *arg)
+{
+    (void) arg;
+
+    while(!quit)
+        bsmp_tcp_serve(&tcp, 100);
+
+    return NULL;
+}
+
+static void *run (void *arg)
+{
+    struct client *c = arg;
+    struct bsmp_var_info *info = &c->client.vars.list[0];
+    uint8_t read[4];
+    unsigned int i;
+
+    for(i = 0; i < nreads; ++i)
+    {
+        uint64_t start = now_ns();
+
+        if(bsmp_read_var(&c->client, info, read))
+            ++c->errors;
+
+        c->ns[i] = now_ns() - start;
+    }
+
+    return NULL;
+}
+
+static int cmp (const void *a, const void *b)
+{
+    unsigned int x = *(const unsigned int*) a, y = *(const unsigned int*) b;
+    return (x > y) - (x < y);
+}
+
+int main (int argc, char **argv)
+{
+    unsigned int nclients = argc > 1 ? atoi(argv[1]) : 1;
+    unsigned int nconns   = argc > 2 ? atoi(argv[2]) : 1;
+    unsigned int i, j, errors = 0;
+    enum bsmp_err err;
+
+    nreads = argc > 3 ? atoi(argv[3]) : 100000;
+
+    if(!nclients || nclients > MAX_CLIENTS || !nreads)
+    {
+        fprintf(stderr, "usage: %s [clients] [connections] [reads]\n", argv[0]);
+        return 1;
+    }
+
+    bsmp_server_init(&server);
+    bsmp_register_variable(&server, &var);
+
+    if((err = bsmp_tcp_listen(&tcp, &server, "127.0.0.1", 0)) ||
+       (err = bsmp_tcp_pool_init(&pool, "127.0.0.1", tcp.port, nconns)))
+    {
+        fprintf(stderr, "setup: %s\n", bsmp_error_str(err));
+        return 1;
+    }
+
+    pthread_t server_thread;
+    pthread_create(&server_thread, NULL, serve, NULL);
+
+    for(i = 0; i < nclients; ++i)
+    {
+        struct bsmp_transport transport;
+
+        bsmp_tcp_transport(&pool, &clients[i].link, &transport);
+
+        if((err = bsmp_client_init_transport(&clients[i].client, &transport, 1,
+                                             NULL)))
+        {
+            fprintf(stderr, "client: %s\n", bsmp_error_str(err));
+            return 1;
+        }
+
+        clients[i].ns = malloc(nreads*sizeof(*clients[i].ns));
+    }
+
+    uint64_t start = now_ns();
+
+    for(i = 0; i < nclients; ++i)
+        pthread_create(&clients[i].thread, NULL, run, &clients[i]);
+
+    for(i = 0; i < nclients; ++i)
+        pthread_join(clients[i].thread, NULL);
+
+    uint64_t elapsed = now_ns() - start;
+
+    quit = 1;
+    pthread_join(server_thread, NULL);
+
+    // Latencies of every round trip, from every client
+    unsigned int total = nclients*nreads;
+    unsigned int *all = malloc(total*sizeof(*all));
+
+    for(i = 0; i < nclients; ++i)
+    {
+        for(j = 0; j < nreads; ++j)
+            all[i*nreads + j] = clients[i].ns[j];
+        errors += clients[i].errors;
+    }
+
+    qsort(all, total, sizeof(*all), cmp);
+
+    struct bsmp_tcp_stats stats;
+    bsmp_tcp_pool_stats(&pool, &stats);
+
+    printf("%u clients, %u connections: %.0f reads/s\n", nclients, nconns,
+           total/(elapsed/1e9));
+    printf("round trip: p50 %.1f us, p99 %.1f us, max %.1f us\n",
+           all[total/2]/1e3, all[total*99/100]/1e3, all[total - 1]/1e3);
+    printf("errors %u, connects %u, failures %u, waits %u\n", errors,
+           stats.connects, stats.failures, stats.waits);
+
+    bsmp_tcp_pool_destroy(&pool);
+    bsmp_tcp_close(&tcp);
+
+    return 0;
+}
@@ -3,9 +3,14 @@
 #ifndef BSMP_H
 #define BSMP_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /* Library-wide limits */
 
 #define BSMP_HEADER_SIZE            3       // Command code + 2 bytes for size
@@ -39,6 +44,16 @@ enum group_id
     GROUP_STANDARD_COUNT,
 };
 
+/* Scatter/gather */
+
+// A region of memory that is part of a message. It has the same layout as the
+// POSIX struct iovec, so a list of them can be handed to writev or sendmsg.
+struct bsmp_iov
+{
+    void    *base;
+    size_t  len;
+};
+
 /* Binary operations */
 
 enum bsmp_bin_op
@@ -70,6 +85,11 @@ enum bsmp_err
     BSMP_ERR_COMM,                  // There was a communication error reported
                                     // by one of the communication functions.
     BSMP_ERR_NOT_INITIALIZED,       // Instance wasn't initialized
+    BSMP_ERR_IO,                    // A backing file or device couldn't be
+                                    // accessed
+    BSMP_ERR_NOT_SUPPORTED,         // The server doesn't support the operation
+    BSMP_ERR_TIMEOUT,               // The response didn't arrive in time
+    BSMP_ERR_CHECKSUM,              // Data doesn't match its checksum
     BSMP_ERR_MAX
 };
 
@@ -161,6 +181,8 @@ typedef bool (*bsmp_curve_read_t)  (struct bsmp_curve *curve, uint16_t block,
                                     uint8_t *data, uint16_t *len);
 typedef bool (*bsmp_curve_write_t) (struct bsmp_curve *curve, uint16_t block,
                                     uint8_t *data, uint16_t len);
+typedef bool (*bsmp_curve_ptr_t)   (struct bsmp_curve *curve, uint16_t block,
+                                    uint8_t **data, uint16_t *len);
 struct bsmp_curve
 {
     // Info about the curve identification
@@ -173,6 +195,12 @@ struct bsmp_curve
     bool (*write_block)(struct bsmp_curve *curve, uint16_t block, uint8_t *data,
                         uint16_t len);
 
+    // Optional. Point to a block that already lives in contiguous memory
+    // instead of copying it. When present, it is used in place of read_block.
+    // The memory must remain valid until the answer has been sent.
+    bool (*get_block_ptr)(struct bsmp_curve *curve, uint16_t block,
+                          uint8_t **data, uint16_t *len);
+
     // The user can make use of this variable as he wishes. It is not touched by
     // BSMP
     void *user;
@@ -228,4 +256,8 @@ struct bsmp_func_ptr_list
  */
 char * bsmp_error_str (enum bsmp_err error);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
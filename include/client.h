@@ -3,26 +3,78 @@
 
 #include "bsmp.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 // Types
 
 // Communication function (send or receive data). Must return 0 if successful
 // and anything but 0 otherwise.
 typedef int (*bsmp_comm_func_t) (uint8_t* data, uint32_t *count);
 
+// Link of a client to its server. Functions get ctx as their first argument
+// and must return 0 if successful and anything but 0 otherwise.
+struct bsmp_transport
+{
+    void *ctx;
+
+    // Send a whole message of len bytes
+    int (*send) (void *ctx, uint8_t *data, uint32_t len);
+
+    // Receive a whole message into data, which holds up to BSMP_MAX_MESSAGE
+    // bytes, and set len to its size
+    int (*recv) (void *ctx, uint8_t *data, uint32_t *len);
+
+    // Optional. Send a whole message made of iovcnt regions. Large values are
+    // then sent from the caller's buffers, without being copied.
+    int (*sendv) (void *ctx, struct bsmp_iov *iov, unsigned int iovcnt);
+
+    // Optional, used instead of recv. Receive a whole message into a buffer of
+    // the transport and point data to it. It must remain valid until the next
+    // call.
+    int (*recv_zc) (void *ctx, uint8_t **data, uint32_t *len);
+};
+
+// Image of a group kept up to date by delta reads
+struct bsmp_group_image
+{
+    uint8_t  *values;           // Complete values of the group, NULL if unused
+    uint16_t seq;               // Sequence number of the last delta merged
+    uint32_t epoch;             // Of the server, as of the last changed read
+};
+
 // BSMP Client instance
 struct bsmp_client
 {
-    bsmp_comm_func_t            send, recv;
+    bsmp_comm_func_t            send, recv;     // Of bsmp_client_init
+    struct bsmp_transport       transport;
     struct bsmp_version         server_version;
     struct bsmp_var_info_list   vars;
     struct bsmp_group_list      groups;
     struct bsmp_curve_info_list curves;
     struct bsmp_func_info_list  funcs;
+    struct bsmp_group_image     images[BSMP_MAX_GROUPS];
+    bool                        curve_lz;   // Server compresses curve blocks
+    unsigned int                pipeline;   // Max. requests in flight
+
+    // Requests are encoded and responses received here, one at a time
+    uint8_t                     buf[BSMP_MAX_MESSAGE];
 };
 
 // Handle to a client instance
 typedef struct bsmp_client bsmp_client_t;
 
+// Read request encoded once, see bsmp_prepare_read_var
+struct bsmp_prepared
+{
+    bsmp_client_t   *client;
+    uint8_t         request[BSMP_HEADER_SIZE + 1];  // Header and entity ID
+    uint8_t         answer;         // Expected command code of the answer
+    uint16_t        size;           // Expected size of the answer
+    uint8_t         *dest;          // Where the answer goes
+};
+
 /*
  * Initializes an instance of the BSMP Client Library. Initialization means
  * that information about the server will be queried (list of variables, list
@@ -53,6 +105,101 @@ enum bsmp_err bsmp_client_init(bsmp_client_t *client,
                                bsmp_comm_func_t send_func,
                                bsmp_comm_func_t recv_func);
 
+/*
+ * Same as bsmp_client_init, but the lists of the server are queried with up to
+ * depth requests in flight (see bsmp_client_set_pipeline).
+ *
+ * @param client [input] Handle to the instance to be initialized
+ * @param send_func [input] Function used to send a message
+ * @param recv_func [input] Function used to receive a message
+ * @param depth [input] Maximum number of requests in flight
+ *
+ * @return BSMP_SUCCESS or one of the errors of bsmp_client_init or:
+ * <ul>
+ *   <li>BSMP_ERR_PARAM_OUT_OF_RANGE: depth is 0</li>
+ * </ul>
+ */
+enum bsmp_err bsmp_client_init_pipelined (bsmp_client_t *client,
+                                          bsmp_comm_func_t send_func,
+                                          bsmp_comm_func_t recv_func,
+                                          unsigned int depth);
+
+/*
+ * Same as bsmp_client_init, but the lists of the server are kept in a cache
+ * file to skip their discovery the next time.
+ *
+ * The server is first asked for its version and a fingerprint of its lists
+ * (variables, groups, curves with their checksums and functions). If the cache
+ * file holds lists with the same version and fingerprint, they are loaded and
+ * initialization takes a single round trip. Otherwise the lists are queried as
+ * by bsmp_client_init and the cache file is rewritten.
+ *
+ * Servers that don't support the query are initialized as by bsmp_client_init,
+ * without a cache. Failing to write the cache file is not an error.
+ *
+ * @param client [input] Handle to the instance to be initialized
+ * @param send_func [input] Function used to send a message
+ * @param recv_func [input] Function used to receive a message
+ * @param path [input] Cache file, one per server
+ *
+ * @return BSMP_SUCCESS or one of the errors of bsmp_client_init or:
+ * <ul>
+ *   <li>BSMP_ERR_PARAM_INVALID: path is a NULL pointer</li>
+ * </ul>
+ */
+enum bsmp_err bsmp_client_init_cached (bsmp_client_t *client,
+                                       bsmp_comm_func_t send_func,
+                                       bsmp_comm_func_t recv_func,
+                                       const char *path);
+
+/*
+ * Initializes an instance of the BSMP Client Library on top of a transport.
+ * Unlike the communication functions of bsmp_client_init, transports carry a
+ * context, so that any number of clients can share an implementation.
+ *
+ * @param client [input] Handle to the instance to be initialized
+ * @param transport [input] Link to the server. It's copied to the instance.
+ * @param depth [input] Maximum number of requests in flight (see
+ *                      bsmp_client_init_pipelined)
+ * @param cache [input] Cache file of the lists of the server (see
+ *                      bsmp_client_init_cached), or NULL not to use one
+ *
+ * @return BSMP_SUCCESS or one of the errors of bsmp_client_init or:
+ * <ul>
+ *   <li>BSMP_ERR_PARAM_INVALID: transport is a NULL pointer or lacks both recv
+ *                               and recv_zc, or its send is NULL</li>
+ *   <li>BSMP_ERR_PARAM_OUT_OF_RANGE: depth is 0</li>
+ * </ul>
+ */
+enum bsmp_err bsmp_client_init_transport (bsmp_client_t *client,
+                                          const struct bsmp_transport *transport,
+                                          unsigned int depth, const char *cache);
+
+/*
+ * Sets how many requests bulk operations keep in flight: bsmp_read_curve,
+ * bsmp_write_curve and the updates of the lists of groups and curves. Their
+ * responses are matched in order.
+ *
+ * The default depth, 1, waits for each response before sending the next
+ * request. Greater depths need a full-duplex link, where the server takes new
+ * requests while the client hasn't read older responses yet (TCP, for
+ * instance), and a recv_func that returns exactly one message per call.
+ *
+ * If a request fails, no more requests are sent, but the responses to the ones
+ * already in flight are still received and dropped.
+ *
+ * @param client [input] A BSMP Client Library instance
+ * @param depth [input] Maximum number of requests in flight
+ *
+ * @return BSMP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>BSMP_ERR_PARAM_INVALID: client is a NULL pointer</li>
+ *   <li>BSMP_ERR_PARAM_OUT_OF_RANGE: depth is 0</li>
+ * </ul>
+ */
+enum bsmp_err bsmp_client_set_pipeline (bsmp_client_t *client,
+                                        unsigned int depth);
+
 /*
  * Returns a pointer to a struct describing the server version of the protocol.
  *
@@ -233,6 +380,110 @@ enum bsmp_err bsmp_write_read_vars (bsmp_client_t *client,
 enum bsmp_err bsmp_read_group (bsmp_client_t *client, struct bsmp_group *grp,
                                uint8_t *values);
 
+/*
+ * Makes bsmp_read_group use delta reads for a group. The server then answers
+ * with the values of only the variables that changed since the last read,
+ * which are merged into an image of the group kept by the client. Callers of
+ * bsmp_read_group still get the complete values.
+ *
+ * If the server doesn't support delta reads, bsmp_read_group silently goes back
+ * to plain reads for that group.
+ *
+ * Creating or removing groups turns delta reads off for every group, since the
+ * layout of the groups may have changed.
+ *
+ * @param client [input] A BSMP Client Library instance
+ * @param grp [input] The group to be read with delta reads
+ * @param image [input] Buffer of grp->size bytes to keep the image of the
+ *                      group. Must remain valid while delta reads are on. Pass
+ *                      NULL to turn delta reads off for the group.
+ *
+ * @return BSMP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>BSMP_ERR_PARAM_INVALID: client or grp is a NULL pointer</li>
+ *   <li>BSMP_ERR_PARAM_INVALID: grp is not a valid server group</li>
+ * </ul>
+ */
+enum bsmp_err bsmp_group_delta_enable (bsmp_client_t *client,
+                                       struct bsmp_group *grp, uint8_t *image);
+
+/*
+ * Reads only the values of the variables of a group that changed since a given
+ * generation of the server.
+ *
+ * The values buffer MUST be able to hold group->size bytes and is expected to
+ * contain the values read by the previous call: only the values of the
+ * changed variables are written to it. On return, generation holds the
+ * generation to be passed to the next call.
+ *
+ * Pass a generation of 0 to read all values. If the server was restarted, as
+ * told by a change of its epoch, all values are read again as well. While the
+ * group is latched, the whole snapshot is read, along with the generation it
+ * was taken at.
+ *
+ * @param client [input] A BSMP Client Library instance
+ * @param grp [input] The group to be read
+ * @param values [input/output] Pointer to a buffer holding the group values
+ * @param generation [input/output] Generation of the last read
+ *
+ * @return BSMP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>BSMP_ERR_PARAM_INVALID: client, grp, values or generation is a NULL
+ *                               pointer</li>
+ *   <li>BSMP_ERR_PARAM_INVALID: grp is not a valid server group</li>
+ *   <li>BSMP_ERR_COMM: There was a failure either sending or receiving a
+ *                      message</li>
+ * </ul>
+ */
+enum bsmp_err bsmp_read_group_changed (bsmp_client_t *client,
+                                       struct bsmp_group *grp, uint8_t *values,
+                                       uint32_t *generation);
+
+/*
+ * Prepares a read of a variable or a group to be repeated by
+ * bsmp_prepared_exec. The request is validated and encoded once, and the value
+ * always goes to the same buffer.
+ *
+ * A prepared group read is a plain read, even if delta reads are on for the
+ * group. Prepare it again after creating or removing groups.
+ *
+ * @param client [input] A BSMP Client Library instance
+ * @param prepared [output] The prepared read
+ * @param var [input] The variable to be read
+ * @param grp [input] The group to be read
+ * @param dest [input] Buffer of var->size or grp->size bytes where the value
+ *                     goes. Must remain valid while the read is used.
+ *
+ * @return BSMP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>BSMP_ERR_PARAM_INVALID: client, prepared, var, grp or dest is a NULL
+ *                               pointer</li>
+ *   <li>BSMP_ERR_PARAM_INVALID: var or grp is not a valid server entity</li>
+ * </ul>
+ */
+enum bsmp_err bsmp_prepare_read_var (bsmp_client_t *client,
+                                     struct bsmp_prepared *prepared,
+                                     struct bsmp_var_info *var, uint8_t *dest);
+
+enum bsmp_err bsmp_prepare_read_group (bsmp_client_t *client,
+                                       struct bsmp_prepared *prepared,
+                                       struct bsmp_group *grp, uint8_t *dest);
+
+/*
+ * Sends a prepared read as is and copies the value in its answer to the buffer
+ * given when it was prepared. The buffer is left untouched if the read fails.
+ *
+ * @param prepared [input] A read prepared by one of the functions above
+ *
+ * @return BSMP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>BSMP_ERR_PARAM_INVALID: prepared is a NULL pointer</li>
+ *   <li>BSMP_ERR_COMM: There was a failure either sending or receiving a
+ *                      message</li>
+ * </ul>
+ */
+enum bsmp_err bsmp_prepared_exec (struct bsmp_prepared *prepared);
+
 /*
  * Writes values to variables in a group from a caller provided buffer.
  *
@@ -297,6 +548,33 @@ enum bsmp_err bsmp_bin_op_var (bsmp_client_t *client, enum bsmp_bin_op op,
 enum bsmp_err bsmp_bin_op_group (bsmp_client_t *client, enum bsmp_bin_op op,
                                  struct bsmp_group *grp, uint8_t *mask);
 
+/*
+ * Perform the same binary operation, with the same mask, in every variable of
+ * a group. Only one mask is sent, regardless of the number of variables.
+ *
+ * All variables in the group MUST have the same size. The mask MUST contain
+ * that many bytes.
+ *
+ * @param client [input] A BSMP Client Library instance
+ * @param op [input] The binary operation to be performed
+ * @param grp [input] The group to perform the operation
+ * @param mask [input] Pointer to a buffer containing the mask
+ *
+ * @return BSMP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>BSMP_ERR_PARAM_INVALID: client, grp or mask is a NULL pointer</li>
+ *   <li>BSMP_ERR_PARAM_INVALID: grp is not a valid server group, is empty or
+ *                               its variables aren't all of the same size</li>
+ *   <li>BSMP_ERR_PARAM_OUT_OF_RANGE: op isn't one of the supported
+ *                                    operations</li>
+ *   <li>BSMP_ERR_COMM: There was a failure either sending or receiving a
+ *                      message</li>
+ * </ul>
+ */
+enum bsmp_err bsmp_bin_op_group_bcast (bsmp_client_t *client,
+                                       enum bsmp_bin_op op,
+                                       struct bsmp_group *grp, uint8_t *mask);
+
 /*
  * Creates a group of variables from the specified variables list.
  *
@@ -335,6 +613,29 @@ enum bsmp_err bsmp_create_group (bsmp_client_t *client,
  */
 enum bsmp_err bsmp_remove_all_groups (bsmp_client_t *client);
 
+/*
+ * Makes the server take a snapshot of the values of a group. Until another
+ * group is latched or the latch is released, reads of the group with
+ * bsmp_read_group answer with the snapshot.
+ *
+ * To sample many servers at the same instant, broadcast the latch instead (see
+ * bsmp_bus_latch_group_all).
+ *
+ * @param client [input] A BSMP Client Library instance
+ * @param grp [input] The group to be latched, NULL to release the latch
+ *
+ * @return BSMP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>BSMP_ERR_PARAM_INVALID: client is a NULL pointer or grp is not a valid
+ *                               server group</li>
+ *   <li>BSMP_ERR_NOT_SUPPORTED: the server has no memory for the snapshot of
+ *                               the group, or doesn't support latches</li>
+ *   <li>BSMP_ERR_COMM: There was a failure either sending or receiving a
+ *                      message</li>
+ * </ul>
+ */
+enum bsmp_err bsmp_latch_group (bsmp_client_t *client, struct bsmp_group *grp);
+
 /*
  * Read a block of values from a specified curve.
  *
@@ -361,12 +662,45 @@ enum bsmp_err bsmp_request_curve_block (bsmp_client_t *client,
                                         uint16_t offset, uint8_t *data,
                                         uint16_t *len);
 
+/*
+ * Same as bsmp_request_curve_block, but the server is asked to compress the
+ * block. Servers send the block as is when compression doesn't pay off.
+ *
+ * If the server doesn't support compression, the block is requested again
+ * uncompressed and compression is not asked for anymore (client->curve_lz is
+ * cleared).
+ *
+ * The data buffer MUST be able to hold up to curve->block_size bytes.
+ *
+ * @param client [input] A BSMP Client Library instance
+ * @param curve [input] The curve to be read
+ * @param offset [input] The block to be fetched
+ * @param data [output] Buffer to hold the read data
+ * @param len [output] Pointer to a variable to hold the number of bytes written
+ *                     to the buffer
+ *
+ * @return BSMP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>BSMP_ERR_PARAM_INVALID: client, curve, data or len is a NULL
+ *                               pointer</li>
+ *   <li>BSMP_ERR_OUT_OF_RANGE: offset is not less than curve->nblocks</li>
+ *   <li>BSMP_ERR_COMM: There was a failure either sending or receiving a
+ *                      message, or the compressed block was malformed</li>
+ * </ul>
+ */
+enum bsmp_err bsmp_request_curve_block_lz (bsmp_client_t *client,
+                                           struct bsmp_curve_info *curve,
+                                           uint16_t offset, uint8_t *data,
+                                           uint16_t *len);
+
 /*
  * Read all blocks of from a specified curve.
  *
  * The functions stops when all the blocks have been read or when a block read
  * returned less than curve->block_size bytes.
  *
+ * Blocks are read with bsmp_request_curve_block_lz.
+ *
  * The data buffer MUST be able to hold up to curve->nblocks*curve->block_size
  * bytes.
  *
@@ -411,10 +745,39 @@ enum bsmp_err bsmp_send_curve_block (bsmp_client_t *client,
                                      uint16_t offset, uint8_t *data,
                                      uint16_t len);
 
+/*
+ * Same as bsmp_send_curve_block, but the block is compressed before being sent.
+ * It's sent as is when compression doesn't pay off.
+ *
+ * If the server doesn't support compression, the block is sent again
+ * uncompressed and compression is not tried anymore (client->curve_lz is
+ * cleared).
+ *
+ * @param client [input] A BSMP Client Library instance
+ * @param curve [input] The curve to be written
+ * @param offset [input] The block to be written
+ * @param data [input] Buffer containing the data to be written
+ * @param len [input] number of bytes from the buffer to be sent
+ *
+ * @return BSMP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>BSMP_ERR_PARAM_INVALID: client, curve or data is a NULL pointer</li>
+ *   <li>BSMP_ERR_OUT_OF_RANGE: offset is not less than curve->nblocks</li>
+ *   <li>BSMP_ERR_OUT_OF_RANGE: len is greater than curve->block_size</li>
+ *   <li>BSMP_ERR_COMM: There was a failure either sending or receiving a
+ *                      message</li>
+ * </ul>
+ */
+enum bsmp_err bsmp_send_curve_block_lz (bsmp_client_t *client,
+                                        struct bsmp_curve_info *curve,
+                                        uint16_t offset, uint8_t *data,
+                                        uint16_t len);
+
 /*
  * Write sequentially to the blocks of a Curve.
  *
  * This function writes, at most, curve->nblocks*curve->block_size to the curve.
+ * Blocks are written with bsmp_send_curve_block_lz.
  *
  * @param client [input] A BSMP Client Library instance
  * @param curve [input] The curve to be written to
@@ -477,5 +840,9 @@ enum bsmp_err bsmp_func_execute (bsmp_client_t *client,
                                  struct bsmp_func_info *func, uint8_t *error,
                                  uint8_t *input, uint8_t *output);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
 
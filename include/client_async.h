@@ -0,0 +1,201 @@
+#ifndef BSMP_CLIENT_ASYNC_H
+#define BSMP_CLIENT_ASYNC_H
+
+#include "client.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Maximum number of requests waiting for their responses
+#ifndef BSMP_ASYNC_MAX_PENDING
+#define BSMP_ASYNC_MAX_PENDING      32
+#endif
+
+// Types
+
+// Send a whole message. Must return 0 if successful and anything but 0
+// otherwise.
+typedef int (*bsmp_async_send_t) (void *ctx, uint8_t *data, uint32_t len);
+
+// Read up to len bytes of the incoming stream of messages without blocking.
+// Must return the number of bytes read, 0 if there was nothing to read or a
+// negative number in case of error.
+typedef int (*bsmp_async_read_t) (void *ctx, uint8_t *data, uint32_t len);
+
+typedef struct bsmp_async bsmp_async_t;
+
+// Completion callback. err is BSMP_SUCCESS if the destination given when the
+// request was submitted was filled in.
+typedef void (*bsmp_async_cb_t) (bsmp_async_t *async, enum bsmp_err err,
+                                 void *user);
+
+// Request waiting for its response
+struct bsmp_async_pending
+{
+    enum bsmp_err (*decode) (struct bsmp_async_pending *pending,
+                             uint8_t code, uint8_t *payload, uint16_t size);
+
+    bsmp_async_cb_t cb;
+    void            *user;
+    uint32_t        deadline;       // When it times out, in ms
+
+    // Where the response goes
+    void            *info;          // Variable, group, curve or function
+    uint8_t         *data;
+    uint16_t        *len;
+    uint8_t         *error;
+};
+
+// Asynchronous BSMP Client instance
+struct bsmp_async
+{
+    bsmp_client_t       *client;
+    void                *ctx;
+    bsmp_async_send_t   send;
+    bsmp_async_read_t   read;
+    uint32_t            timeout;    // Timeout of each request, in ms
+    uint32_t            now;        // Time of the last tick, in ms
+
+    // Requests in the order they were sent, which is the order of the
+    // responses
+    struct bsmp_async_pending pending[BSMP_ASYNC_MAX_PENDING];
+    unsigned int        head, count;
+
+    // Message being received
+    uint8_t             rx[BSMP_MAX_MESSAGE];
+    uint32_t            rx_len;
+
+    // After a timeout, incoming data is dropped until the link is quiet
+    bool                resync;
+    uint32_t            quiet;      // When it's considered quiet, in ms
+};
+
+/*
+ * Initializes an asynchronous client on top of a client already initialized
+ * with bsmp_client_init, whose lists of entities it uses.
+ *
+ * Requests are sent as soon as they are submitted and their responses are
+ * matched in order. An event loop drives the instance: bsmp_async_readable when
+ * the link has data to read and bsmp_async_tick periodically.
+ *
+ * Requests are encoded in the buffer of the client: don't use both from
+ * different threads, nor call synchronous functions while asynchronous
+ * requests are pending.
+ *
+ * @param async [input] Handle to the instance to be initialized
+ * @param client [input] An initialized BSMP Client Library instance
+ * @param ctx [input] Context passed to send and read
+ * @param send [input] Function used to send a message
+ * @param read [input] Function used to read incoming data without blocking
+ * @param timeout [input] Time, in ms, a request waits for its response
+ *
+ * @return BSMP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>BSMP_ERR_PARAM_INVALID: async, client, send or read is a NULL
+ *                               pointer</li>
+ * </ul>
+ */
+enum bsmp_err bsmp_async_init (bsmp_async_t *async, bsmp_client_t *client,
+                               void *ctx, bsmp_async_send_t send,
+                               bsmp_async_read_t read, uint32_t timeout);
+
+/*
+ * Reads whatever is available on the link and completes the requests whose
+ * responses arrived. To be called when the link is readable.
+ *
+ * Callbacks are called from within this function and may submit new requests.
+ *
+ * @param async [input] An asynchronous client
+ *
+ * @return BSMP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>BSMP_ERR_PARAM_INVALID: async is a NULL pointer</li>
+ *   <li>BSMP_ERR_COMM: reading failed. Every pending request was completed with
+ *                      this error.</li>
+ * </ul>
+ */
+enum bsmp_err bsmp_async_readable (bsmp_async_t *async);
+
+/*
+ * Advances the clock of the instance and times out late requests. To be
+ * called periodically.
+ *
+ * Since responses carry no request identifier, a late response can't be told
+ * from the response to the next request. Once a request times out, every
+ * request in flight is completed with BSMP_ERR_TIMEOUT, and the link is
+ * resynchronized: whatever arrives is dropped until nothing has arrived for a
+ * whole timeout. New requests are refused meanwhile.
+ *
+ * @param async [input] An asynchronous client
+ * @param now [input] Current time, in ms, from any monotonic clock. It may wrap
+ *                    around.
+ *
+ * @return BSMP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>BSMP_ERR_PARAM_INVALID: async is a NULL pointer</li>
+ * </ul>
+ */
+enum bsmp_err bsmp_async_tick (bsmp_async_t *async, uint32_t now);
+
+/*
+ * Returns the number of requests waiting for their responses.
+ *
+ * @param async [input] An asynchronous client
+ */
+unsigned int bsmp_async_pending (bsmp_async_t *async);
+
+/*
+ * The following functions submit a request equivalent to the synchronous
+ * function of the same name. Output buffers must remain valid until the
+ * callback is called.
+ *
+ * Besides the errors of the synchronous functions, they may return:
+ * <ul>
+ *   <li>BSMP_ERR_OUT_OF_MEMORY: BSMP_ASYNC_MAX_PENDING requests are
+ *                               pending</li>
+ *   <li>BSMP_ERR_TIMEOUT: the link is being resynchronized after a
+ *                         timeout</li>
+ * </ul>
+ *
+ * The callback is not called if the request couldn't be submitted.
+ */
+enum bsmp_err bsmp_async_read_var (bsmp_async_t *async,
+                                   struct bsmp_var_info *var, uint8_t *value,
+                                   bsmp_async_cb_t cb, void *user);
+
+enum bsmp_err bsmp_async_write_var (bsmp_async_t *async,
+                                    struct bsmp_var_info *var, uint8_t *value,
+                                    bsmp_async_cb_t cb, void *user);
+
+enum bsmp_err bsmp_async_read_group (bsmp_async_t *async,
+                                     struct bsmp_group *grp, uint8_t *values,
+                                     bsmp_async_cb_t cb, void *user);
+
+enum bsmp_err bsmp_async_write_group (bsmp_async_t *async,
+                                      struct bsmp_group *grp, uint8_t *values,
+                                      bsmp_async_cb_t cb, void *user);
+
+enum bsmp_err bsmp_async_request_curve_block (bsmp_async_t *async,
+                                              struct bsmp_curve_info *curve,
+                                              uint16_t offset, uint8_t *data,
+                                              uint16_t *len, bsmp_async_cb_t cb,
+                                              void *user);
+
+enum bsmp_err bsmp_async_send_curve_block (bsmp_async_t *async,
+                                           struct bsmp_curve_info *curve,
+                                           uint16_t offset, uint8_t *data,
+                                           uint16_t len, bsmp_async_cb_t cb,
+                                           void *user);
+
+enum bsmp_err bsmp_async_func_execute (bsmp_async_t *async,
+                                       struct bsmp_func_info *func,
+                                       uint8_t *error, uint8_t *input,
+                                       uint8_t *output, bsmp_async_cb_t cb,
+                                       void *user);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,152 @@
+#ifndef BSMP_CLIENT_CORO_HPP
+#define BSMP_CLIENT_CORO_HPP
+
+// C++20 coroutines on top of the asynchronous client (client_async.h).
+//
+//     bsmp::task session(bsmp::client &cli, struct bsmp_group *grp)
+//     {
+//         std::vector<uint8_t> values(grp->size);
+//         for(;;)
+//             if(co_await cli.read_group(grp, values.data()) == BSMP_SUCCESS)
+//                 ...
+//     }
+//
+// A coroutine suspends on co_await and is resumed from the callback of the
+// request, that is, from within bsmp_async_readable or bsmp_async_tick. The
+// event loop that calls them is up to the application: poll, epoll, a
+// multishot io_uring poll on the link's fd, Asio... Many sessions, each with
+// its own bsmp_async_t, can then share one thread.
+
+#include <coroutine>
+#include <exception>
+
+#include "client_async.h"
+
+namespace bsmp
+{
+
+// Coroutine started right away and never awaited: a session with a device
+struct task
+{
+    struct promise_type
+    {
+        task get_return_object () noexcept { return {}; }
+        std::suspend_never initial_suspend () noexcept { return {}; }
+        std::suspend_never final_suspend () noexcept { return {}; }
+        void return_void () noexcept {}
+        void unhandled_exception () noexcept { std::terminate(); }
+    };
+};
+
+// Request awaited by a coroutine. submit calls one of the bsmp_async_*
+// functions with the callback and user pointer it's given.
+template <typename Submit>
+class operation
+{
+public:
+    explicit operation (bsmp_async_t *async, Submit submit)
+        : async_(async), submit_(submit) {}
+
+    bool await_ready () const noexcept { return false; }
+
+    // Don't suspend if the request couldn't even be submitted
+    bool await_suspend (std::coroutine_handle<> handle) noexcept
+    {
+        handle_ = handle;
+        err_    = submit_(async_, &operation::done, this);
+        return err_ == BSMP_SUCCESS;
+    }
+
+    enum bsmp_err await_resume () const noexcept { return err_; }
+
+private:
+    static void done (bsmp_async_t *, enum bsmp_err err, void *user)
+    {
+        operation *op = static_cast<operation *>(user);
+        op->err_ = err;
+        op->handle_.resume();
+    }
+
+    bsmp_async_t            *async_;
+    Submit                  submit_;
+    std::coroutine_handle<> handle_;
+    enum bsmp_err           err_ = BSMP_SUCCESS;
+};
+
+// Awaitable version of the functions of client_async.h. Output buffers must
+// stay valid until the co_await returns.
+class client
+{
+public:
+    explicit client (bsmp_async_t &async) : async_(&async) {}
+
+    bsmp_async_t *async () const noexcept { return async_; }
+
+    auto read_var (struct bsmp_var_info *var, uint8_t *value)
+    {
+        return make([=] (bsmp_async_t *a, bsmp_async_cb_t cb, void *u) {
+            return bsmp_async_read_var(a, var, value, cb, u);
+        });
+    }
+
+    auto write_var (struct bsmp_var_info *var, uint8_t *value)
+    {
+        return make([=] (bsmp_async_t *a, bsmp_async_cb_t cb, void *u) {
+            return bsmp_async_write_var(a, var, value, cb, u);
+        });
+    }
+
+    auto read_group (struct bsmp_group *grp, uint8_t *values)
+    {
+        return make([=] (bsmp_async_t *a, bsmp_async_cb_t cb, void *u) {
+            return bsmp_async_read_group(a, grp, values, cb, u);
+        });
+    }
+
+    auto write_group (struct bsmp_group *grp, uint8_t *values)
+    {
+        return make([=] (bsmp_async_t *a, bsmp_async_cb_t cb, void *u) {
+            return bsmp_async_write_group(a, grp, values, cb, u);
+        });
+    }
+
+    auto request_curve_block (struct bsmp_curve_info *curve, uint16_t offset,
+                              uint8_t *data, uint16_t *len)
+    {
+        return make([=] (bsmp_async_t *a, bsmp_async_cb_t cb, void *u) {
+            return bsmp_async_request_curve_block(a, curve, offset, data, len,
+                                                  cb, u);
+        });
+    }
+
+    auto send_curve_block (struct bsmp_curve_info *curve, uint16_t offset,
+                           uint8_t *data, uint16_t len)
+    {
+        return make([=] (bsmp_async_t *a, bsmp_async_cb_t cb, void *u) {
+            return bsmp_async_send_curve_block(a, curve, offset, data, len,
+                                               cb, u);
+        });
+    }
+
+    auto func_execute (struct bsmp_func_info *func, uint8_t *error,
+                       uint8_t *input, uint8_t *output)
+    {
+        return make([=] (bsmp_async_t *a, bsmp_async_cb_t cb, void *u) {
+            return bsmp_async_func_execute(a, func, error, input, output,
+                                           cb, u);
+        });
+    }
+
+private:
+    template <typename Submit>
+    operation<Submit> make (Submit submit)
+    {
+        return operation<Submit>(async_, submit);
+    }
+
+    bsmp_async_t *async_;
+};
+
+}
+
+#endif
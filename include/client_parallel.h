@@ -0,0 +1,63 @@
+#ifndef BSMP_CLIENT_PARALLEL_H
+#define BSMP_CLIENT_PARALLEL_H
+
+#include "client.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Clients reading a curve at once
+#ifndef BSMP_PARALLEL_MAX_CLIENTS
+#define BSMP_PARALLEL_MAX_CLIENTS   16
+#endif
+
+/*
+ * Read all blocks of a curve over several connections to the same server at
+ * once (POSIX threads only).
+ *
+ * The blocks are split in count contiguous ranges, one per client, each read
+ * by its own thread into its place in the data buffer. Requests are pipelined
+ * on each connection as set with bsmp_client_set_pipeline.
+ *
+ * As with bsmp_read_curve, the curve ends at its first short block: whatever
+ * was read past it is not counted in len, and errors past it are ignored.
+ *
+ * The data buffer MUST be able to hold up to curve->nblocks*curve->block_size
+ * bytes.
+ *
+ * @param clients [input] Array of count BSMP Client Library instances, each
+ *                        with its own connection to the server
+ * @param count [input] Number of clients, up to BSMP_PARALLEL_MAX_CLIENTS
+ * @param curve [input] The curve to be read, from the list of clients[0]
+ * @param data [output] Buffer to hold the read data
+ * @param len [output] Pointer to a variable to hold the number of bytes written
+ *                     to the buffer
+ * @param verify [input] Whether to check the data against the checksum the
+ *                       server has for the curve, once it's read
+ *
+ * @return BSMP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>BSMP_ERR_PARAM_INVALID: clients, curve, data or len is a NULL
+ *                               pointer, count is 0 or the clients don't have
+ *                               the same curve</li>
+ *   <li>BSMP_ERR_PARAM_OUT_OF_RANGE: count is greater than
+ *                                    BSMP_PARALLEL_MAX_CLIENTS</li>
+ *   <li>BSMP_ERR_OUT_OF_MEMORY: a thread couldn't be created</li>
+ *   <li>BSMP_ERR_COMM: There was a failure either sending or receiving a
+ *                      message</li>
+ *   <li>BSMP_ERR_CHECKSUM: verify is true and the data doesn't match the
+ *                          checksum of the curve</li>
+ * </ul>
+ */
+enum bsmp_err bsmp_read_curve_parallel (bsmp_client_t **clients,
+                                        unsigned int count,
+                                        struct bsmp_curve_info *curve,
+                                        uint8_t *data, uint32_t *len,
+                                        bool verify);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
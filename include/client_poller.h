@@ -0,0 +1,203 @@
+#ifndef BSMP_CLIENT_POLLER_H
+#define BSMP_CLIENT_POLLER_H
+
+#include <pthread.h>
+
+#include "client.h"
+#include "client_ring.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Maximum number of physical links, each served by its own thread
+#ifndef BSMP_POLL_MAX_LINKS
+#define BSMP_POLL_MAX_LINKS         64
+#endif
+
+// Maximum number of threads running the completion callbacks
+#ifndef BSMP_POLL_MAX_WORKERS
+#define BSMP_POLL_MAX_WORKERS       16
+#endif
+
+// Maximum number of devices
+#ifndef BSMP_POLL_MAX_DEVICES
+#define BSMP_POLL_MAX_DEVICES       1024
+#endif
+
+// Types
+
+typedef struct bsmp_poller bsmp_poller_t;
+struct bsmp_poll_device;
+
+// Called once per cycle for each device, from one of the workers, after its
+// read plan was executed. err is the first error of the plan, if any. The
+// destination buffers of the plan are not touched until the next cycle.
+typedef void (*bsmp_poll_done_t) (struct bsmp_poll_device *dev,
+                                  enum bsmp_err err, void *user);
+
+// Timing of a cycle, in us
+struct bsmp_poll_stats
+{
+    uint32_t        cycle;          // Number of the cycle, from 0
+    uint32_t        acquire_us;     // Until the slowest link was done
+    uint32_t        cycle_us;       // Until every callback returned
+    unsigned int    errors;         // Devices whose plan failed
+    uint32_t        overruns;       // Cycles so far longer than the period
+    uint32_t        steals;         // Callbacks run by another worker so far
+};
+
+// Called by the poller's clock thread at the end of each cycle
+typedef void (*bsmp_poll_stats_t) (bsmp_poller_t *poller,
+                                   const struct bsmp_poll_stats *stats,
+                                   void *user);
+
+// Device polled every cycle
+struct bsmp_poll_device
+{
+    bsmp_client_t           *client;
+    unsigned int            link;       // Physical link of the client
+    struct bsmp_prepared    *plan;      // Reads executed in order each cycle
+    unsigned int            nreads;
+    bsmp_poll_done_t        done;       // May be NULL
+    void                    *user;
+    bsmp_ring_t             *ring;      // Gets the first read, may be NULL
+
+    // Filled in every cycle
+    enum bsmp_err           err;
+    uint32_t                read_us;    // Time taken by the plan
+};
+
+// Physical link, whose devices are read one after the other by its thread
+struct bsmp_poll_link
+{
+    bsmp_poller_t           *poller;
+    pthread_t               thread;
+    unsigned int            first, count;   // Its devices in the poller's order
+    unsigned int            worker;         // Where their callbacks are queued
+};
+
+// Worker running callbacks. Others steal from the head of its queue when
+// theirs is empty.
+struct bsmp_poll_worker
+{
+    bsmp_poller_t           *poller;
+    pthread_t               thread;
+    pthread_mutex_t         lock;
+    struct bsmp_poll_device *jobs[BSMP_POLL_MAX_DEVICES];
+    unsigned int            head, tail;
+};
+
+// Poller instance
+struct bsmp_poller
+{
+    struct bsmp_poll_device *devices;
+    unsigned int            count;
+    uint32_t                period_us;
+    bsmp_poll_stats_t       stats_cb;
+    void                    *user;
+
+    // Devices sorted by link, in the order they were given within a link
+    struct bsmp_poll_device *order[BSMP_POLL_MAX_DEVICES];
+
+    struct bsmp_poll_link   links[BSMP_POLL_MAX_LINKS];
+    unsigned int            nlinks;     // Links with devices
+
+    struct bsmp_poll_worker workers[BSMP_POLL_MAX_WORKERS];
+    unsigned int            nworkers;
+
+    pthread_t               clock;
+
+    // Cycle state, under lock
+    pthread_mutex_t         lock;
+    pthread_cond_t          start;      // A cycle started or stop was asked
+    pthread_cond_t          work;       // Callbacks were queued
+    pthread_cond_t          idle;       // The last callback of the cycle returned
+    uint32_t                cycle;      // Number of the running cycle + 1
+    unsigned int            queued;     // Callbacks queued, not yet taken
+    unsigned int            pending;    // Devices not done this cycle
+    unsigned int            links_done;
+    uint64_t                acquired;   // When the last link was done, in us
+    bool                    running;
+    bool                    stop;       // No more cycles
+    bool                    quit;       // Threads are to return
+
+    struct bsmp_poll_stats  stats;
+};
+
+/*
+ * Initializes a poller (POSIX threads only).
+ *
+ * Each cycle, the read plan of every device is executed by the thread of its
+ * link, devices of the same link one after the other, and different links in
+ * parallel. As soon as a device is read, its completion callback is queued to
+ * a pool of workers, which balance the load by stealing each other's work.
+ * If a device has a ring, the first read of its plan is published to it, see
+ * bsmp_ring_read, for a consumer thread to take without locking.
+ * The next cycle starts when every callback of the cycle returned, on the next
+ * multiple of the period.
+ *
+ * Clients on the same link must not be used elsewhere while the poller runs.
+ *
+ * @param poller [input] Handle to the instance to be initialized
+ * @param devices [input] Array of count devices. Must remain valid while the
+ *                        poller is initialized.
+ * @param count [input] Number of devices
+ * @param workers [input] Number of workers running the callbacks
+ * @param period_us [input] Period of the cycles, in us
+ * @param stats_cb [input] Function called at the end of each cycle, or NULL
+ * @param user [input] Passed to stats_cb
+ *
+ * @return BSMP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>BSMP_ERR_PARAM_INVALID: poller or devices is a NULL pointer, or a
+ *                               device has no client or no plan, or has a
+ *                               ring for samples of another size</li>
+ *   <li>BSMP_ERR_PARAM_OUT_OF_RANGE: count, workers or the link of a device
+ *                                    is out of range, or period_us is 0</li>
+ * </ul>
+ */
+enum bsmp_err bsmp_poller_init (bsmp_poller_t *poller,
+                                struct bsmp_poll_device *devices,
+                                unsigned int count, unsigned int workers,
+                                uint32_t period_us, bsmp_poll_stats_t stats_cb,
+                                void *user);
+
+/*
+ * Starts the threads of a poller: the clock, one per link and the workers.
+ *
+ * @param poller [input] An initialized poller
+ *
+ * @return BSMP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>BSMP_ERR_PARAM_INVALID: poller is a NULL pointer or already
+ *                               running</li>
+ *   <li>BSMP_ERR_OUT_OF_MEMORY: a thread couldn't be created</li>
+ * </ul>
+ */
+enum bsmp_err bsmp_poller_start (bsmp_poller_t *poller);
+
+/*
+ * Stops a poller at the end of the current cycle and waits for its threads.
+ *
+ * @param poller [input] A running poller
+ *
+ * @return BSMP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>BSMP_ERR_PARAM_INVALID: poller is a NULL pointer or not running</li>
+ * </ul>
+ */
+enum bsmp_err bsmp_poller_stop (bsmp_poller_t *poller);
+
+/*
+ * Releases the resources of a stopped poller.
+ *
+ * @param poller [input] An initialized poller
+ */
+void bsmp_poller_destroy (bsmp_poller_t *poller);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
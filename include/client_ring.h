@@ -0,0 +1,152 @@
+#ifndef BSMP_CLIENT_RING_H
+#define BSMP_CLIENT_RING_H
+
+#include "client.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Size of a cache line, to keep the two ends of a ring apart
+#ifndef BSMP_RING_LINE
+#define BSMP_RING_LINE              64
+#endif
+
+// Bytes taken by a slot of a ring of samples of the given size: their time,
+// then their value, padded to 8 bytes
+#define BSMP_RING_STRIDE(size)      (8 + (((size) + 7) & ~7u))
+
+// Memory needed by a ring of the given number of slots
+#define BSMP_RING_MEM_SIZE(size, slots) ((slots)*BSMP_RING_STRIDE(size))
+
+// Types
+
+// Ring of timestamped samples between one producer thread, usually the one
+// polling a client, and one consumer thread. Neither side locks or allocates.
+// The fields are for the functions below only.
+struct bsmp_ring
+{
+    uint8_t     *mem;
+    uint16_t    size;           // Of the samples
+    uint32_t    stride;         // Of the slots
+    uint32_t    mask;           // Number of slots - 1
+
+    // Written by the producer only
+    uint8_t     pad0[BSMP_RING_LINE];
+    uint32_t    head;           // Slots published, ever
+    uint32_t    tail_cache;     // Last tail seen by the producer
+    uint32_t    dropped;        // Samples lost to a full ring
+
+    // Written by the consumer only
+    uint8_t     pad1[BSMP_RING_LINE];
+    uint32_t    tail;           // Slots released, ever
+    uint32_t    head_cache;     // Last head seen by the consumer
+    uint8_t     pad2[BSMP_RING_LINE];
+};
+
+typedef struct bsmp_ring bsmp_ring_t;
+
+/*
+ * Initializes a ring over caller provided memory.
+ *
+ * @param ring [input] Handle to the instance to be initialized
+ * @param size [input] Size of each sample, grp->size for the samples of a
+ *                     group
+ * @param slots [input] Number of slots, a power of two
+ * @param mem [input] At least BSMP_RING_MEM_SIZE(size, slots) bytes, aligned
+ *                    to 8 bytes. Must remain valid while the ring is used.
+ * @param mem_size [input] Size of mem
+ *
+ * @return BSMP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>BSMP_ERR_PARAM_INVALID: ring or mem is a NULL pointer</li>
+ *   <li>BSMP_ERR_PARAM_OUT_OF_RANGE: size is 0, slots is not a power of two or
+ *                                    mem_size is too small</li>
+ * </ul>
+ */
+enum bsmp_err bsmp_ring_init (bsmp_ring_t *ring, uint16_t size, uint32_t slots,
+                              void *mem, uint32_t mem_size);
+
+/*
+ * Producer side. Returns where the next sample is to be written, or NULL if
+ * the ring is full. The sample is seen by the consumer once committed.
+ *
+ * @param ring [input] An initialized ring
+ */
+uint8_t *bsmp_ring_reserve (bsmp_ring_t *ring);
+
+/*
+ * Producer side. Publishes the sample written at the place returned by the
+ * last bsmp_ring_reserve.
+ *
+ * @param ring [input] An initialized ring
+ * @param time_us [input] Time of the sample
+ */
+void bsmp_ring_commit (bsmp_ring_t *ring, uint64_t time_us);
+
+/*
+ * Producer side. Copies a sample into the ring.
+ *
+ * @param ring [input] An initialized ring
+ * @param time_us [input] Time of the sample
+ * @param data [input] ring->size bytes
+ *
+ * @return BSMP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>BSMP_ERR_PARAM_INVALID: ring or data is a NULL pointer</li>
+ *   <li>BSMP_ERR_OUT_OF_MEMORY: the ring is full. The sample is counted as
+ *                               dropped.</li>
+ * </ul>
+ */
+enum bsmp_err bsmp_ring_push (bsmp_ring_t *ring, uint64_t time_us,
+                              const uint8_t *data);
+
+/*
+ * Producer side. Executes a prepared read straight into the next slot, stamped
+ * with the CLOCK_MONOTONIC time, in us, the request was sent at (POSIX only).
+ * If the ring is full, the read goes to the buffer it was prepared with and
+ * the sample is counted as dropped.
+ *
+ * @param ring [input] An initialized ring
+ * @param read [input] A read prepared for samples of the size of the ring
+ *
+ * @return BSMP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>BSMP_ERR_PARAM_INVALID: ring or read is a NULL pointer, or the size
+ *                               of the read is not the one of the ring</li>
+ *   <li>BSMP_ERR_COMM: There was a failure either sending or receiving a
+ *                      message. Nothing is published.</li>
+ * </ul>
+ */
+enum bsmp_err bsmp_ring_read (bsmp_ring_t *ring, struct bsmp_prepared *read);
+
+/*
+ * Consumer side. Returns the oldest sample, left in place until released, or
+ * NULL if the ring is empty.
+ *
+ * @param ring [input] An initialized ring
+ * @param time_us [output] Time of the sample. May be NULL.
+ */
+const uint8_t *bsmp_ring_peek (bsmp_ring_t *ring, uint64_t *time_us);
+
+/*
+ * Consumer side. Gives the sample returned by bsmp_ring_peek back to the
+ * producer.
+ *
+ * @param ring [input] An initialized ring
+ */
+void bsmp_ring_release (bsmp_ring_t *ring);
+
+/*
+ * Returns how many samples are waiting in the ring. Exact on the consumer side,
+ * a lower bound anywhere else.
+ *
+ * @param ring [input] An initialized ring
+ */
+uint32_t bsmp_ring_count (bsmp_ring_t *ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,151 @@
+#ifndef BSMP_CLIENT_SCHED_H
+#define BSMP_CLIENT_SCHED_H
+
+#include "client.h"
+#include "client_ring.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Maximum number of tasks of a scheduler
+#ifndef BSMP_SCHED_MAX_TASKS
+#define BSMP_SCHED_MAX_TASKS        32
+#endif
+
+// Bins of the jitter histograms. Bin 0 counts reads started on time, bin k
+// the ones started from 2^(k-1) to 2^k - 1 us late and the last one anything
+// later.
+#define BSMP_SCHED_HIST_BINS        16
+
+// A task is degraded by doubling its period, up to this many times
+#define BSMP_SCHED_MAX_SHIFT        10
+
+// Types
+
+// Current time in us, from any monotonic clock
+typedef uint64_t (*bsmp_sched_clock_t) (void);
+
+struct bsmp_sched_task;
+
+// Called after each read of a task
+typedef void (*bsmp_sched_done_t) (struct bsmp_sched_task *task,
+                                   enum bsmp_err err, void *user);
+
+// Periodic read. The first fields are set by the user before the task is
+// added, the others are kept by the scheduler.
+struct bsmp_sched_task
+{
+    struct bsmp_prepared    read;           // See bsmp_prepare_read_var
+    uint32_t                period_us;
+    uint32_t                deadline_us;    // After each release, 0 for period
+    uint8_t                 priority;       // 0 is the most important
+    bsmp_sched_done_t       done;           // May be NULL
+    void                    *user;
+    bsmp_ring_t             *ring;          // Gets the samples, may be NULL
+
+    uint64_t                release;        // Next release, in us
+    unsigned int            shift;          // Period doubled this many times
+    uint32_t                runs;
+    uint32_t                misses;         // Reads done past their deadline
+    uint32_t                skipped;        // Releases dropped under overload
+    uint32_t                jitter[BSMP_SCHED_HIST_BINS];
+};
+
+// Scheduler instance
+struct bsmp_sched
+{
+    bsmp_client_t           *client;
+    bsmp_sched_clock_t      clock;
+    uint32_t                byte_ns;        // Time to transfer a byte
+    uint32_t                budget_ppm;     // Share of the link for the tasks
+    uint32_t                rtt_us;         // Measured cost of a transaction
+
+    struct bsmp_sched_task  *tasks[BSMP_SCHED_MAX_TASKS];
+    unsigned int            count;
+};
+
+typedef struct bsmp_sched bsmp_sched_t;
+
+/*
+ * Initializes a scheduler of periodic reads over a client.
+ *
+ * Tasks are read earliest deadline first, one at a time. The time each read
+ * takes on the link is estimated from the round trip time, measured on every
+ * read, plus the time to transfer the request and the answer. If the tasks
+ * don't fit in the budget of the link, the periods of the least important ones
+ * are doubled until they do.
+ *
+ * @param sched [input] Handle to the instance to be initialized
+ * @param client [input] An initialized BSMP Client Library instance. It must
+ *                       not be used elsewhere while the scheduler runs.
+ * @param byte_ns [input] Time, in ns, to transfer a byte on the link (86806
+ *                        for 115200 bauds, 0 for links where only the round
+ *                        trip counts)
+ * @param budget_pct [input] Share of the link time, from 1 to 100%, the tasks
+ *                           may take
+ * @param clock [input] Clock in us, NULL for CLOCK_MONOTONIC (POSIX only)
+ *
+ * @return BSMP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>BSMP_ERR_PARAM_INVALID: sched or client is a NULL pointer</li>
+ *   <li>BSMP_ERR_PARAM_OUT_OF_RANGE: budget_pct is out of range</li>
+ * </ul>
+ */
+enum bsmp_err bsmp_sched_init (bsmp_sched_t *sched, bsmp_client_t *client,
+                               uint32_t byte_ns, unsigned int budget_pct,
+                               bsmp_sched_clock_t clock);
+
+/*
+ * Adds a task, first released right away. Its read must be prepared on the
+ * client of the scheduler and the task must remain valid while it's added.
+ *
+ * @param sched [input] An initialized scheduler
+ * @param task [input] The task to be added
+ *
+ * @return BSMP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>BSMP_ERR_PARAM_INVALID: sched or task is a NULL pointer, the read
+ *                               was prepared on another client or the ring
+ *                               is for samples of another size</li>
+ *   <li>BSMP_ERR_PARAM_OUT_OF_RANGE: period_us is 0 or deadline_us is greater
+ *                                    than period_us</li>
+ *   <li>BSMP_ERR_OUT_OF_MEMORY: BSMP_SCHED_MAX_TASKS tasks were added</li>
+ *   <li>BSMP_ERR_DUPLICATE: the task was already added</li>
+ * </ul>
+ */
+enum bsmp_err bsmp_sched_add (bsmp_sched_t *sched,
+                              struct bsmp_sched_task *task);
+
+/*
+ * Reads the released task with the earliest deadline, if any, and calls its
+ * callback. To be called in a loop, sleeping wait_us between calls.
+ *
+ * Releases a task can't make before the next one are dropped, and counted as
+ * skipped, so that an overloaded link doesn't fall further and further behind.
+ *
+ * @param sched [input] An initialized scheduler
+ * @param wait_us [output] Time until the next release, 0 if a task is already
+ *                         due
+ *
+ * @return BSMP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>BSMP_ERR_PARAM_INVALID: sched or wait_us is a NULL pointer</li>
+ * </ul>
+ * Errors of the reads are only passed to the callbacks.
+ */
+enum bsmp_err bsmp_sched_run (bsmp_sched_t *sched, uint32_t *wait_us);
+
+/*
+ * Returns the share of the link time, in parts per million, the tasks take
+ * with their current periods, as estimated by the scheduler.
+ *
+ * @param sched [input] An initialized scheduler
+ */
+uint32_t bsmp_sched_load (bsmp_sched_t *sched);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
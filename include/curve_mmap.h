@@ -0,0 +1,104 @@
+#ifndef BSMP_CURVE_MMAP_H
+#define BSMP_CURVE_MMAP_H
+
+#include <stddef.h>
+
+#include "bsmp.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Curve backed by a memory-mapped file (POSIX only).
+//
+// Blocks are served straight from the mapping (get_block_ptr), so the file is
+// paged in on demand instead of being read into RAM at startup. Writes to the
+// mapping are flushed with msync before the write command is acknowledged.
+//
+// If the checksum is persisted, the file holds BSMP_CURVE_CSUM_SIZE extra bytes
+// right after the last block, where the MD5 of the curve is kept.
+struct bsmp_curve_mmap
+{
+    // Curve to be registered with bsmp_register_curve. Must be the first
+    // member: the block functions recover the bsmp_curve_mmap from it.
+    struct bsmp_curve curve;
+
+    int      fd;                // Backing file descriptor
+    uint8_t  *map;              // Start of the mapping
+    size_t   map_len;           // Length of the mapping
+    size_t   data_len;          // Bytes of curve data available in the mapping
+    uint8_t  *csum;             // Checksum stored in the mapping, or NULL
+};
+
+/**
+ * Map a file as a curve. On success, mc->curve is ready to be registered with
+ * bsmp_register_curve. The user field of mc->curve is left for the caller.
+ *
+ * If writable is true, the file is created if needed and grown to hold
+ * nblocks*block_size bytes (plus the checksum, if persisted). If writable is
+ * false, the file may be shorter than nblocks*block_size: the last block read
+ * will be a short one and any block past the end of the file will be empty.
+ *
+ * If nblocks is 0 and writable is false, the number of blocks is computed from
+ * the size of the file (minus the checksum, if persisted).
+ *
+ * If persist_csum is true, the checksum previously stored in the file, if any,
+ * is loaded into mc->curve.info.checksum.
+ *
+ * @param mc [output] Curve instance to be initialized
+ * @param path [input] Path of the backing file
+ * @param block_size [input] Size of each block, in bytes
+ * @param nblocks [input] Number of blocks of the curve
+ * @param writable [input] Whether the client can write to the curve
+ * @param persist_csum [input] Whether to keep the checksum in the file
+ *
+ * @return BSMP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>BSMP_ERR_PARAM_INVALID: mc or path is a NULL pointer</li>
+ *   <li>BSMP_ERR_PARAM_OUT_OF_RANGE: block_size is 0 or greater than
+ *                                    BSMP_CURVE_BLOCK_MAX_SIZE, or nblocks is
+ *                                    greater than BSMP_CURVE_MAX_BLOCKS</li>
+ *   <li>BSMP_ERR_IO: the file couldn't be opened, resized or mapped</li>
+ * </ul>
+ */
+enum bsmp_err bsmp_curve_mmap_open (struct bsmp_curve_mmap *mc,
+                                    const char *path, uint16_t block_size,
+                                    uint32_t nblocks, bool writable,
+                                    bool persist_csum);
+
+/**
+ * Flush the mapping to the backing file. If the curve is writable and its
+ * checksum is persisted, the current value of mc->curve.info.checksum is stored
+ * in the file first.
+ *
+ * Call it after the checksum was recalculated if it must survive a crash.
+ *
+ * @param mc [input] Curve instance
+ *
+ * @return BSMP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>BSMP_ERR_PARAM_INVALID: mc is a NULL pointer or isn't mapped</li>
+ *   <li>BSMP_ERR_IO: msync failed</li>
+ * </ul>
+ */
+enum bsmp_err bsmp_curve_mmap_sync (struct bsmp_curve_mmap *mc);
+
+/**
+ * Sync (see bsmp_curve_mmap_sync), unmap and close the backing file. The curve
+ * must not be used by a server afterwards.
+ *
+ * @param mc [input] Curve instance
+ *
+ * @return BSMP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>BSMP_ERR_PARAM_INVALID: mc is a NULL pointer or isn't mapped</li>
+ *   <li>BSMP_ERR_IO: the final sync failed. The file is closed anyway.</li>
+ * </ul>
+ */
+enum bsmp_err bsmp_curve_mmap_close (struct bsmp_curve_mmap *mc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
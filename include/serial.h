@@ -0,0 +1,162 @@
+#ifndef BSMP_SERIAL_H
+#define BSMP_SERIAL_H
+
+#include "client.h"
+#include "server.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Frames on a serial line wrap a message with the address of the device, first,
+// and a checksum, last, which brings the sum of all bytes of the frame to 0
+#define BSMP_SERIAL_WRAP_SIZE       2
+#define BSMP_SERIAL_MAX_FRAME       (BSMP_MAX_MESSAGE + BSMP_SERIAL_WRAP_SIZE)
+
+// Address of frames to every device. Only variable and group writes and group
+// latches may be broadcast, and devices don't answer them.
+#define BSMP_SERIAL_BROADCAST       0xFF
+
+// Regions of a message sent at once
+#define BSMP_SERIAL_MAX_REGIONS     8
+
+// Bytes buffered from the line, enough for a few frames at once
+#ifndef BSMP_SERIAL_RX_SIZE
+#define BSMP_SERIAL_RX_SIZE         (2*BSMP_SERIAL_MAX_FRAME)
+#endif
+
+// Types
+
+// Serial line, for either a client or a server
+struct bsmp_serial
+{
+    int         fd;
+    uint8_t     address;        // Of the device, see bsmp_serial_open
+    int         timeout_ms;     // Of receptions, -1 to wait forever
+    int         gap_ms;         // Silence that ends a partial frame
+    uint32_t    errors;         // Bytes dropped by the framing, so far
+
+    // Bytes received and not consumed yet, from rx_start to rx_end. Frames are
+    // handed out from here without being copied.
+    uint8_t     rx[BSMP_SERIAL_RX_SIZE];
+    uint32_t    rx_start, rx_end;
+    uint32_t    rx_frame;       // Size of the frame last handed out
+
+    uint8_t     tx[BSMP_SERIAL_MAX_FRAME];  // Answers of a server
+};
+
+typedef struct bsmp_serial bsmp_serial_t;
+
+/*
+ * Opens a serial port and sets it up for low latency: raw mode, 8N1, no flow
+ * control, no inter-byte timer (VTIME = 0) with non-blocking reads, waiting
+ * being done with poll, and, on Linux, the driver's low_latency flag where
+ * supported.
+ *
+ * A client sends frames to the device at address and takes answers from any
+ * address. A server only answers frames sent to its own address, and answers
+ * with it.
+ *
+ * @param serial [input] Handle to the instance to be initialized
+ * @param path [input] Serial device, like /dev/ttyUSB0
+ * @param baud [input] Speed in bps, 0 to keep the current one
+ * @param address [input] Address of the device
+ *
+ * @return BSMP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>BSMP_ERR_PARAM_INVALID: serial or path is a NULL pointer</li>
+ *   <li>BSMP_ERR_PARAM_OUT_OF_RANGE: baud is not a standard speed</li>
+ *   <li>BSMP_ERR_IO: the port couldn't be opened or set up</li>
+ * </ul>
+ */
+enum bsmp_err bsmp_serial_open (bsmp_serial_t *serial, const char *path,
+                                uint32_t baud, uint8_t address);
+
+/*
+ * Same as bsmp_serial_open, for a file descriptor already open, like one end
+ * of a pseudo terminal. It's closed by bsmp_serial_close.
+ */
+enum bsmp_err bsmp_serial_attach (bsmp_serial_t *serial, int fd, uint32_t baud,
+                                  uint8_t address);
+
+/*
+ * Closes the serial port of an instance.
+ *
+ * @param serial [input] An initialized instance
+ */
+void bsmp_serial_close (bsmp_serial_t *serial);
+
+/*
+ * Fills in a transport for bsmp_client_init_transport. Requests go out in a
+ * single write each, answers are handed to the client straight from the
+ * receive buffer.
+ *
+ * @param serial [input] An initialized instance
+ * @param transport [output] Transport over the serial line
+ */
+void bsmp_serial_transport (bsmp_serial_t *serial,
+                            struct bsmp_transport *transport);
+
+/*
+ * Sends a message in a frame to the address of the instance.
+ *
+ * @param serial [input] An initialized instance
+ * @param data [input] The message
+ * @param len [input] Size of the message
+ *
+ * @return 0 if successful, anything else otherwise
+ */
+int bsmp_serial_send (bsmp_serial_t *serial, uint8_t *data, uint32_t len);
+
+/*
+ * Sends a message made of count regions, up to BSMP_SERIAL_MAX_REGIONS, in a
+ * frame to any address.
+ *
+ * @param serial [input] An initialized instance
+ * @param address [input] Address of the frame
+ * @param iov [input] Regions of the message, in order
+ * @param count [input] Number of regions
+ *
+ * @return 0 if successful, anything else otherwise
+ */
+int bsmp_serial_send_to (bsmp_serial_t *serial, uint8_t address,
+                         struct bsmp_iov *iov, unsigned int count);
+
+/*
+ * Receives the next valid frame, waiting up to timeout_ms. Corrupted bytes are
+ * skipped and counted in errors, as are the bytes of a frame cut short by
+ * gap_ms of silence. The message stays in the receive buffer until the next
+ * reception.
+ *
+ * @param serial [input] An initialized instance
+ * @param address [output] Address of the frame. May be NULL.
+ * @param data [output] Points to the message
+ * @param len [output] Size of the message
+ *
+ * @return 0 if successful, anything else otherwise
+ */
+int bsmp_serial_recv (bsmp_serial_t *serial, uint8_t *address, uint8_t **data,
+                      uint32_t *len);
+
+/*
+ * Waits for a request to the address of the instance, up to timeout_ms, and
+ * answers it. Writes and latches broadcast to BSMP_SERIAL_BROADCAST are applied
+ * without an answer. Other frames are ignored.
+ *
+ * @param serial [input] An initialized instance
+ * @param server [input] The server answering the request
+ *
+ * @return BSMP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>BSMP_ERR_PARAM_INVALID: serial or server is a NULL pointer</li>
+ *   <li>BSMP_ERR_TIMEOUT: no request arrived in time</li>
+ *   <li>BSMP_ERR_COMM: the line failed, or the answer couldn't be sent</li>
+ * </ul>
+ */
+enum bsmp_err bsmp_serial_serve (bsmp_serial_t *serial, bsmp_server_t *server);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,219 @@
+#ifndef BSMP_SERIAL_BUS_H
+#define BSMP_SERIAL_BUS_H
+
+#include <pthread.h>
+
+#include "serial.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Types
+
+typedef struct bsmp_bus bsmp_bus_t;
+
+// Device on the bus, the context of its client's transport
+struct bsmp_bus_port
+{
+    bsmp_bus_t          *bus;
+    uint8_t             address;
+    pthread_cond_t      done;
+
+    // Request of the client, sent from its own buffers
+    struct bsmp_iov     request[2];
+    unsigned int        nregions;
+    bool                ready;      // Sent by the client, not queued yet
+    bool                queued;     // Waiting for its answer
+
+    uint8_t             *answer;    // Where the answer goes
+    uint32_t            len;
+    int                 err;
+
+    // After a timeout, frames from the device are dropped until then, so a
+    // late answer isn't taken for the one to the next request
+    uint64_t            stale_us;
+};
+
+// Counters of a bus, since it was started
+struct bsmp_bus_stats
+{
+    uint32_t            transactions;
+    uint32_t            timeouts;   // Requests left unanswered
+    uint32_t            strays;     // Frames from devices not being asked
+    uint64_t            busy_us;    // From each request to its answer
+    uint64_t            elapsed_us;
+};
+
+// Half-duplex multidrop line shared by the clients of many devices
+struct bsmp_bus
+{
+    bsmp_serial_t           *serial;
+    uint32_t                gap_us;     // Least silence between frames
+    struct bsmp_bus_port    ports[256]; // By address
+    pthread_t               thread;
+    pthread_mutex_t         bcast;      // Broadcasts go one at a time
+
+    // Under lock
+    pthread_mutex_t         lock;
+    pthread_cond_t          work;       // A request was queued
+    struct bsmp_bus_port    *queue[256];
+    unsigned int            head, count;
+    bool                    running;
+    bool                    quit;
+    uint64_t                started;
+    struct bsmp_bus_stats   stats;
+};
+
+/*
+ * Initializes an arbiter of a serial line with many devices (POSIX threads
+ * only). Once started, it's the only user of the line: clients of the devices
+ * get their transports from bsmp_bus_transport and the arbiter's thread sends
+ * their requests one at a time, in the order they came, right after the
+ * answer to the previous one, and hands each answer to the client waiting for
+ * it. When a device times out, its next request waits until it's been given a
+ * whole timeout more to answer, dropping whatever it sends meanwhile.
+ *
+ * @param bus [input] Handle to the instance to be initialized
+ * @param serial [input] An initialized serial line, whose timeout_ms bounds
+ *                       the wait for each answer
+ * @param gap_us [input] Least silence between the end of a frame and the
+ *                       start of the next, for the devices to turn the line
+ *                       around. Modbus uses 3.5 characters, 38500000/baud us.
+ *
+ * @return BSMP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>BSMP_ERR_PARAM_INVALID: bus or serial is a NULL pointer</li>
+ * </ul>
+ */
+enum bsmp_err bsmp_bus_init (bsmp_bus_t *bus, bsmp_serial_t *serial,
+                             uint32_t gap_us);
+
+/*
+ * Fills in the transport of the client of the device at an address, other than
+ * BSMP_SERIAL_BROADCAST. Clients on a bus must have a single request in flight
+ * (depth 1).
+ *
+ * @param bus [input] An initialized bus
+ * @param address [input] Address of the device
+ * @param transport [output] Transport through the bus
+ */
+void bsmp_bus_transport (bsmp_bus_t *bus, uint8_t address,
+                         struct bsmp_transport *transport);
+
+/*
+ * Writes a variable of every device on the bus at once, in a single broadcast
+ * frame, which devices don't answer. Devices without a writable variable of
+ * that ID and size just ignore it: see bsmp_bus_sweep_var to check that the
+ * value landed.
+ *
+ * @param bus [input] A running bus
+ * @param var [input] The variable, as described by the client of any device
+ * @param value [input] Its new value, var->size bytes
+ *
+ * @return BSMP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>BSMP_ERR_PARAM_INVALID: bus, var or value is a NULL pointer, or var
+ *                               is read-only</li>
+ *   <li>BSMP_ERR_COMM: the frame couldn't be sent or the bus isn't
+ *                      running</li>
+ * </ul>
+ */
+enum bsmp_err bsmp_bus_write_var_all (bsmp_bus_t *bus,
+                                      struct bsmp_var_info *var,
+                                      uint8_t *value);
+
+/*
+ * Same as bsmp_bus_write_var_all, for the variables of a group, which must
+ * have the same ID and variables on every device.
+ */
+enum bsmp_err bsmp_bus_write_group_all (bsmp_bus_t *bus,
+                                        struct bsmp_group *grp,
+                                        uint8_t *values);
+
+/*
+ * Makes every device on the bus take a snapshot of a group at once, in a
+ * single broadcast frame, which devices don't answer. Their answers to
+ * bsmp_read_group are then the snapshot, taken at the same instant, until the
+ * next latch. See bsmp_latch_group.
+ *
+ * @param bus [input] A running bus
+ * @param grp [input] The group, as described by the client of any device. It
+ *                    must have the same ID on every device.
+ *
+ * @return BSMP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>BSMP_ERR_PARAM_INVALID: bus or grp is a NULL pointer</li>
+ *   <li>BSMP_ERR_COMM: the frame couldn't be sent or the bus isn't
+ *                      running</li>
+ * </ul>
+ */
+enum bsmp_err bsmp_bus_latch_group_all (bsmp_bus_t *bus,
+                                        struct bsmp_group *grp);
+
+/*
+ * Reads back, from each device, the variable with the ID of var and compares
+ * it to value. Meant to follow a broadcast write.
+ *
+ * @param clients [input] Clients of the devices
+ * @param count [input] Number of clients
+ * @param var [input] The variable, as described by the client of any device
+ * @param value [input] Expected value, var->size bytes
+ * @param ok [output] Whether each device holds the value. May be NULL.
+ *
+ * @return BSMP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>BSMP_ERR_PARAM_INVALID: clients, var or value is a NULL pointer</li>
+ *   <li>BSMP_ERR_COMM: some device doesn't hold the value or couldn't be
+ *                      read</li>
+ * </ul>
+ */
+enum bsmp_err bsmp_bus_sweep_var (bsmp_client_t **clients, unsigned int count,
+                                  struct bsmp_var_info *var, uint8_t *value,
+                                  bool *ok);
+
+/*
+ * Starts the thread of a bus.
+ *
+ * @param bus [input] An initialized bus
+ *
+ * @return BSMP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>BSMP_ERR_PARAM_INVALID: bus is a NULL pointer or already running</li>
+ *   <li>BSMP_ERR_OUT_OF_MEMORY: the thread couldn't be created</li>
+ * </ul>
+ */
+enum bsmp_err bsmp_bus_start (bsmp_bus_t *bus);
+
+/*
+ * Stops the thread of a bus once the requests queued are answered.
+ *
+ * @param bus [input] A running bus
+ *
+ * @return BSMP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>BSMP_ERR_PARAM_INVALID: bus is a NULL pointer or not running</li>
+ * </ul>
+ */
+enum bsmp_err bsmp_bus_stop (bsmp_bus_t *bus);
+
+/*
+ * Copies the counters of a bus.
+ *
+ * @param bus [input] An initialized bus
+ * @param stats [output] Counters since the bus was started
+ */
+void bsmp_bus_stats (bsmp_bus_t *bus, struct bsmp_bus_stats *stats);
+
+/*
+ * Releases the resources of a stopped bus.
+ *
+ * @param bus [input] An initialized bus
+ */
+void bsmp_bus_destroy (bsmp_bus_t *bus);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
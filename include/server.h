@@ -3,6 +3,10 @@
 
 #include "bsmp.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 // Types
 
 // Hook function. Called before the values of a set of variables are read and
@@ -15,6 +19,30 @@ enum bsmp_operation
 typedef bool (*bsmp_hook_t) (enum bsmp_operation op, struct bsmp_var **list);
 typedef bool (*bsmp_custom_md5_t) (struct bsmp_curve *curve, uint8_t *csum);
 
+// Clients of a group whose delta reads are tracked at once. Beyond them, the
+// least recently served gets a full answer on its next read. Not meant to be
+// overridden: it sizes bsmp_server_t, which the library and the application
+// must agree on.
+#define BSMP_DELTA_SESSIONS 4
+
+// Last values of a group sent by delta reads to one client, which is told
+// apart by the sequence number it got last
+struct bsmp_delta_session
+{
+    uint8_t  *shadow;           // Values of the group, NULL if never sent
+    uint16_t capacity;          // Bytes of shadow
+    uint16_t size;              // Size of the group when last sent
+    uint16_t seq;               // Sequence number of the last delta sent
+    uint32_t used;              // When it was last served
+};
+
+struct bsmp_group_delta
+{
+    uint16_t                    seq;    // Last one handed out, to any session
+    uint32_t                    clock;
+    struct bsmp_delta_session   sessions[BSMP_DELTA_SESSIONS];
+};
+
 // BSMP instance
 struct bsmp_server
 {
@@ -26,6 +54,26 @@ struct bsmp_server
     struct bsmp_var             *modified_list[BSMP_MAX_VARIABLES+1];
     bsmp_hook_t                 hook;
     bsmp_custom_md5_t           custom_md5;
+
+    // Version counters. Each change of a Variable takes the next generation.
+    // Generations only compare within the same epoch, which tells runs of the
+    // server apart. bsmp_server_init takes it from the clock where there is
+    // one; servers without one should set it afterwards, from a boot counter
+    // or a random number.
+    uint32_t                    epoch;
+    uint32_t                    generation;
+    uint32_t                    vars_generation[BSMP_MAX_VARIABLES];
+
+    // Delta group reads. Shadows are allocated from delta_mem.
+    uint8_t                     *delta_mem;
+    uint32_t                    delta_mem_size, delta_mem_used;
+    struct bsmp_group_delta     deltas[BSMP_MAX_GROUPS];
+
+    // Group latched, whose reads answer with the snapshot in latch_mem
+    uint8_t                     *latch_mem;
+    uint32_t                    latch_mem_size;
+    struct bsmp_group           *latched;       // NULL if none
+    uint32_t                    latch_generation;   // When it was taken
 };
 
 // Handle to a server instance
@@ -79,9 +127,9 @@ enum bsmp_err bsmp_register_variable (bsmp_server_t *server,
  * instance. The id field of the curve parameter will be written by the BSMP
  * lib.
  *
- * The fields writable, nblocks and read_block must be filled correctly.
- * If writable is true, the field write_block must also be filled correctly.
- * Otherwise, write_block must be NULL.
+ * The fields writable, nblocks and either read_block or get_block_ptr must be
+ * filled correctly. If writable is true, the field write_block must also be
+ * filled correctly. Otherwise, write_block must be NULL.
  *
  * The user field is untouched.
  *
@@ -94,7 +142,8 @@ enum bsmp_err bsmp_register_variable (bsmp_server_t *server,
  *   <li>BSMP_ERR_PARAM_INVALID: curve->info.nblocks less than
  *                               BSMP_CURVE_MIN_BLOCKS or greater than
  *                               BSMP_CURVE_MAX_BLOCKS.</li>
- *   <li>BSMP_ERR_PARAM_INVALID: curve->read_block is NULL.</li>
+ *   <li>BSMP_ERR_PARAM_INVALID: both curve->read_block and
+ *                               curve->get_block_ptr are NULL.</li>
  *   <li>BSMP_ERR_PARAM_INVALID: curve->writable is true and curve->write_block
  *                               is NULL.</li>
  *   <li>BSMP_ERR_PARAM_INVALID: curve->writable is false and curve->write_block
@@ -175,6 +224,72 @@ enum bsmp_err bsmp_register_hook (bsmp_server_t *server, bsmp_hook_t hook);
  */
 enum bsmp_err bsmp_register_md5(bsmp_server_t *server, bsmp_custom_md5_t md5);
 
+/**
+ * Register memory to be used by delta group reads. Without it, delta reads are
+ * not supported and clients fall back to plain group reads.
+ *
+ * In a delta read, the server answers with a bitmap of the Variables of the
+ * group whose values changed since the last delta read of that group, followed
+ * by the values of only those Variables. The server keeps a copy of the last
+ * values sent for each group read this way, taken from the registered memory.
+ * A copy takes as many bytes as the size of its group. Up to
+ * BSMP_DELTA_SESSIONS clients of each group get their own copy.
+ *
+ * @param server [input] Handle to a server instance
+ * @param mem [input] Memory to be used. Must remain valid throughout the
+ *                    entire lifespan of the server instance.
+ * @param size [input] Size of mem, in bytes
+ *
+ * @return BSMP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li> BSMP_ERR_PARAM_INVALID: Either server or mem is a NULL pointer. </li>
+ * </ul>
+ */
+enum bsmp_err bsmp_register_delta_memory (bsmp_server_t *server, uint8_t *mem,
+                                          uint32_t size);
+
+/**
+ * Register memory to be used by group latches. Without it, latches are not
+ * supported.
+ *
+ * A latch takes a snapshot of the values of a group. Reads of that group,
+ * plain, changed or delta ones, answer with the snapshot, until another group
+ * is latched or the latch is released. Broadcast to many servers, it samples all of them at the same
+ * instant, however long reading them back takes.
+ *
+ * @param server [input] Handle to a server instance
+ * @param mem [input] Memory to be used, as large as the largest group to be
+ *                    latched. Must remain valid throughout the entire lifespan
+ *                    of the server instance.
+ * @param size [input] Size of mem, in bytes
+ *
+ * @return BSMP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li> BSMP_ERR_PARAM_INVALID: Either server or mem is a NULL pointer. </li>
+ * </ul>
+ */
+enum bsmp_err bsmp_register_latch_memory (bsmp_server_t *server, uint8_t *mem,
+                                          uint32_t size);
+
+/**
+ * Tell the server that the value of a Variable was changed by the application.
+ *
+ * Each Variable has a version, bumped whenever it is written by a command or
+ * through this function. Clients use it to read only the Variables that changed
+ * since their last read. Variables changed behind the server's back are not
+ * sent to those clients until this function is called.
+ *
+ * @param server [input] Handle to a server instance.
+ * @param var [input] The Variable that was changed.
+ *
+ * @return BSMP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li> BSMP_ERR_PARAM_INVALID: Either server or var is a NULL pointer, or var
+ *                                isn't registered with server.</li>
+ * </ul>
+ */
+enum bsmp_err bsmp_var_changed (bsmp_server_t *server, struct bsmp_var *var);
+
 /**
  * Process a received message and prepare an answer.
  *
@@ -192,5 +307,45 @@ enum bsmp_err bsmp_process_packet (bsmp_server_t *server,
                                    struct bsmp_raw_packet *request,
                                    struct bsmp_raw_packet *response);
 
+/**
+ * Process a received message and prepare an answer described as a list of
+ * memory regions, ready to be handed to writev or sendmsg.
+ *
+ * The first region always starts with the header of the answer, which is
+ * written to response->data along with any part of the payload that had to be
+ * copied. Other regions point straight to the memory of the entities (the
+ * values of the Variables being read or the block of a Curve that has
+ * get_block_ptr), which is then not copied. That memory must not be modified
+ * until the answer is sent. Regions that are adjacent in memory are merged.
+ *
+ * If there isn't room in iov for a region, its data is copied to
+ * response->data instead. A group read takes at most one region per Variable
+ * plus two.
+ *
+ * @param server [input] Handle to a server instance.
+ * @param request [input] The message to be processed.
+ * @param response [output] response->data must point to a buffer of
+ *                          BSMP_MAX_MESSAGE bytes. response->len is set to
+ *                          the total length of the answer.
+ * @param iov [output] List of regions composing the answer, in order
+ * @param iovcnt [input/output] Number of entries in iov on input, number of
+ *                              entries used on output
+ *
+ * @return BSMP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li> BSMP_ERR_PARAM_INVALID: Either server, request, response, iov or
+ *                                iovcnt is a NULL pointer.</li>
+ *   <li> BSMP_ERR_PARAM_OUT_OF_RANGE: *iovcnt is 0.</li>
+ * </ul>
+ */
+enum bsmp_err bsmp_process_packet_iov (bsmp_server_t *server,
+                                       struct bsmp_raw_packet *request,
+                                       struct bsmp_raw_packet *response,
+                                       struct bsmp_iov *iov,
+                                       unsigned int *iovcnt);
+
+#ifdef __cplusplus
+}
 #endif
 
+#endif
@@ -0,0 +1,169 @@
+#ifndef BSMP_SHM_H
+#define BSMP_SHM_H
+
+#include "client_ring.h"
+#include "server.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Bytes of each direction of a segment, a power of two. Messages are stored
+// whole, each after its size, so that they are handed out without being
+// copied, and room for the largest one must always be found.
+#ifndef BSMP_SHM_RING_SIZE
+#define BSMP_SHM_RING_SIZE          (1 << 18)
+#endif
+
+// Types
+
+// Messages in one direction, between one producer and one consumer. Both ends
+// spin for a while before sleeping on a futex, and only wake the other when it
+// is asleep.
+struct bsmp_shm_ring
+{
+    // Written by the producer only
+    uint32_t    head;           // Bytes published, ever
+    uint32_t    head_waiters;   // The consumer sleeps on head
+    uint8_t     pad0[BSMP_RING_LINE - 8];
+
+    // Written by the consumer only
+    uint32_t    tail;           // Bytes released, ever
+    uint32_t    tail_waiters;   // The producer sleeps on tail
+    uint8_t     pad1[BSMP_RING_LINE - 8];
+
+    uint8_t     data[BSMP_SHM_RING_SIZE];
+};
+
+// Layout of the shared memory
+struct bsmp_shm_segment
+{
+    uint32_t                magic;
+    uint32_t                ring_size;
+    uint8_t                 pad[BSMP_RING_LINE - 8];
+    struct bsmp_shm_ring    requests;
+    struct bsmp_shm_ring    answers;
+};
+
+// One end of a segment, either the server's or the client's
+struct bsmp_shm
+{
+    int                     fd;
+    struct bsmp_shm_segment *seg;
+    struct bsmp_shm_ring    *tx, *rx;
+    int                     timeout_ms; // Of waits for the other end
+    unsigned int            spin_us;    // Before going to sleep, 0 on one CPU
+
+    uint32_t                tx_head;    // Where the reserved message goes
+    uint32_t                rx_tail;    // Released by the next reception
+    char                    name[64];   // Removed on close by its creator
+};
+
+typedef struct bsmp_shm bsmp_shm_t;
+
+/*
+ * Creates a shared memory segment and takes its server end. Messages are
+ * passed through two rings in the segment, one per direction, without system
+ * calls while both ends keep up with each other.
+ *
+ * @param shm [input] Handle to the instance to be initialized
+ * @param name [input] Name of the segment for shm_open, like "/bsmp-sim0",
+ *                     which the client opens with bsmp_shm_open. NULL for an
+ *                     anonymous segment (Linux only) whose shm->fd is handed
+ *                     to the client, through fork or a UNIX socket, for
+ *                     bsmp_shm_attach.
+ *
+ * @return BSMP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>BSMP_ERR_PARAM_INVALID: shm is a NULL pointer, name is too long, or
+ *                               NULL outside Linux</li>
+ *   <li>BSMP_ERR_IO: the segment couldn't be created</li>
+ * </ul>
+ */
+enum bsmp_err bsmp_shm_create (bsmp_shm_t *shm, const char *name);
+
+/*
+ * Opens a segment created by bsmp_shm_create and takes its client end.
+ *
+ * @param shm [input] Handle to the instance to be initialized
+ * @param name [input] Name of the segment
+ *
+ * @return BSMP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>BSMP_ERR_PARAM_INVALID: shm or name is a NULL pointer</li>
+ *   <li>BSMP_ERR_IO: the segment couldn't be opened or has another
+ *                    layout</li>
+ * </ul>
+ */
+enum bsmp_err bsmp_shm_open (bsmp_shm_t *shm, const char *name);
+
+/*
+ * Same as bsmp_shm_open, for the file descriptor of a segment. It's closed by
+ * bsmp_shm_close.
+ */
+enum bsmp_err bsmp_shm_attach (bsmp_shm_t *shm, int fd);
+
+/*
+ * Unmaps the segment from an end. The end that created it also removes its
+ * name.
+ *
+ * @param shm [input] An initialized instance
+ */
+void bsmp_shm_close (bsmp_shm_t *shm);
+
+/*
+ * Fills in a transport for bsmp_client_init_transport, on the client end.
+ * Requests are copied into the ring, answers are handed to the client straight
+ * from it.
+ *
+ * @param shm [input] The client end of a segment
+ * @param transport [output] Transport through the segment
+ */
+void bsmp_shm_transport (bsmp_shm_t *shm, struct bsmp_transport *transport);
+
+/*
+ * Sends a message made of count regions.
+ *
+ * @param shm [input] An end of a segment
+ * @param iov [input] Regions of the message, in order
+ * @param count [input] Number of regions
+ *
+ * @return 0 if successful, anything else otherwise
+ */
+int bsmp_shm_send (bsmp_shm_t *shm, struct bsmp_iov *iov, unsigned int count);
+
+/*
+ * Receives the next message, waiting up to timeout_ms. The message stays in
+ * the ring until the next reception.
+ *
+ * @param shm [input] An end of a segment
+ * @param data [output] Points to the message
+ * @param len [output] Size of the message
+ *
+ * @return 0 if successful, anything else otherwise
+ */
+int bsmp_shm_recv (bsmp_shm_t *shm, uint8_t **data, uint32_t *len);
+
+/*
+ * Waits for a request, up to timeout_ms, and answers it. The request is passed
+ * to bsmp_process_packet straight from its ring, and the answer is written
+ * straight into the other one.
+ *
+ * @param shm [input] The server end of a segment
+ * @param server [input] The server answering the request
+ *
+ * @return BSMP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>BSMP_ERR_PARAM_INVALID: shm or server is a NULL pointer</li>
+ *   <li>BSMP_ERR_TIMEOUT: no request arrived in time</li>
+ *   <li>BSMP_ERR_COMM: the request was malformed, or the client didn't make
+ *                      room for the answer in time</li>
+ * </ul>
+ */
+enum bsmp_err bsmp_shm_serve (bsmp_shm_t *shm, bsmp_server_t *server);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,198 @@
+#ifndef BSMP_TCP_H
+#define BSMP_TCP_H
+
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "client.h"
+#include "server.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Messages go over TCP as they are: their header holds the size of the payload
+// that follows, which delimits them in the stream.
+
+// Bytes buffered from a connection, enough for a few messages at once
+#ifndef BSMP_TCP_RX_SIZE
+#define BSMP_TCP_RX_SIZE        (2*BSMP_MAX_MESSAGE)
+#endif
+
+// Connections of a pool
+#ifndef BSMP_TCP_MAX_POOL
+#define BSMP_TCP_MAX_POOL       8
+#endif
+
+// Clients served at once
+#ifndef BSMP_TCP_MAX_CONNS
+#define BSMP_TCP_MAX_CONNS      8
+#endif
+
+// Types
+
+// Connection, from either side
+struct bsmp_tcp_conn
+{
+    int         fd;             // -1 when closed
+    bool        busy;           // Lent to a client
+    uint32_t    backoff_ms;     // Wait after the last failed connect
+    uint64_t    retry_ms;       // No connect before then
+
+    // Bytes received and not consumed yet, from rx_start to rx_end
+    uint8_t     rx[BSMP_TCP_RX_SIZE];
+    uint32_t    rx_start, rx_end;
+};
+
+// Stats of a pool, since it was initialized
+struct bsmp_tcp_stats
+{
+    uint32_t    connects;
+    uint32_t    failures;       // Failed connects and broken connections
+    uint32_t    waits;          // Clients that waited for a free connection
+};
+
+// Connections to a server, shared by any number of clients
+struct bsmp_tcp_pool
+{
+    struct sockaddr_storage addr;
+    socklen_t               addrlen;
+    unsigned int            size;
+    int                     timeout_ms;     // Of connects, sends and receives
+    uint32_t                backoff_min_ms; // Doubled on each failed connect
+    uint32_t                backoff_max_ms;
+
+    // Under lock
+    pthread_mutex_t         lock;
+    pthread_cond_t          freed;
+    struct bsmp_tcp_stats   stats;
+    struct bsmp_tcp_conn    conns[BSMP_TCP_MAX_POOL];
+};
+
+typedef struct bsmp_tcp_pool bsmp_tcp_pool_t;
+
+// Context of the transport of one client. A connection is taken from the pool
+// by the first request sent and returned once every answer is in.
+struct bsmp_tcp_link
+{
+    bsmp_tcp_pool_t         *pool;
+    struct bsmp_tcp_conn    *conn;
+    unsigned int            inflight;
+};
+
+// Listening socket and the clients connected to it
+struct bsmp_tcp_server
+{
+    bsmp_server_t           *server;
+    int                     fd;
+    uint16_t                port;       // Bound to, see bsmp_tcp_listen
+    int                     timeout_ms; // Of answers to slow clients
+    struct bsmp_tcp_conn    conns[BSMP_TCP_MAX_CONNS];
+    uint8_t                 tx[BSMP_MAX_MESSAGE];
+};
+
+typedef struct bsmp_tcp_server bsmp_tcp_server_t;
+
+/*
+ * Initializes a pool of connections to a server. Nothing is connected until a
+ * client needs it. Sockets are set up for low latency: TCP_NODELAY, so that
+ * requests aren't held back by Nagle's algorithm, and, on Linux, TCP_QUICKACK
+ * once connected. Answers then carry the acknowledgements of requests.
+ *
+ * A connection that fails is closed, its client gets an error, and the next
+ * request connects again. Failed connects wait backoff_min_ms before the next
+ * try, doubling up to backoff_max_ms. Meanwhile, requests fail at once if every
+ * connection is backing off, and otherwise wait for a busy one to be freed or
+ * for a backoff to end.
+ *
+ * @param pool [input] Handle to the instance to be initialized
+ * @param host [input] Name or address of the server
+ * @param port [input] Port of the server
+ * @param size [input] Number of connections, up to BSMP_TCP_MAX_POOL. Clients
+ *                     wait for a free one when all are busy.
+ *
+ * @return BSMP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>BSMP_ERR_PARAM_INVALID: pool or host is a NULL pointer</li>
+ *   <li>BSMP_ERR_PARAM_OUT_OF_RANGE: size is 0 or too big</li>
+ *   <li>BSMP_ERR_IO: host couldn't be resolved</li>
+ * </ul>
+ */
+enum bsmp_err bsmp_tcp_pool_init (bsmp_tcp_pool_t *pool, const char *host,
+                                  uint16_t port, unsigned int size);
+
+/*
+ * Fills in a transport for bsmp_client_init_transport. Requests go out in a
+ * single sendmsg each, answers come from reads of as many bytes as there are,
+ * one read often bringing several pipelined answers at once.
+ *
+ * @param pool [input] An initialized pool
+ * @param link [output] Context of the transport, one per client
+ * @param transport [output] Transport through the pool
+ */
+void bsmp_tcp_transport (bsmp_tcp_pool_t *pool, struct bsmp_tcp_link *link,
+                         struct bsmp_transport *transport);
+
+/*
+ * Copies the stats of a pool.
+ *
+ * @param pool [input] An initialized pool
+ * @param stats [output] Stats since the pool was initialized
+ */
+void bsmp_tcp_pool_stats (bsmp_tcp_pool_t *pool, struct bsmp_tcp_stats *stats);
+
+/*
+ * Closes the connections of a pool and releases its resources. No client may
+ * be using it.
+ *
+ * @param pool [input] An initialized pool
+ */
+void bsmp_tcp_pool_destroy (bsmp_tcp_pool_t *pool);
+
+/*
+ * Listens for clients of a server.
+ *
+ * @param tcp [input] Handle to the instance to be initialized
+ * @param server [input] The server answering the requests
+ * @param host [input] Address to listen on, NULL for any
+ * @param port [input] Port to listen on, 0 for any. The port taken is then in
+ *                     tcp->port.
+ *
+ * @return BSMP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>BSMP_ERR_PARAM_INVALID: tcp or server is a NULL pointer</li>
+ *   <li>BSMP_ERR_IO: the socket couldn't be set up</li>
+ * </ul>
+ */
+enum bsmp_err bsmp_tcp_listen (bsmp_tcp_server_t *tcp, bsmp_server_t *server,
+                               const char *host, uint16_t port);
+
+/*
+ * Waits up to timeout_ms for clients to connect or send requests, and answers
+ * every request received. Each answer goes out in a single sendmsg, the
+ * values of the entities sent from their own memory.
+ *
+ * @param tcp [input] A listening instance
+ * @param timeout_ms [input] Longest wait, -1 to wait forever
+ *
+ * @return BSMP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>BSMP_ERR_PARAM_INVALID: tcp is a NULL pointer</li>
+ *   <li>BSMP_ERR_TIMEOUT: nothing happened in time</li>
+ *   <li>BSMP_ERR_COMM: the listening socket failed</li>
+ * </ul>
+ */
+enum bsmp_err bsmp_tcp_serve (bsmp_tcp_server_t *tcp, int timeout_ms);
+
+/*
+ * Closes the listening socket and the connections of its clients.
+ *
+ * @param tcp [input] A listening instance
+ */
+void bsmp_tcp_close (bsmp_tcp_server_t *tcp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,4 +1,7 @@
 #include "../include/bsmp.h"
+#include "bsmp_priv.h"
+
+#include <string.h>
 
 static char* error_str[BSMP_ERR_MAX] =
 {
@@ -10,12 +13,50 @@ static char* error_str[BSMP_ERR_MAX] =
     [BSMP_ERR_DUPLICATE]            = "Entity already registered",
     [BSMP_ERR_COMM]                 = "Sending or receiving a message failed",
     [BSMP_ERR_NOT_INITIALIZED]      = "Instance not initialized",
+    [BSMP_ERR_IO]                   = "Input/output error on a backing file",
+    [BSMP_ERR_NOT_SUPPORTED]        = "Operation not supported by the server",
+    [BSMP_ERR_TIMEOUT]              = "Timed out waiting for a response",
+    [BSMP_ERR_CHECKSUM]             = "Data doesn't match its checksum",
 };
 
+// The kernels work on the widest chunks available: pairs of 128-bit vectors
+// where the compiler maps them to SSE2 or NEON registers, then native words,
+// then single bytes for the tail. Unaligned buffers are handled by memcpy,
+// which compiles down to plain (unaligned) loads and stores.
+#if defined(__GNUC__) && (defined(__SSE2__) || defined(__ARM_NEON))
+typedef uint8_t binops_vec_t __attribute__((vector_size(16)));
+
+#define BINOPS_VEC_LOOP(operation)\
+        for(; i + 2*sizeof(binops_vec_t) <= size; i += 2*sizeof(binops_vec_t)) {\
+            binops_vec_t d[2], m[2];\
+            memcpy(d, data + i, sizeof(d));\
+            memcpy(m, mask + i, sizeof(m));\
+            d[0] operation m[0];\
+            d[1] operation m[1];\
+            memcpy(data + i, d, sizeof(d));\
+        }
+#else
+#define BINOPS_VEC_LOOP(operation)
+#endif
+
+typedef unsigned long binops_word_t;
+
 #define BINOPS_FUNC(name, operation)\
+    void binops_wide_##name (uint8_t *data, uint8_t *mask, uint16_t size) {\
+        unsigned int i = 0;\
+        BINOPS_VEC_LOOP(operation)\
+        for(; i + sizeof(binops_word_t) <= size; i += sizeof(binops_word_t)) {\
+            binops_word_t d, m;\
+            memcpy(&d, data + i, sizeof(d));\
+            memcpy(&m, mask + i, sizeof(m));\
+            d operation m;\
+            memcpy(data + i, &d, sizeof(d));\
+        }\
+        for(; i < size; ++i)\
+            data[i] operation mask[i];\
+    }\
     void binops_##name (uint8_t *data, uint8_t *mask, uint8_t size) {\
-        while(size--)\
-            data[size] operation mask[size];\
+        binops_wide_##name(data, mask, size);\
     }
 
 BINOPS_FUNC(and, &=)
@@ -33,6 +74,220 @@ bin_op_function bin_op[256] =
     ['T'] = binops_xor     // TOGGLE BITS
 };
 
+bin_op_wide_function bin_op_wide[256] =
+{
+    ['A'] = binops_wide_and,    // AND
+    ['X'] = binops_wide_xor,    // XOR
+    ['O'] = binops_wide_or,     // OR
+    ['C'] = binops_wide_clear,  // CLEAR BITS
+    ['S'] = binops_wide_or,     // SET BITS
+    ['T'] = binops_wide_xor     // TOGGLE BITS
+};
+
+// Curve block codec. The format is the one of LZF: a control byte below 32
+// starts a run of (control + 1) literals; any other control byte is a back
+// reference of (control >> 5) + 2 bytes (with the length continued in the next
+// byte when the 3-bit field is 7) at the distance given by its 5 lower bits and
+// the following byte, plus one.
+#define LZ_MAX_LIT          (1 << 5)
+#define LZ_MAX_OFF          (1 << 13)
+#define LZ_MAX_REF          ((1 << 8) + (1 << 3))
+#define LZ_HASH(p)          (((((uint32_t)(p)[0] << 16) | ((p)[1] << 8) | \
+                              (p)[2]) * 2654435761u) >> (32 - BSMP_LZ_HASH_LOG))
+
+// The output may run in the same buffer as the input, lag bytes before it. It
+// then never overtakes the input not read yet, and matches are only looked for
+// in the input not overwritten yet.
+#define LZ_NO_LAG           (2*BSMP_MAX_PAYLOAD)
+
+// Output of a byte, unless out is NULL for a dry run. Both arguments are
+// always evaluated.
+#define LZ_PUT(at, byte)    do { unsigned int at_ = (at);       \
+                                 uint8_t byte_ = (byte);        \
+                                 if(out) out[at_] = byte_; } while(0)
+
+static uint16_t lz_encode (const uint8_t *in, uint16_t in_len, uint8_t *out,
+                           uint16_t out_max, uint32_t lag)
+{
+    // Positions are never greater than BSMP_MAX_PAYLOAD, so they fit 16 bits.
+    // Stale or missing entries are harmless: candidates are always verified.
+    uint16_t htab[1 << BSMP_LZ_HASH_LOG];
+    memset(htab, 0, sizeof(htab));
+
+    unsigned int ip = 0;        // Next input byte
+    unsigned int op = 1;        // Next output byte, after a literal control
+    unsigned int lit = 0;       // Literals in the current run
+
+    while(ip + 2 < in_len)
+    {
+        unsigned int h   = LZ_HASH(in + ip);
+        unsigned int ref = htab[h];
+        htab[h] = ip;
+
+        if(ref < ip && ip - ref <= LZ_MAX_OFF && op <= ref + lag &&
+           in[ref] == in[ip] && in[ref + 1] == in[ip + 1] &&
+           in[ref + 2] == in[ip + 2])
+        {
+            unsigned int off    = ip - ref - 1;
+            unsigned int maxlen = in_len - ip;
+            unsigned int len    = 3;
+
+            if(maxlen > LZ_MAX_REF)
+                maxlen = LZ_MAX_REF;
+
+            while(len < maxlen && in[ref + len] == in[ip + len])
+                ++len;
+
+            // Close the literal run, or reuse its unused control byte
+            if(lit)
+                LZ_PUT(op - lit - 1, lit - 1);
+            else
+                --op;
+
+            // Up to three bytes and the control of the next run
+            if(op + 3 > out_max || op + 4 > ip + len + lag)
+                return 0;
+
+            if(len - 2 < 7)
+                LZ_PUT(op++, ((len - 2) << 5) | (off >> 8));
+            else
+            {
+                LZ_PUT(op++, (7 << 5) | (off >> 8));
+                LZ_PUT(op++, len - 2 - 7);
+            }
+            LZ_PUT(op++, off);
+
+            ip  += len;
+            lit  = 0;
+            ++op;                   // Control of the next literal run
+
+            // Keep the table warm with the end of the match
+            if(ip + 2 < in_len)
+            {
+                htab[LZ_HASH(in + ip - 2)] = ip - 2;
+                htab[LZ_HASH(in + ip - 1)] = ip - 1;
+            }
+            continue;
+        }
+
+        if(op >= out_max || op + 1 > ip + lag)
+            return 0;
+
+        LZ_PUT(op++, in[ip++]);
+
+        if(++lit == LZ_MAX_LIT)
+        {
+            LZ_PUT(op - lit - 1, lit - 1);
+            lit = 0;
+            ++op;
+        }
+    }
+
+    // Last bytes are too few to start a match
+    while(ip < in_len)
+    {
+        if(op >= out_max || op + 1 > ip + lag)
+            return 0;
+
+        LZ_PUT(op++, in[ip++]);
+
+        if(++lit == LZ_MAX_LIT)
+        {
+            LZ_PUT(op - lit - 1, lit - 1);
+            lit = 0;
+            ++op;
+        }
+    }
+
+    if(lit)
+        LZ_PUT(op - lit - 1, lit - 1);
+    else
+        --op;
+
+    return op;
+}
+
+uint16_t lz_compress (const uint8_t *in, uint16_t in_len, uint8_t *out,
+                      uint16_t out_max)
+{
+    return lz_encode(in, in_len, out, out_max, LZ_NO_LAG);
+}
+
+uint16_t lz_compress_in_place (uint8_t *buf, uint16_t in_at, uint16_t in_len,
+                               uint16_t out_max)
+{
+    // A dry run takes the same decisions without overwriting the input, so
+    // that it's left intact if compression fails
+    if(in_at < out_max && !lz_encode(buf + in_at, in_len, NULL, out_max, in_at))
+        return 0;
+
+    return lz_encode(buf + in_at, in_len, buf, out_max, in_at);
+}
+
+bool lz_decompress (const uint8_t *in, uint16_t in_len, uint8_t *out,
+                    uint16_t out_max, uint16_t *out_len)
+{
+    const uint8_t *in_end = in + in_len;
+    unsigned int op = 0;
+
+    while(in < in_end)
+    {
+        unsigned int ctrl = *in++;
+
+        if(ctrl < LZ_MAX_LIT)
+        {
+            unsigned int len = ctrl + 1;
+
+            if((unsigned int)(in_end - in) < len || op + len > out_max)
+                return false;
+
+            memcpy(out + op, in, len);
+            in += len;
+            op += len;
+        }
+        else
+        {
+            unsigned int len = ctrl >> 5;
+
+            if(len == 7)
+            {
+                if(in >= in_end)
+                    return false;
+                len += *in++;
+            }
+            len += 2;
+
+            if(in >= in_end)
+                return false;
+
+            unsigned int off = (((ctrl & 0x1F) << 8) | *in++) + 1;
+
+            if(off > op || op + len > out_max)
+                return false;
+
+            // Source and destination overlap when off < len: copy bytewise
+            uint8_t *ref = out + op - off;
+            unsigned int i;
+            for(i = 0; i < len; ++i)
+                out[op + i] = ref[i];
+            op += len;
+        }
+    }
+
+    *out_len = op;
+    return true;
+}
+
+uint64_t schema_hash (uint64_t hash, const uint8_t *data, unsigned int len)
+{
+    while(len--)
+    {
+        hash ^= *data++;
+        hash *= UINT64_C(0x100000001B3);
+    }
+    return hash;
+}
+
 char *bsmp_error_str (enum bsmp_err error)
 {
     return error_str[error];
@@ -14,6 +14,61 @@
 #define WRITABLE            0x80
 #define READ_ONLY           0x00
 
+#define GENERATION_SIZE     4       // Bytes of a generation on the wire
+#define EPOCH_SIZE          4       // Bytes of a server epoch on the wire
+#define DELTA_SEQ_SIZE      2       // Bytes of a delta sequence number
+#define DELTA_BITMAP_SIZE(count)    (((count) + 7)/8)
+
+// Same as bin_op, for buffers larger than 255 bytes (a whole group, for
+// instance)
+typedef void (*bin_op_wide_function) (uint8_t *data, uint8_t *mask,
+                                      uint16_t size);
+extern bin_op_wide_function bin_op_wide[256];
+
+// Size of the hash table of the curve block compressor, as a power of two. It
+// lives on the stack: two bytes per entry.
+#ifndef BSMP_LZ_HASH_LOG
+#define BSMP_LZ_HASH_LOG    10
+#endif
+
+// Compress in_len bytes. Returns the compressed size, or 0 if it doesn't fit in
+// out_max bytes.
+uint16_t lz_compress (const uint8_t *in, uint16_t in_len, uint8_t *out,
+                      uint16_t out_max);
+
+// Same as lz_compress, for in_len bytes at buf + in_at compressed to the start
+// of buf. Compression gives up when the output would overwrite input not read
+// yet, which a small in_at makes likely for data that doesn't compress well.
+// The input is left intact when it does.
+uint16_t lz_compress_in_place (uint8_t *buf, uint16_t in_at, uint16_t in_len,
+                               uint16_t out_max);
+
+// Decompress in_len bytes. Fails if the data is malformed or if it would
+// decompress to more than out_max bytes.
+bool lz_decompress (const uint8_t *in, uint16_t in_len, uint8_t *out,
+                    uint16_t out_max, uint16_t *out_len);
+
+// Schema image: what a client learns when it's initialized, each list as its
+// query command answers it, in this order:
+//   number of variables, list of variables,
+//   number of groups, list of groups, variables of each group,
+//   number of curves, list of curves, checksum of each curve,
+//   number of functions, list of functions
+#define SCHEMA_MAX_SIZE     (1 + BSMP_MAX_VARIABLES +\
+                             1 + BSMP_MAX_GROUPS*(1 + BSMP_MAX_VARIABLES) +\
+                             1 + BSMP_MAX_CURVES*(BSMP_CURVE_LIST_INFO +\
+                                                  BSMP_CURVE_CSUM_SIZE) +\
+                             1 + BSMP_MAX_FUNCTIONS)
+
+// Answer to a schema query: version (3 bytes) and fingerprint (8 bytes)
+#define SCHEMA_ANSWER_SIZE  11
+
+// The fingerprint of a schema is the 64-bit FNV-1a hash of its image. Hash len
+// more bytes, starting from SCHEMA_HASH_INIT.
+#define SCHEMA_HASH_INIT    UINT64_C(0xCBF29CE484222325)
+
+uint64_t schema_hash (uint64_t hash, const uint8_t *data, unsigned int len);
+
 enum command_code
 {
     // Query commands
@@ -31,12 +86,18 @@ enum command_code
     CMD_CURVE_CSUM,
     CMD_FUNC_QUERY_LIST,
     CMD_FUNC_LIST,
+    CMD_SCHEMA_QUERY,
+    CMD_SCHEMA,
 
     // Read commands
     CMD_VAR_READ            = 0x10,
     CMD_VAR_VALUE,
     CMD_GROUP_READ,
     CMD_GROUP_VALUES,
+    CMD_GROUP_READ_CHANGED,
+    CMD_GROUP_CHANGED,
+    CMD_GROUP_READ_DELTA,
+    CMD_GROUP_DELTA,
 
     // Write commands
     CMD_VAR_WRITE           = 0x20,
@@ -44,15 +105,19 @@ enum command_code
     CMD_VAR_BIN_OP          = 0x24,
     CMD_GROUP_BIN_OP        = 0x26,
     CMD_VAR_WRITE_READ      = 0x28,
+    CMD_GROUP_BIN_OP_BCAST  = 0x2A,
 
     // Group manipulation commands
     CMD_GROUP_CREATE        = 0x30,
     CMD_GROUP_REMOVE_ALL    = 0x32,
+    CMD_GROUP_LATCH         = 0x34,
 
     // Curve commands
     CMD_CURVE_BLOCK_REQUEST = 0x40,
     CMD_CURVE_BLOCK,
     CMD_CURVE_RECALC_CSUM,
+    CMD_CURVE_BLOCK_REQUEST_LZ,
+    CMD_CURVE_BLOCK_LZ,
 
     // Function commands
     CMD_FUNC_EXECUTE        = 0x50,
@@ -1,4 +1,5 @@
 #include "bsmp_priv.h"
+#include "client_priv.h"
 #include "../include/client.h"
 
 #include <stdio.h>
@@ -17,15 +18,8 @@ static char bin_op_code[BIN_OP_COUNT] =
     [BIN_OP_TOGGLE] = 'T',
 };
 
-struct bsmp_message
-{
-    uint8_t     code;
-    uint16_t    payload_size;
-    uint8_t     payload[BSMP_MAX_PAYLOAD];
-};
-
 #define LIST_CONTAINS(name, list_type, item_type)\
-    static bool name##_list_contains(list_type *list, item_type *item){\
+    bool name##_list_contains(list_type *list, item_type *item){\
         unsigned int i;\
         for(i = 0; i < list->count; ++i)\
             if(list->list+i == item)\
@@ -38,112 +32,198 @@ LIST_CONTAINS(groups,   struct bsmp_group_list,         struct bsmp_group)
 LIST_CONTAINS(curves,   struct bsmp_curve_info_list,    struct bsmp_curve_info)
 LIST_CONTAINS(funcs,    struct bsmp_func_info_list,     struct bsmp_func_info)
 
-static enum bsmp_err command(bsmp_client_t *client, struct bsmp_message *request,
-                             struct bsmp_message *response)
+void request_flatten(struct bsmp_message *request)
 {
-    if(!client || !request || !response)
-        return BSMP_ERR_PARAM_INVALID;
+    memcpy(request->payload + request->payload_size, request->tail,
+           request->tail_size);
+
+    request->payload_size += request->tail_size;
+    request->tail_size     = 0;
+}
+
+// Send a request built with REQUEST. The buffer of the client may be reused as
+// soon as it returns.
+static enum bsmp_err send_request(bsmp_client_t *client,
+                                  struct bsmp_message *request)
+{
+    struct bsmp_transport *t = &client->transport;
+    uint16_t payload_size = request->payload_size + request->tail_size;
+
+    // Header right before the payload
+    client->buf[0] = request->code;
+    client->buf[1] = payload_size >> 8;
+    client->buf[2] = payload_size;
 
-    struct
+    if(request->tail_size && t->sendv)
     {
-        uint8_t data[BSMP_MAX_MESSAGE];
-        uint32_t size;
-    }send_buf, recv_buf;
+        struct bsmp_iov iov[2] = {
+            {client->buf, BSMP_HEADER_SIZE + request->payload_size},
+            {request->tail, request->tail_size}
+        };
+
+        if(t->sendv(t->ctx, iov, 2))
+            return BSMP_ERR_COMM;
 
-    // Prepare buffer with the message to be sent
-    send_buf.data[0] = request->code;      // Code in the first byte
-    send_buf.data[1] = request->payload_size >> 8;
-    send_buf.data[2] = request->payload_size;
+        return BSMP_SUCCESS;
+    }
 
-    // Payload in the subsequent bytes
-    memcpy(&send_buf.data[BSMP_HEADER_SIZE], request->payload,
-           request->payload_size);
+    request_flatten(request);
 
-    // Send request
-    send_buf.size = BSMP_HEADER_SIZE + request->payload_size;
-    if(client->send(send_buf.data, &send_buf.size))
+    if(t->send(t->ctx, client->buf, BSMP_HEADER_SIZE + payload_size))
         return BSMP_ERR_COMM;
 
-    // Receive response
-    if(client->recv(recv_buf.data, &recv_buf.size))
+    return BSMP_SUCCESS;
+}
+
+// Receive the response to the oldest request sent. Its payload is only valid
+// until the next request is encoded or, if the transport receives in its own
+// buffer, until the next response is received.
+static enum bsmp_err recv_response(bsmp_client_t *client,
+                                   struct bsmp_message *response)
+{
+    struct bsmp_transport *t = &client->transport;
+    uint8_t *msg = client->buf;
+    uint32_t size;
+
+    if(t->recv_zc ? t->recv_zc(t->ctx, &msg, &size) :
+                    t->recv(t->ctx, msg, &size))
         return BSMP_ERR_COMM;
 
     // Must receive, at least, command and size
-    if(recv_buf.size < 2)
+    if(size < BSMP_HEADER_SIZE)
         return BSMP_ERR_COMM;
 
-    // Copy command code and get payload size
-    response->code = recv_buf.data[0];
-    response->payload_size = (recv_buf.data[1] << 8) | recv_buf.data[2];
+    response->code         = msg[0];
+    response->payload_size = (msg[1] << 8) | msg[2];
+    response->payload      = msg + BSMP_HEADER_SIZE;
 
-    // Copy response
-    memcpy(response->payload, &recv_buf.data[BSMP_HEADER_SIZE], recv_buf.size);
+    if(response->payload_size > size - BSMP_HEADER_SIZE)
+        return BSMP_ERR_COMM;
 
     return BSMP_SUCCESS;
 }
 
-static enum bsmp_err get_version(bsmp_client_t *client)
+// Send a request built with REQUEST and receive its response. The response
+// overwrites the request: its payload is only valid until the next command.
+static enum bsmp_err command(bsmp_client_t *client, struct bsmp_message *request,
+                             struct bsmp_message *response)
 {
-    if(!client)
+    if(!client || !request || !response)
         return BSMP_ERR_PARAM_INVALID;
 
-    struct bsmp_message response, request =
-    {
-        .code = CMD_QUERY_VERSION,
-        .payload_size = 0
-    };
-
-    if(command(client, &request, &response))
+    if(send_request(client, request) || recv_response(client, response))
         return BSMP_ERR_COMM;
 
-    // Special case: v1.0
-    if(response.code == CMD_ERR_OP_NOT_SUPPORTED)
-    {
-        client->server_version.major    = 1;
-        client->server_version.minor    = 0;
-        client->server_version.revision = 0;
-    }
-    else
+    return BSMP_SUCCESS;
+}
+
+// Sequence of similar commands, kept up to client->pipeline deep in flight.
+// encode builds the i-th request, decode handles the i-th response. Either may
+// lower count to stop the sequence early.
+struct pipeline
+{
+    unsigned int count;
+    enum bsmp_err (*encode) (bsmp_client_t *client, struct pipeline *p,
+                             unsigned int i, struct bsmp_message *request);
+    enum bsmp_err (*decode) (bsmp_client_t *client, struct pipeline *p,
+                             unsigned int i, struct bsmp_message *response);
+    void *ctx;
+};
+
+static enum bsmp_err pipeline_run(bsmp_client_t *client, struct pipeline *p)
+{
+    enum bsmp_err err = BSMP_SUCCESS;
+    unsigned int sent = 0, received = 0;
+
+    for(;;)
     {
-        client->server_version.major    = response.payload[0];
-        client->server_version.minor    = response.payload[1];
-        client->server_version.revision = response.payload[2];
+        // Keep the pipe full, unless something went wrong
+        while(!err && sent < p->count && sent - received < client->pipeline)
+        {
+            struct bsmp_message request = REQUEST(client, 0);
+
+            if((err = p->encode(client, p, sent, &request)))
+                break;
+
+            if(send_request(client, &request))
+                return BSMP_ERR_COMM;
+
+            ++sent;
+        }
+
+        if(received == sent)
+            break;
+
+        // Responses to requests past the end or after an error are drained,
+        // so that the next command gets its own response
+        struct bsmp_message response;
+
+        if(recv_response(client, &response))
+            return BSMP_ERR_COMM;
+
+        if(!err && received < p->count)
+            err = p->decode(client, p, received, &response);
+
+        ++received;
     }
 
+    return err;
+}
+
+// Major, minor and revision
+static void set_version(bsmp_client_t *client, uint8_t *version)
+{
     struct bsmp_version *v = &client->server_version;
+
+    v->major    = version[0];
+    v->minor    = version[1];
+    v->revision = version[2];
+
     snprintf(v->str, BSMP_VERSION_STR_MAX_LEN, "%d.%02d.%03d", v->major,
              v->minor, v->revision);
-
-    return BSMP_SUCCESS;
 }
 
-static enum bsmp_err update_vars_list(bsmp_client_t *client)
+static enum bsmp_err get_version(bsmp_client_t *client)
 {
     if(!client)
         return BSMP_ERR_PARAM_INVALID;
 
-    struct bsmp_message response, request =
-    {
-        .code = CMD_VAR_QUERY_LIST,
-        .payload_size = 0
-    };
+    struct bsmp_message response, request = REQUEST(client, CMD_QUERY_VERSION);
 
-    if(command(client, &request, &response) || response.code != CMD_VAR_LIST)
+    if(command(client, &request, &response))
         return BSMP_ERR_COMM;
 
+    // Special case: v1.0
+    if(response.code == CMD_ERR_OP_NOT_SUPPORTED)
+        set_version(client, (uint8_t[]){1, 0, 0});
+    else
+        set_version(client, response.payload);
+
+    return BSMP_SUCCESS;
+}
+
+// The lists are parsed by the following functions, whether they come from the
+// server or from a schema cache
+
+static enum bsmp_err vars_list_parse(bsmp_client_t *client, uint8_t *list,
+                                     uint16_t size)
+{
     // Zero list
     memset(&client->vars, 0, sizeof(client->vars));
 
-    // Number of bytes in the payload corresponds to the number of vars in the
+    if(size > BSMP_MAX_VARIABLES)
+        return BSMP_ERR_COMM;
+
+    // Number of bytes in the list corresponds to the number of vars in the
     // server
-    client->vars.count = response.payload_size;
+    client->vars.count = size;
 
     unsigned int i;
     for(i = 0; i < client->vars.count; ++i)
     {
         client->vars.list[i].id       = i;
-        client->vars.list[i].writable = response.payload[i] & WRITABLE_MASK;
-        client->vars.list[i].size     = response.payload[i] & SIZE_MASK;
+        client->vars.list[i].writable = list[i] & WRITABLE_MASK;
+        client->vars.list[i].size     = list[i] & SIZE_MASK;
 
         if(!client->vars.list[i].size)
             client->vars.list[i].size = BSMP_VAR_MAX_SIZE;
@@ -152,169 +232,269 @@ static enum bsmp_err update_vars_list(bsmp_client_t *client)
     return BSMP_SUCCESS;
 }
 
-static enum bsmp_err update_groups_list(bsmp_client_t *client)
+static enum bsmp_err groups_list_parse(bsmp_client_t *client, uint8_t *list,
+                                       uint16_t size)
 {
-    if(!client)
-        return BSMP_ERR_PARAM_INVALID;
-
-    struct bsmp_message response, request =
-    {
-        .code = CMD_GROUP_QUERY_LIST,
-        .payload_size = 0
-    };
-
-    if(command(client, &request, &response))
-        return BSMP_ERR_COMM;
-
-    if(response.code != CMD_GROUP_LIST)
-        return BSMP_ERR_COMM;           // TODO: better error code
-
-    // Zero list
+    // Zero list. Images of the old groups may not fit the new ones.
     memset(&client->groups, 0, sizeof(client->groups));
+    memset(client->images, 0, sizeof(client->images));
 
-    // Number of bytes in the payload corresponds to the number of groups in the
+    // Number of bytes in the list corresponds to the number of groups in the
     // server
-    client->groups.count = response.payload_size;
+    if(size > BSMP_MAX_GROUPS)
+        return BSMP_ERR_COMM;
+
+    client->groups.count = size;
 
-    // Fill information for each group
-    enum bsmp_err err_code;
     unsigned int i;
     for(i = 0; i < client->groups.count; ++i)
     {
-        // Fill in its info
         struct bsmp_group *grp = &client->groups.list[i];
 
         grp->id         = i;
         grp->size       = 0;
-        grp->writable   = response.payload[i] & WRITABLE_MASK;
-        grp->vars.count = response.payload[i] & SIZE_MASK;
-
-        // Query each group's variables list
-        struct bsmp_message grp_response, grp_request = {
-            .code           = CMD_GROUP_QUERY,
-            .payload_size   = 1,
-            .payload        = {i}
-        };
-
-        if(command(client, &grp_request, &grp_response) ||
-                   grp_response.code != CMD_GROUP)
-        {
-            err_code = BSMP_ERR_COMM;
-            goto err;
-        }
-
-        // Each byte in the response is a variable id
-        unsigned int j;
-        struct bsmp_var_info *var;
-        for(j = 0; j < grp_response.payload_size; ++j)
-        {
-            var = &client->vars.list[grp_response.payload[j]];
-            grp->vars.list[j] = var;
-            grp->size += var->size;
-        }
+        grp->writable   = list[i] & WRITABLE_MASK;
+        grp->vars.count = list[i] & SIZE_MASK;
     }
 
     return BSMP_SUCCESS;
-
-err:
-    client->groups.count = 0;
-    return err_code;
 }
 
-static enum bsmp_err update_curves_list(bsmp_client_t *client)
+// Variables of a group
+static enum bsmp_err group_parse(bsmp_client_t *client, struct bsmp_group *grp,
+                                 uint8_t *list, uint16_t size)
 {
-    if(!client)
-        return BSMP_ERR_PARAM_INVALID;
+    if(size > BSMP_MAX_VARIABLES)
+        return BSMP_ERR_COMM;
 
-    struct bsmp_message response, request =
+    // Each byte in the list is a variable id
+    unsigned int j;
+    struct bsmp_var_info *var;
+    for(j = 0; j < size; ++j)
     {
-        .code = CMD_CURVE_QUERY_LIST,
-        .payload_size = 0
-    };
+        if(list[j] >= client->vars.count)
+            return BSMP_ERR_COMM;
 
-    if(command(client, &request, &response) || response.code != CMD_CURVE_LIST)
-        return BSMP_ERR_COMM;
+        var = &client->vars.list[list[j]];
+        grp->vars.list[j] = var;
+        grp->size += var->size;
+    }
+
+    return BSMP_SUCCESS;
+}
 
+static enum bsmp_err curves_list_parse(bsmp_client_t *client, uint8_t *list,
+                                       uint16_t size)
+{
     // Zero list
     memset(&client->curves, 0, sizeof(client->curves));
 
-    // Each 3-byte block in the response correspond to a curve
-    client->curves.count = response.payload_size/BSMP_CURVE_LIST_INFO;
+    // Each 5-byte block in the list corresponds to a curve
+    if(size/BSMP_CURVE_LIST_INFO > BSMP_MAX_CURVES)
+        return BSMP_ERR_COMM;
+
+    client->curves.count = size/BSMP_CURVE_LIST_INFO;
 
     unsigned int i;
-    uint8_t *payloadp = response.payload;
     for(i = 0; i < client->curves.count; ++i)
     {
         struct bsmp_curve_info *curve = &client->curves.list[i];
 
         curve->id            = i;
-        curve->writable      = *(payloadp++);
-        curve->block_size    = *(payloadp++) << 8;
-        curve->block_size   += *(payloadp++);
-        curve->nblocks       = *(payloadp++) << 8;
-        curve->nblocks      += *(payloadp++);
+        curve->writable      = *(list++);
+        curve->block_size    = *(list++) << 8;
+        curve->block_size   += *(list++);
+        curve->nblocks       = *(list++) << 8;
+        curve->nblocks      += *(list++);
 
         if(!curve->nblocks)
             curve->nblocks = BSMP_CURVE_MAX_BLOCKS;
+    }
 
-        struct bsmp_message response_csum, request_csum =
-        {
-            .code = CMD_CURVE_QUERY_CSUM,
-            .payload = {i},
-            .payload_size = 1
-        };
+    return BSMP_SUCCESS;
+}
+
+static enum bsmp_err funcs_list_parse(bsmp_client_t *client, uint8_t *list,
+                                      uint16_t size)
+{
+    // Zero list
+    memset(&client->funcs, 0, sizeof(client->funcs));
+
+    if(size > BSMP_MAX_FUNCTIONS)
+        return BSMP_ERR_COMM;
 
-        if(command(client, &request_csum, &response_csum) ||
-           response_csum.code != CMD_CURVE_CSUM)
-            continue;
+    // Number of bytes in the list corresponds to the number of funcs in the
+    // server
+    client->funcs.count = size;
 
-        memcpy(curve->checksum, response_csum.payload, BSMP_CURVE_CSUM_SIZE);
+    unsigned int i;
+    for(i = 0; i < client->funcs.count; ++i)
+    {
+        client->funcs.list[i].id            = i;
+        client->funcs.list[i].input_size    = (list[i] & 0xF0) >> 4;
+        client->funcs.list[i].output_size   = (list[i] & 0x0F);
     }
 
     return BSMP_SUCCESS;
 }
 
-static enum bsmp_err update_funcs_list(bsmp_client_t *client)
+static enum bsmp_err update_vars_list(bsmp_client_t *client)
+{
+    if(!client)
+        return BSMP_ERR_PARAM_INVALID;
+
+    struct bsmp_message response, request = REQUEST(client, CMD_VAR_QUERY_LIST);
+
+    if(command(client, &request, &response) || response.code != CMD_VAR_LIST)
+        return BSMP_ERR_COMM;
+
+    return vars_list_parse(client, response.payload, response.payload_size);
+}
+
+static enum bsmp_err group_query_encode(bsmp_client_t *client,
+                                        struct pipeline *p, unsigned int i,
+                                        struct bsmp_message *request)
+{
+    (void) client; (void) p;
+
+    request->code         = CMD_GROUP_QUERY;
+    request->payload[0]   = i;
+    request->payload_size = 1;
+
+    return BSMP_SUCCESS;
+}
+
+static enum bsmp_err group_query_decode(bsmp_client_t *client,
+                                        struct pipeline *p, unsigned int i,
+                                        struct bsmp_message *response)
+{
+    (void) p;
+
+    if(response->code != CMD_GROUP)
+        return BSMP_ERR_COMM;
+
+    return group_parse(client, &client->groups.list[i], response->payload,
+                       response->payload_size);
+}
+
+static enum bsmp_err update_groups_list(bsmp_client_t *client)
 {
     if(!client)
         return BSMP_ERR_PARAM_INVALID;
 
     struct bsmp_message response, request =
-    {
-        .code = CMD_FUNC_QUERY_LIST,
-        .payload_size = 0
-    };
+        REQUEST(client, CMD_GROUP_QUERY_LIST);
 
-    if(command(client, &request, &response) || response.code != CMD_FUNC_LIST)
+    if(command(client, &request, &response))
         return BSMP_ERR_COMM;
 
-    // Zero list
-    memset(&client->funcs, 0, sizeof(client->funcs));
+    if(response.code != CMD_GROUP_LIST)
+        return BSMP_ERR_COMM;           // TODO: better error code
 
-    // Number of bytes in the payload corresponds to the number of funcs in the
-    // server
-    client->funcs.count = response.payload_size;
+    // Fill in the info of each group before the list is overwritten by the
+    // next command
+    enum bsmp_err err_code;
+    if((err_code = groups_list_parse(client, response.payload,
+                                     response.payload_size)))
+        return err_code;
+
+    // Query each group's variables list
+    struct pipeline p = {
+        .count  = client->groups.count,
+        .encode = group_query_encode,
+        .decode = group_query_decode,
+    };
 
-    unsigned int i;
-    for(i = 0; i < client->funcs.count; ++i)
-    {
-        client->funcs.list[i].id            = i;
-        client->funcs.list[i].input_size    = (response.payload[i] & 0xF0) >> 4;
-        client->funcs.list[i].output_size   = (response.payload[i] & 0x0F);
-    }
+    if((err_code = pipeline_run(client, &p)))
+        client->groups.count = 0;
+
+    return err_code;
+}
+
+static enum bsmp_err curve_csum_encode(bsmp_client_t *client,
+                                       struct pipeline *p, unsigned int i,
+                                       struct bsmp_message *request)
+{
+    (void) client; (void) p;
+
+    request->code         = CMD_CURVE_QUERY_CSUM;
+    request->payload[0]   = i;
+    request->payload_size = 1;
 
     return BSMP_SUCCESS;
 }
 
-enum bsmp_err bsmp_client_init (bsmp_client_t *client,
-                                bsmp_comm_func_t send_func,
-                                bsmp_comm_func_t recv_func)
+static enum bsmp_err curve_csum_decode(bsmp_client_t *client,
+                                       struct pipeline *p, unsigned int i,
+                                       struct bsmp_message *response)
+{
+    (void) p;
+
+    // A missing checksum is not an error: it's left zeroed
+    if(response->code == CMD_CURVE_CSUM &&
+       response->payload_size == BSMP_CURVE_CSUM_SIZE)
+        memcpy(client->curves.list[i].checksum, response->payload,
+               BSMP_CURVE_CSUM_SIZE);
+
+    return BSMP_SUCCESS;
+}
+
+static enum bsmp_err update_curves_list(bsmp_client_t *client)
 {
     if(!client)
         return BSMP_ERR_PARAM_INVALID;
 
-    client->send = send_func;
-    client->recv = recv_func;
+    struct bsmp_message response, request =
+        REQUEST(client, CMD_CURVE_QUERY_LIST);
+
+    if(command(client, &request, &response) || response.code != CMD_CURVE_LIST)
+        return BSMP_ERR_COMM;
+
+    enum bsmp_err err;
+    if((err = curves_list_parse(client, response.payload,
+                                response.payload_size)))
+        return err;
+
+    // The list is overwritten from now on
+    struct pipeline p = {
+        .count  = client->curves.count,
+        .encode = curve_csum_encode,
+        .decode = curve_csum_decode,
+    };
+
+    return pipeline_run(client, &p);
+}
+
+static enum bsmp_err update_funcs_list(bsmp_client_t *client)
+{
+    if(!client)
+        return BSMP_ERR_PARAM_INVALID;
+
+    struct bsmp_message response, request =
+        REQUEST(client, CMD_FUNC_QUERY_LIST);
+
+    if(command(client, &request, &response) || response.code != CMD_FUNC_LIST)
+        return BSMP_ERR_COMM;
+
+    return funcs_list_parse(client, response.payload, response.payload_size);
+}
+
+// Adapters of the send and recv functions of bsmp_client_init to a transport
+static int comm_send(void *ctx, uint8_t *data, uint32_t len)
+{
+    return ((bsmp_client_t *) ctx)->send(data, &len);
+}
+
+static int comm_recv(void *ctx, uint8_t *data, uint32_t *len)
+{
+    return ((bsmp_client_t *) ctx)->recv(data, len);
+}
+
+static void client_reset(bsmp_client_t *client,
+                         const struct bsmp_transport *transport,
+                         unsigned int depth)
+{
+    client->transport = *transport;
 
     client->vars.count = 0;
     memset(&client->vars, 0, sizeof(client->vars));
@@ -328,6 +508,16 @@ enum bsmp_err bsmp_client_init (bsmp_client_t *client,
     client->funcs.count = 0;
     memset(&client->funcs, 0, sizeof(client->funcs));
 
+    memset(client->images, 0, sizeof(client->images));
+
+    // Until the server says otherwise
+    client->curve_lz = true;
+
+    client->pipeline = depth;
+}
+
+static enum bsmp_err discover(bsmp_client_t *client)
+{
     enum bsmp_err err;
 
     if((err = get_version(client)))
@@ -348,52 +538,392 @@ enum bsmp_err bsmp_client_init (bsmp_client_t *client,
     return BSMP_SUCCESS;
 }
 
-#define BSMP_GET_LIST(name, type)\
-    enum bsmp_err bsmp_get_##name##_list (bsmp_client_t *client, type **list) {\
-        if(!client || !list)\
-            return BSMP_ERR_PARAM_INVALID;\
-        *list = &client->name;\
-        return BSMP_SUCCESS;\
-    }
+/* Schema cache */
 
-BSMP_GET_LIST(vars,     struct bsmp_var_info_list)
-BSMP_GET_LIST(groups,   struct bsmp_group_list)
-BSMP_GET_LIST(curves,   struct bsmp_curve_info_list)
-BSMP_GET_LIST(funcs,    struct bsmp_func_info_list)
+// Cache file: magic, format, server version (3 bytes), fingerprint (8 bytes),
+// image size (2 bytes) and the image itself (see bsmp_priv.h)
+#define SCHEMA_MAGIC            "BSMP"
+#define SCHEMA_MAGIC_SIZE       4
+#define SCHEMA_FORMAT           1
+#define SCHEMA_HEADER_SIZE      (SCHEMA_MAGIC_SIZE + 1 + 3 + 8 + 2)
 
-struct bsmp_version *bsmp_get_version(bsmp_client_t *client)
+static void put_u64(uint8_t *p, uint64_t value)
 {
-    if(client)
-        return &client->server_version;
-    return NULL;
+    unsigned int i;
+    for(i = 0; i < 8; ++i)
+        p[i] = value >> (56 - 8*i);
 }
 
-enum bsmp_err bsmp_read_var (bsmp_client_t *client, struct bsmp_var_info *var,
-                             uint8_t *value)
+static uint64_t get_u64(uint8_t *p)
 {
-    if(!client || !var || !value)
-        return BSMP_ERR_PARAM_INVALID;
-
+    uint64_t value = 0;
+    unsigned int i;
+    for(i = 0; i < 8; ++i)
+        value = (value << 8) | p[i];
+    return value;
+}
+
+// Version and fingerprint of the schema of the server
+static enum bsmp_err query_schema(bsmp_client_t *client, uint64_t *fingerprint)
+{
+    struct bsmp_message response, request = REQUEST(client, CMD_SCHEMA_QUERY);
+
+    if(command(client, &request, &response))
+        return BSMP_ERR_COMM;
+
+    if(response.code != CMD_SCHEMA ||
+       response.payload_size != SCHEMA_ANSWER_SIZE)
+        return BSMP_ERR_NOT_SUPPORTED;
+
+    set_version(client, response.payload);
+    *fingerprint = get_u64(response.payload + 3);
+
+    return BSMP_SUCCESS;
+}
+
+// Build the image of the lists of the client. Returns its size.
+static unsigned int schema_encode(bsmp_client_t *client, uint8_t *image)
+{
+    uint8_t *p = image;
+    unsigned int i, j;
+
+    *(p++) = client->vars.count;
+    for(i = 0; i < client->vars.count; ++i)
+    {
+        struct bsmp_var_info *var = &client->vars.list[i];
+        *(p++) = (var->size & SIZE_MASK) | (var->writable ? WRITABLE : READ_ONLY);
+    }
+
+    *(p++) = client->groups.count;
+    for(i = 0; i < client->groups.count; ++i)
+    {
+        struct bsmp_group *grp = &client->groups.list[i];
+        *(p++) = (grp->writable ? WRITABLE : READ_ONLY) + grp->vars.count;
+    }
+
+    for(i = 0; i < client->groups.count; ++i)
+    {
+        struct bsmp_group *grp = &client->groups.list[i];
+        for(j = 0; j < grp->vars.count; ++j)
+            *(p++) = grp->vars.list[j]->id;
+    }
+
+    *(p++) = client->curves.count;
+    for(i = 0; i < client->curves.count; ++i)
+    {
+        struct bsmp_curve_info *curve = &client->curves.list[i];
+
+        *(p++) = curve->writable;
+        *(p++) = curve->block_size >> 8;
+        *(p++) = curve->block_size;
+        *(p++) = curve->nblocks >> 8;
+        *(p++) = curve->nblocks;
+    }
+
+    for(i = 0; i < client->curves.count; ++i)
+    {
+        memcpy(p, client->curves.list[i].checksum, BSMP_CURVE_CSUM_SIZE);
+        p += BSMP_CURVE_CSUM_SIZE;
+    }
+
+    *(p++) = client->funcs.count;
+    for(i = 0; i < client->funcs.count; ++i)
+    {
+        struct bsmp_func_info *func = &client->funcs.list[i];
+        *(p++) = (func->input_size << 4) | (func->output_size & 0x0F);
+    }
+
+    return p - image;
+}
+
+// Next size bytes of an image, or NULL if it's too short
+static uint8_t *image_take(uint8_t **pos, uint8_t *end, unsigned int size)
+{
+    uint8_t *p = *pos;
+
+    if((unsigned int)(end - p) < size)
+        return NULL;
+
+    *pos = p + size;
+    return p;
+}
+
+// Fill in the lists of the client from an image
+static enum bsmp_err schema_decode(bsmp_client_t *client, uint8_t *image,
+                                   unsigned int size)
+{
+    uint8_t *pos = image, *end = image + size, *list, *count;
+    unsigned int i;
+
+#define TAKE(n) if(!(list = image_take(&pos, end, (n)))) return BSMP_ERR_COMM
+
+    if(!(count = image_take(&pos, end, 1)))
+        return BSMP_ERR_COMM;
+    TAKE(*count);
+    if(vars_list_parse(client, list, *count))
+        return BSMP_ERR_COMM;
+
+    if(!(count = image_take(&pos, end, 1)))
+        return BSMP_ERR_COMM;
+    TAKE(*count);
+    if(groups_list_parse(client, list, *count))
+        return BSMP_ERR_COMM;
+
+    for(i = 0; i < client->groups.count; ++i)
+    {
+        struct bsmp_group *grp = &client->groups.list[i];
+
+        TAKE(grp->vars.count);
+        if(group_parse(client, grp, list, grp->vars.count))
+            return BSMP_ERR_COMM;
+    }
+
+    if(!(count = image_take(&pos, end, 1)))
+        return BSMP_ERR_COMM;
+    TAKE(*count*BSMP_CURVE_LIST_INFO);
+    if(curves_list_parse(client, list, *count*BSMP_CURVE_LIST_INFO))
+        return BSMP_ERR_COMM;
+
+    for(i = 0; i < client->curves.count; ++i)
+    {
+        TAKE(BSMP_CURVE_CSUM_SIZE);
+        memcpy(client->curves.list[i].checksum, list, BSMP_CURVE_CSUM_SIZE);
+    }
+
+    if(!(count = image_take(&pos, end, 1)))
+        return BSMP_ERR_COMM;
+    TAKE(*count);
+    if(funcs_list_parse(client, list, *count))
+        return BSMP_ERR_COMM;
+
+#undef TAKE
+
+    return pos == end ? BSMP_SUCCESS : BSMP_ERR_COMM;
+}
+
+// Load the lists from a cache file, if it holds the given schema
+static enum bsmp_err schema_load(bsmp_client_t *client, const char *path,
+                                 uint64_t fingerprint)
+{
+    // The buffer of the client is free during the initialization
+    uint8_t *header = client->buf, *image = header + SCHEMA_HEADER_SIZE;
+    struct bsmp_version *v = &client->server_version;
+
+    FILE *file = fopen(path, "rb");
+    if(!file)
+        return BSMP_ERR_IO;
+
+    size_t size = fread(header, 1, SCHEMA_HEADER_SIZE + SCHEMA_MAX_SIZE + 1,
+                        file);
+    fclose(file);
+
+    if(size < SCHEMA_HEADER_SIZE ||
+       memcmp(header, SCHEMA_MAGIC, SCHEMA_MAGIC_SIZE) ||
+       header[4] != SCHEMA_FORMAT ||
+       header[5] != v->major || header[6] != v->minor ||
+       header[7] != v->revision ||
+       get_u64(header + 8) != fingerprint)
+        return BSMP_ERR_IO;
+
+    // Truncated or corrupted file
+    size -= SCHEMA_HEADER_SIZE;
+    if(size != (unsigned int)((header[16] << 8) | header[17]) ||
+       schema_hash(SCHEMA_HASH_INIT, image, size) != fingerprint)
+        return BSMP_ERR_IO;
+
+    return schema_decode(client, image, size) ? BSMP_ERR_IO : BSMP_SUCCESS;
+}
+
+// Write the lists to a cache file, if they match the fingerprint. The file is
+// replaced at once, so that a concurrent load never sees half of it.
+static enum bsmp_err schema_save(bsmp_client_t *client, const char *path,
+                                 uint64_t fingerprint)
+{
+    uint8_t *header = client->buf, *image = header + SCHEMA_HEADER_SIZE;
+    struct bsmp_version *v = &client->server_version;
+
+    unsigned int size = schema_encode(client, image);
+
+    // The schema changed during the discovery
+    if(schema_hash(SCHEMA_HASH_INIT, image, size) != fingerprint)
+        return BSMP_ERR_NOT_SUPPORTED;
+
+    memcpy(header, SCHEMA_MAGIC, SCHEMA_MAGIC_SIZE);
+    header[4] = SCHEMA_FORMAT;
+    header[5] = v->major;
+    header[6] = v->minor;
+    header[7] = v->revision;
+    put_u64(header + 8, fingerprint);
+    header[16] = size >> 8;
+    header[17] = size;
+
+    char tmp[strlen(path) + sizeof(".tmp")];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    FILE *file = fopen(tmp, "wb");
+    if(!file)
+        return BSMP_ERR_IO;
+
+    size += SCHEMA_HEADER_SIZE;
+    bool ok = fwrite(header, 1, size, file) == size;
+
+    if(fclose(file) || !ok || rename(tmp, path))
+    {
+        remove(tmp);
+        return BSMP_ERR_IO;
+    }
+
+    return BSMP_SUCCESS;
+}
+
+static enum bsmp_err client_init(bsmp_client_t *client,
+                                 const struct bsmp_transport *transport,
+                                 unsigned int depth, const char *cache)
+{
+    if(!depth)
+        return BSMP_ERR_PARAM_OUT_OF_RANGE;
+
+    client_reset(client, transport, depth);
+
+    if(!cache)
+        return discover(client);
+
+    // One round trip if the cache is up to date
+    uint64_t fingerprint;
+    bool known = !query_schema(client, &fingerprint);
+
+    if(known && !schema_load(client, cache, fingerprint))
+        return BSMP_SUCCESS;
+
+    enum bsmp_err err;
+    if((err = discover(client)))
+        return err;
+
+    // The cache is only an optimization: failing to write it is not an error
+    if(known)
+        schema_save(client, cache, fingerprint);
+
+    return BSMP_SUCCESS;
+}
+
+enum bsmp_err bsmp_client_init (bsmp_client_t *client,
+                                bsmp_comm_func_t send_func,
+                                bsmp_comm_func_t recv_func)
+{
+    return bsmp_client_init_pipelined(client, send_func, recv_func, 1);
+}
+
+enum bsmp_err bsmp_client_init_pipelined (bsmp_client_t *client,
+                                          bsmp_comm_func_t send_func,
+                                          bsmp_comm_func_t recv_func,
+                                          unsigned int depth)
+{
+    if(!client || !send_func || !recv_func)
+        return BSMP_ERR_PARAM_INVALID;
+
+    struct bsmp_transport transport = {
+        .ctx  = client,
+        .send = comm_send,
+        .recv = comm_recv,
+    };
+
+    client->send = send_func;
+    client->recv = recv_func;
+
+    return client_init(client, &transport, depth, NULL);
+}
+
+enum bsmp_err bsmp_client_init_cached (bsmp_client_t *client,
+                                       bsmp_comm_func_t send_func,
+                                       bsmp_comm_func_t recv_func,
+                                       const char *path)
+{
+    if(!client || !send_func || !recv_func || !path)
+        return BSMP_ERR_PARAM_INVALID;
+
+    struct bsmp_transport transport = {
+        .ctx  = client,
+        .send = comm_send,
+        .recv = comm_recv,
+    };
+
+    client->send = send_func;
+    client->recv = recv_func;
+
+    return client_init(client, &transport, 1, path);
+}
+
+enum bsmp_err bsmp_client_init_transport (bsmp_client_t *client,
+                                          const struct bsmp_transport *transport,
+                                          unsigned int depth, const char *cache)
+{
+    if(!client || !transport || !transport->send ||
+       (!transport->recv && !transport->recv_zc))
+        return BSMP_ERR_PARAM_INVALID;
+
+    client->send = NULL;
+    client->recv = NULL;
+
+    return client_init(client, transport, depth, cache);
+}
+
+enum bsmp_err bsmp_client_set_pipeline (bsmp_client_t *client,
+                                        unsigned int depth)
+{
+    if(!client)
+        return BSMP_ERR_PARAM_INVALID;
+
+    if(!depth)
+        return BSMP_ERR_PARAM_OUT_OF_RANGE;
+
+    client->pipeline = depth;
+
+    return BSMP_SUCCESS;
+}
+
+#define BSMP_GET_LIST(name, type)\
+    enum bsmp_err bsmp_get_##name##_list (bsmp_client_t *client, type **list) {\
+        if(!client || !list)\
+            return BSMP_ERR_PARAM_INVALID;\
+        *list = &client->name;\
+        return BSMP_SUCCESS;\
+    }
+
+BSMP_GET_LIST(vars,     struct bsmp_var_info_list)
+BSMP_GET_LIST(groups,   struct bsmp_group_list)
+BSMP_GET_LIST(curves,   struct bsmp_curve_info_list)
+BSMP_GET_LIST(funcs,    struct bsmp_func_info_list)
+
+struct bsmp_version *bsmp_get_version(bsmp_client_t *client)
+{
+    if(client)
+        return &client->server_version;
+    return NULL;
+}
+
+enum bsmp_err bsmp_read_var (bsmp_client_t *client, struct bsmp_var_info *var,
+                             uint8_t *value)
+{
+    if(!client || !var || !value)
+        return BSMP_ERR_PARAM_INVALID;
+
     if(!vars_list_contains(&client->vars, var))
         return BSMP_ERR_PARAM_INVALID;
 
     // Prepare message to be sent
-    struct bsmp_message response, request =
-    {
-        .code = CMD_VAR_READ,
-        .payload = {var->id},
-        .payload_size = 1
+    struct bsmp_message response, request = REQUEST(client, CMD_VAR_READ);
 
-    };
+    request.payload[0] = var->id;
+    request.payload_size = 1;
 
     if(command(client, &request, &response))
         return BSMP_ERR_COMM;
 
-    if(response.code != CMD_VAR_VALUE)
+    if(response.code != CMD_VAR_VALUE || response.payload_size != var->size)
         return BSMP_ERR_COMM;   //TODO: better error?
 
     // Give back answer
-    memcpy(value, response.payload, response.payload_size);
+    memcpy(value, response.payload, var->size);
 
     return BSMP_SUCCESS;
 }
@@ -411,13 +941,12 @@ enum bsmp_err bsmp_write_var (bsmp_client_t *client, struct bsmp_var_info *var,
         return BSMP_ERR_PARAM_INVALID;
 
     // Prepare message to be sent
-    struct bsmp_message request = {
-        .code = CMD_VAR_WRITE,
-        .payload = {var->id},
-        .payload_size = 1 + var->size
-    }, response;
+    struct bsmp_message response, request = REQUEST(client, CMD_VAR_WRITE);
 
-    memcpy(&request.payload[1], value, var->size);
+    request.payload[0] = var->id;
+    request.payload_size = 1;
+    request.tail         = value;
+    request.tail_size    = var->size;
 
     if(command(client, &request, &response))
        return BSMP_ERR_COMM;
@@ -434,59 +963,299 @@ enum bsmp_err bsmp_write_read_vars (bsmp_client_t *client,
                                     struct bsmp_var_info *read_var,
                                     uint8_t *read_value)
 {
-    if(!(client && write_var && write_value && read_var && read_value))
-        return BSMP_ERR_PARAM_INVALID;
+    if(!(client && write_var && write_value && read_var && read_value))
+        return BSMP_ERR_PARAM_INVALID;
+
+    if(!vars_list_contains(&client->vars, write_var) || !write_var->writable)
+        return BSMP_ERR_PARAM_INVALID;
+
+    if(!vars_list_contains(&client->vars, read_var))
+        return BSMP_ERR_PARAM_INVALID;
+
+    // Prepare message to be sent
+    struct bsmp_message response, request = REQUEST(client, CMD_VAR_WRITE_READ);
+
+    request.payload[0] = write_var->id;
+    request.payload[1] = read_var->id;
+    request.payload_size = 2;
+    request.tail         = write_value;
+    request.tail_size    = write_var->size;
+
+    if(command(client, &request, &response))
+       return BSMP_ERR_COMM;
+
+    if(response.code != CMD_VAR_VALUE ||
+       response.payload_size != read_var->size)
+       return BSMP_ERR_COMM;   //TODO: better error?
+
+    memcpy(read_value, response.payload, read_var->size);
+
+    return BSMP_SUCCESS;
+}
+
+// Delta read of a group, merged into its image
+static enum bsmp_err read_group_delta (bsmp_client_t *client,
+                                       struct bsmp_group *grp, uint8_t *values)
+{
+    struct bsmp_group_image *image = &client->images[grp->id];
+
+    struct bsmp_message response, request =
+        REQUEST(client, CMD_GROUP_READ_DELTA);
+
+    request.payload[0] = grp->id;
+    request.payload[1] = image->seq >> 8;
+    request.payload[2] = image->seq;
+    request.payload_size = 1 + DELTA_SEQ_SIZE;
+
+    if(command(client, &request, &response))
+        return BSMP_ERR_COMM;
+
+    if(response.code == CMD_ERR_OP_NOT_SUPPORTED ||
+       response.code == CMD_ERR_INSUFFICIENT_MEMORY)
+        return BSMP_ERR_NOT_SUPPORTED;
+
+    unsigned int bitmap_size = DELTA_BITMAP_SIZE(grp->vars.count);
+
+    if(response.code != CMD_GROUP_DELTA ||
+       response.payload_size < DELTA_SEQ_SIZE + bitmap_size)
+        return BSMP_ERR_COMM;
+
+    // Values of the changed variables come in the order of the group
+    uint8_t *bitmap      = response.payload + DELTA_SEQ_SIZE;
+    uint8_t *payloadp    = bitmap + bitmap_size;
+    uint8_t *payload_end = response.payload + response.payload_size;
+    uint8_t *imagep      = image->values;
+
+    unsigned int i;
+    for(i = 0; i < grp->vars.count; ++i)
+    {
+        uint8_t size = grp->vars.list[i]->size;
+
+        if(bitmap[i/8] & (1 << (i % 8)))
+        {
+            if(payloadp + size > payload_end)
+            {
+                image->seq = 0;     // Image is now unreliable
+                return BSMP_ERR_COMM;
+            }
+
+            memcpy(imagep, payloadp, size);
+            payloadp += size;
+        }
+        imagep += size;
+    }
+
+    // Nothing may follow the values
+    if(payloadp != payload_end)
+    {
+        image->seq = 0;
+        return BSMP_ERR_COMM;
+    }
+
+    image->seq = (response.payload[0] << 8) + response.payload[1];
+
+    memcpy(values, image->values, grp->size);
+
+    return BSMP_SUCCESS;
+}
+
+enum bsmp_err bsmp_read_group (bsmp_client_t *client, struct bsmp_group *grp,
+                               uint8_t *values)
+{
+    if(!client || !grp || !values)
+        return BSMP_ERR_PARAM_INVALID;
+
+    if(!groups_list_contains(&client->groups, grp))
+        return BSMP_ERR_PARAM_INVALID;
+
+    if(client->images[grp->id].values)
+    {
+        enum bsmp_err err = read_group_delta(client, grp, values);
+
+        if(err != BSMP_ERR_NOT_SUPPORTED)
+            return err;
+
+        // Don't insist
+        client->images[grp->id].values = NULL;
+    }
+
+    // Prepare message to be sent
+    struct bsmp_message response, request = REQUEST(client, CMD_GROUP_READ);
+
+    request.payload[0] = grp->id;
+    request.payload_size = 1;
+
+    if(command(client, &request, &response))
+        return BSMP_ERR_COMM;
+
+    if(response.code != CMD_GROUP_VALUES || response.payload_size != grp->size)
+        return BSMP_ERR_COMM;   //TODO: better error?
+
+    // Give back answer
+    memcpy(values, response.payload, grp->size);
+
+    return BSMP_SUCCESS;
+}
+
+enum bsmp_err bsmp_group_delta_enable (bsmp_client_t *client,
+                                       struct bsmp_group *grp, uint8_t *image)
+{
+    if(!client || !grp)
+        return BSMP_ERR_PARAM_INVALID;
+
+    if(!groups_list_contains(&client->groups, grp))
+        return BSMP_ERR_PARAM_INVALID;
+
+    // Sequence number 0 asks for the complete values
+    client->images[grp->id].values = image;
+    client->images[grp->id].seq    = 0;
+
+    return BSMP_SUCCESS;
+}
+
+enum bsmp_err bsmp_read_group_changed (bsmp_client_t *client,
+                                       struct bsmp_group *grp, uint8_t *values,
+                                       uint32_t *generation)
+{
+    if(!client || !grp || !values || !generation)
+        return BSMP_ERR_PARAM_INVALID;
+
+    if(!groups_list_contains(&client->groups, grp))
+        return BSMP_ERR_PARAM_INVALID;
+
+    uint32_t since = *generation;
+    uint32_t current;
+
+    // Prepare message to be sent
+    struct bsmp_message response, request =
+        REQUEST(client, CMD_GROUP_READ_CHANGED);
+
+    request.payload[0] = grp->id;
+    request.payload[1] = since >> 24;
+    request.payload[2] = since >> 16;
+    request.payload[3] = since >> 8;
+    request.payload[4] = since;
+    request.payload_size = 1 + GENERATION_SIZE;
+
+    if(command(client, &request, &response))
+        return BSMP_ERR_COMM;
+
+    if(response.code != CMD_GROUP_CHANGED ||
+       response.payload_size < EPOCH_SIZE + GENERATION_SIZE)
+        return BSMP_ERR_COMM;   //TODO: better error?
+
+    uint32_t epoch = ((uint32_t)response.payload[0] << 24) +
+                     (response.payload[1] << 16) + (response.payload[2] << 8) +
+                      response.payload[3];
+
+    current = ((uint32_t)response.payload[4] << 24) +
+              (response.payload[5] << 16) + (response.payload[6] << 8) +
+               response.payload[7];
+
+    // Another run of the server: its generations mean nothing to us
+    if(since && epoch != client->images[grp->id].epoch)
+    {
+        client->images[grp->id].epoch = epoch;
+        *generation = 0;
+        return bsmp_read_group_changed(client, grp, values, generation);
+    }
+
+    client->images[grp->id].epoch = epoch;
+
+    // Changed variables come in the order of the group
+    uint8_t  *payloadp = response.payload + EPOCH_SIZE + GENERATION_SIZE;
+    uint8_t  *payload_end = response.payload + response.payload_size;
+    uint8_t  *valuesp = values;
+    unsigned int i = 0;
+
+    while(payloadp < payload_end)
+    {
+        uint8_t id = *(payloadp++);
+
+        while(i < grp->vars.count && grp->vars.list[i]->id != id)
+            valuesp += grp->vars.list[i++]->size;
+
+        if(i == grp->vars.count ||
+           payloadp + grp->vars.list[i]->size > payload_end)
+            return BSMP_ERR_COMM;
+
+        memcpy(valuesp, payloadp, grp->vars.list[i]->size);
+        payloadp += grp->vars.list[i]->size;
+        valuesp  += grp->vars.list[i++]->size;
+    }
+
+    *generation = current;
+
+    return BSMP_SUCCESS;
+}
+
+static void prepare(bsmp_client_t *client, struct bsmp_prepared *prepared,
+                    uint8_t code, uint8_t id, uint8_t answer, uint16_t size,
+                    uint8_t *dest)
+{
+    prepared->client     = client;
+    prepared->request[0] = code;
+    prepared->request[1] = 0;
+    prepared->request[2] = 1;
+    prepared->request[3] = id;
+    prepared->answer     = answer;
+    prepared->size       = size;
+    prepared->dest       = dest;
+}
 
-    if(!vars_list_contains(&client->vars, write_var) || !write_var->writable)
+enum bsmp_err bsmp_prepare_read_var (bsmp_client_t *client,
+                                     struct bsmp_prepared *prepared,
+                                     struct bsmp_var_info *var, uint8_t *dest)
+{
+    if(!client || !prepared || !var || !dest)
         return BSMP_ERR_PARAM_INVALID;
 
-    if(!vars_list_contains(&client->vars, read_var))
+    if(!vars_list_contains(&client->vars, var))
         return BSMP_ERR_PARAM_INVALID;
 
-    // Prepare message to be sent
-    struct bsmp_message request = {
-        .code = CMD_VAR_WRITE_READ,
-        .payload = {write_var->id, read_var->id},
-        .payload_size = 2 + write_var->size
-    }, response;
+    prepare(client, prepared, CMD_VAR_READ, var->id, CMD_VAR_VALUE, var->size,
+            dest);
 
-    memcpy(&request.payload[2], write_value, write_var->size);
+    return BSMP_SUCCESS;
+}
 
-    if(command(client, &request, &response))
-       return BSMP_ERR_COMM;
+enum bsmp_err bsmp_prepare_read_group (bsmp_client_t *client,
+                                       struct bsmp_prepared *prepared,
+                                       struct bsmp_group *grp, uint8_t *dest)
+{
+    if(!client || !prepared || !grp || !dest)
+        return BSMP_ERR_PARAM_INVALID;
 
-    if(response.code != CMD_VAR_VALUE)
-       return BSMP_ERR_COMM;   //TODO: better error?
+    if(!groups_list_contains(&client->groups, grp))
+        return BSMP_ERR_PARAM_INVALID;
 
-    memcpy(read_value, response.payload, read_var->size);
+    prepare(client, prepared, CMD_GROUP_READ, grp->id, CMD_GROUP_VALUES,
+            grp->size, dest);
 
     return BSMP_SUCCESS;
 }
 
-enum bsmp_err bsmp_read_group (bsmp_client_t *client, struct bsmp_group *grp,
-                               uint8_t *values)
+enum bsmp_err bsmp_prepared_exec (struct bsmp_prepared *prepared)
 {
-    if(!client || !grp || !values)
+    if(!prepared)
         return BSMP_ERR_PARAM_INVALID;
 
-    if(!groups_list_contains(&client->groups, grp))
-        return BSMP_ERR_PARAM_INVALID;
+    bsmp_client_t *client = prepared->client;
 
-    // Prepare message to be sent
-    struct bsmp_message response, request = {
-        .code = CMD_GROUP_READ,
-        .payload = {grp->id},
-        .payload_size = 1
-    };
+    struct bsmp_transport *t = &client->transport;
 
-    if(command(client, &request, &response))
+    if(t->send(t->ctx, prepared->request, sizeof(prepared->request)))
         return BSMP_ERR_COMM;
 
-    if(response.code != CMD_GROUP_VALUES)
-        return BSMP_ERR_COMM;   //TODO: better error?
+    struct bsmp_message response;
+    if(recv_response(client, &response))
+        return BSMP_ERR_COMM;
 
-    // Give back answer
-    memcpy(values, response.payload, response.payload_size);
+    if(response.code != prepared->answer ||
+       response.payload_size != prepared->size)
+        return BSMP_ERR_COMM;
+
+    memcpy(prepared->dest, response.payload, prepared->size);
 
     return BSMP_SUCCESS;
 }
@@ -504,13 +1273,12 @@ enum bsmp_err bsmp_write_group (bsmp_client_t *client, struct bsmp_group *grp,
         return BSMP_ERR_PARAM_INVALID;
 
     // Prepare message to be sent
-    struct bsmp_message response, request = {
-        .code = CMD_GROUP_WRITE,
-        .payload = {grp->id},
-        .payload_size = 1 + grp->size
-    };
+    struct bsmp_message response, request = REQUEST(client, CMD_GROUP_WRITE);
 
-    memcpy(&request.payload[1], values, grp->size);
+    request.payload[0] = grp->id;
+    request.payload_size = 1;
+    request.tail         = values;
+    request.tail_size    = grp->size;
 
     if(command(client, &request, &response))
        return BSMP_ERR_COMM;
@@ -537,11 +1305,11 @@ enum bsmp_err bsmp_bin_op_var (bsmp_client_t *client, enum bsmp_bin_op op,
         return BSMP_ERR_PARAM_OUT_OF_RANGE;
 
     // Prepare message to be sent
-    struct bsmp_message response, request = {
-        .code = CMD_VAR_BIN_OP,
-        .payload = {var->id, bin_op_code[op]},
-        .payload_size = 2 + var->size
-    };
+    struct bsmp_message response, request = REQUEST(client, CMD_VAR_BIN_OP);
+
+    request.payload[0] = var->id;
+    request.payload[1] = bin_op_code[op];
+    request.payload_size = 2 + var->size;
 
     memcpy(&request.payload[2], mask, var->size);
 
@@ -570,11 +1338,11 @@ enum bsmp_err bsmp_bin_op_group (bsmp_client_t *client, enum bsmp_bin_op op,
         return BSMP_ERR_PARAM_OUT_OF_RANGE;
 
     // Prepare message to be sent
-    struct bsmp_message response, request = {
-        .code = CMD_GROUP_BIN_OP,
-        .payload = {grp->id, bin_op_code[op]},
-        .payload_size = 2 + grp->size
-    };
+    struct bsmp_message response, request = REQUEST(client, CMD_GROUP_BIN_OP);
+
+    request.payload[0] = grp->id;
+    request.payload[1] = bin_op_code[op];
+    request.payload_size = 2 + grp->size;
 
     memcpy(&request.payload[2], mask, grp->size);
 
@@ -587,6 +1355,49 @@ enum bsmp_err bsmp_bin_op_group (bsmp_client_t *client, enum bsmp_bin_op op,
     return BSMP_SUCCESS;
 }
 
+enum bsmp_err bsmp_bin_op_group_bcast (bsmp_client_t *client,
+                                       enum bsmp_bin_op op,
+                                       struct bsmp_group *grp, uint8_t *mask)
+{
+    if(!client || !grp || !mask)
+        return BSMP_ERR_PARAM_INVALID;
+
+    if(!groups_list_contains(&client->groups, grp))
+        return BSMP_ERR_PARAM_INVALID;
+
+    if(!grp->writable || !grp->vars.count)
+        return BSMP_ERR_PARAM_INVALID;
+
+    if(op >= BIN_OP_COUNT)
+        return BSMP_ERR_PARAM_OUT_OF_RANGE;
+
+    // The same mask goes to every variable: they must have the same size
+    uint8_t mask_size = grp->vars.list[0]->size;
+
+    unsigned int i;
+    for(i = 1; i < grp->vars.count; ++i)
+        if(grp->vars.list[i]->size != mask_size)
+            return BSMP_ERR_PARAM_INVALID;
+
+    // Prepare message to be sent
+    struct bsmp_message response, request =
+        REQUEST(client, CMD_GROUP_BIN_OP_BCAST);
+
+    request.payload[0] = grp->id;
+    request.payload[1] = bin_op_code[op];
+    request.payload_size = 2 + mask_size;
+
+    memcpy(&request.payload[2], mask, mask_size);
+
+    if(command(client, &request, &response))
+       return BSMP_ERR_COMM;
+
+    if(response.code != CMD_OK)
+       return BSMP_ERR_COMM;   //TODO: better error?
+
+    return BSMP_SUCCESS;
+}
+
 enum bsmp_err bsmp_create_group (bsmp_client_t *client,
                                  struct bsmp_var_info **list)
 {
@@ -594,10 +1405,7 @@ enum bsmp_err bsmp_create_group (bsmp_client_t *client,
         return BSMP_ERR_PARAM_INVALID;
 
     // Prepare message to be sent
-    struct bsmp_message request = {
-        .code = CMD_GROUP_CREATE,
-        .payload_size = 0
-    }, response;
+    struct bsmp_message response, request = REQUEST(client, CMD_GROUP_CREATE);
 
     while(*list)
     {
@@ -626,10 +1434,8 @@ enum bsmp_err bsmp_remove_all_groups (bsmp_client_t *client)
     if(!client)
         return BSMP_ERR_PARAM_INVALID;
 
-    struct bsmp_message response, request = {
-        .code = CMD_GROUP_REMOVE_ALL,
-        .payload_size = 0
-    };
+    struct bsmp_message response, request =
+        REQUEST(client, CMD_GROUP_REMOVE_ALL);
 
     if(command(client, &request, &response) || response.code != CMD_OK)
         return BSMP_ERR_COMM;
@@ -639,6 +1445,90 @@ enum bsmp_err bsmp_remove_all_groups (bsmp_client_t *client)
     return BSMP_SUCCESS;
 }
 
+enum bsmp_err bsmp_latch_group (bsmp_client_t *client, struct bsmp_group *grp)
+{
+    if(!client)
+        return BSMP_ERR_PARAM_INVALID;
+
+    if(grp && !groups_list_contains(&client->groups, grp))
+        return BSMP_ERR_PARAM_INVALID;
+
+    struct bsmp_message response, request = REQUEST(client, CMD_GROUP_LATCH);
+
+    if(grp)
+    {
+        request.payload[0] = grp->id;
+        request.payload_size = 1;
+    }
+
+    if(command(client, &request, &response))
+        return BSMP_ERR_COMM;
+
+    if(response.code == CMD_ERR_OP_NOT_SUPPORTED ||
+       response.code == CMD_ERR_INSUFFICIENT_MEMORY)
+        return BSMP_ERR_NOT_SUPPORTED;
+
+    if(response.code != CMD_OK)
+        return BSMP_ERR_COMM;
+
+    return BSMP_SUCCESS;
+}
+
+enum bsmp_err curve_block_decode(struct bsmp_curve_info *curve,
+                                 struct bsmp_message *response,
+                                 uint8_t *data, uint16_t *len)
+{
+    if((response->code != CMD_CURVE_BLOCK &&
+        response->code != CMD_CURVE_BLOCK_LZ) ||
+       response->payload_size < BSMP_CURVE_BLOCK_INFO)
+        return BSMP_ERR_COMM;
+
+    uint8_t  *block = response->payload + BSMP_CURVE_BLOCK_INFO;
+    uint16_t size   = response->payload_size - BSMP_CURVE_BLOCK_INFO;
+
+    if(response->code == CMD_CURVE_BLOCK)
+    {
+        if(size > curve->block_size)
+            return BSMP_ERR_COMM;
+
+        memcpy(data, block, size);
+        *len = size;
+    }
+    else if(!lz_decompress(block, size, data, curve->block_size, len))
+        return BSMP_ERR_COMM;
+
+    return BSMP_SUCCESS;
+}
+
+void curve_block_encode(struct bsmp_curve_info *curve, uint16_t offset,
+                        uint8_t *data, uint16_t len, bool compress,
+                        struct bsmp_message *request)
+{
+    uint8_t *block = request->payload + BSMP_CURVE_BLOCK_INFO;
+    uint16_t lz_len = 0;
+
+    request->payload[0] = curve->id;
+    request->payload[1] = offset >> 8;
+    request->payload[2] = offset;
+
+    // Only worth it if it gets smaller
+    if(compress && len > 1)
+        lz_len = lz_compress(data, len, block, len - 1);
+
+    if(lz_len)
+    {
+        request->code         = CMD_CURVE_BLOCK_LZ;
+        request->payload_size = BSMP_CURVE_BLOCK_INFO + lz_len;
+    }
+    else
+    {
+        request->code         = CMD_CURVE_BLOCK;
+        request->payload_size = BSMP_CURVE_BLOCK_INFO;
+        request->tail         = data;
+        request->tail_size    = len;
+    }
+}
+
 enum bsmp_err bsmp_request_curve_block (bsmp_client_t *client,
                                         struct bsmp_curve_info *curve,
                                         uint16_t offset, uint8_t *data,
@@ -653,17 +1543,159 @@ enum bsmp_err bsmp_request_curve_block (bsmp_client_t *client,
     if(offset > curve->nblocks)
         return BSMP_ERR_PARAM_OUT_OF_RANGE;
 
-    struct bsmp_message response, request = {
-        .code = CMD_CURVE_BLOCK_REQUEST,
-        .payload = {curve->id, offset >> 8, offset},
-        .payload_size = BSMP_CURVE_BLOCK_INFO
-    };
+    struct bsmp_message response, request =
+        REQUEST(client, CMD_CURVE_BLOCK_REQUEST);
+
+    request.payload[0] = curve->id;
+    request.payload[1] = offset >> 8;
+    request.payload[2] = offset;
+    request.payload_size = BSMP_CURVE_BLOCK_INFO;
 
     if(command(client, &request, &response) || response.code !=CMD_CURVE_BLOCK)
         return BSMP_ERR_COMM;
 
-    *len = response.payload_size - BSMP_CURVE_BLOCK_INFO;
-    memcpy(data, response.payload + BSMP_CURVE_BLOCK_INFO, *len);
+    return curve_block_decode(curve, &response, data, len);
+}
+
+enum bsmp_err bsmp_request_curve_block_lz (bsmp_client_t *client,
+                                           struct bsmp_curve_info *curve,
+                                           uint16_t offset, uint8_t *data,
+                                           uint16_t *len)
+{
+    if(!client || !curve || !data || !len)
+        return BSMP_ERR_PARAM_INVALID;
+
+    if(!curves_list_contains(&client->curves, curve))
+        return BSMP_ERR_PARAM_INVALID;
+
+    if(offset >= curve->nblocks)
+        return BSMP_ERR_PARAM_OUT_OF_RANGE;
+
+    if(!client->curve_lz)
+        return bsmp_request_curve_block(client, curve, offset, data, len);
+
+    struct bsmp_message response, request =
+        REQUEST(client, CMD_CURVE_BLOCK_REQUEST_LZ);
+
+    request.payload[0] = curve->id;
+    request.payload[1] = offset >> 8;
+    request.payload[2] = offset;
+    request.payload_size = BSMP_CURVE_BLOCK_INFO;
+
+    if(command(client, &request, &response))
+        return BSMP_ERR_COMM;
+
+    if(response.code == CMD_ERR_OP_NOT_SUPPORTED)
+    {
+        client->curve_lz = false;
+        return bsmp_request_curve_block(client, curve, offset, data, len);
+    }
+
+    return curve_block_decode(curve, &response, data, len);
+}
+
+// Transfer of the blocks of a curve, from the first one on
+struct curve_transfer
+{
+    struct bsmp_curve_info  *curve;
+    uint8_t                 *data;
+    uint32_t                len;
+    unsigned int            first;
+    bool                    last;       // A short block was read
+    bool                    compress;   // Blocks written may go compressed
+};
+
+static enum bsmp_err curve_read_encode(bsmp_client_t *client,
+                                       struct pipeline *p, unsigned int i,
+                                       struct bsmp_message *request)
+{
+    struct curve_transfer *t = p->ctx;
+    uint16_t offset = t->first + i;
+
+    request->code = client->curve_lz ? CMD_CURVE_BLOCK_REQUEST_LZ
+                                     : CMD_CURVE_BLOCK_REQUEST;
+    request->payload[0]   = t->curve->id;
+    request->payload[1]   = offset >> 8;
+    request->payload[2]   = offset;
+    request->payload_size = BSMP_CURVE_BLOCK_INFO;
+
+    return BSMP_SUCCESS;
+}
+
+static enum bsmp_err curve_read_decode(bsmp_client_t *client,
+                                       struct pipeline *p, unsigned int i,
+                                       struct bsmp_message *response)
+{
+    (void) client;
+
+    struct curve_transfer *t = p->ctx;
+    uint32_t block_size = t->curve->block_size;
+    uint16_t blklen;
+    enum bsmp_err err;
+
+    if((err = curve_block_decode(t->curve, response,
+                                 t->data + (t->first + i)*block_size, &blklen)))
+        return err;
+
+    t->len += blklen;
+
+    // A short block is the last one
+    if(blklen < block_size)
+    {
+        t->last  = true;
+        p->count = i + 1;
+    }
+
+    return BSMP_SUCCESS;
+}
+
+enum bsmp_err curve_read_blocks (bsmp_client_t *client,
+                                 struct bsmp_curve_info *curve,
+                                 unsigned int first, unsigned int count,
+                                 uint8_t *data, uint32_t *len, bool *last)
+{
+    enum bsmp_err err;          // Error code
+    uint16_t      blklen;       // Length of the first block
+
+    *len  = 0;
+    *last = false;
+
+    if(!count)
+        return BSMP_SUCCESS;
+
+    // The first block also finds out whether the server compresses blocks
+    if((err = bsmp_request_curve_block_lz(client, curve, first,
+                                          data + first*curve->block_size,
+                                          &blklen)))
+        return err;
+
+    if(blklen < curve->block_size)
+    {
+        *len  = blklen;
+        *last = true;
+        return BSMP_SUCCESS;
+    }
+
+    // Then the rest of them, pipelined
+    struct curve_transfer t = {
+        .curve = curve,
+        .data  = data,
+        .len   = blklen,
+        .first = first + 1
+    };
+
+    struct pipeline p = {
+        .count  = count - 1,
+        .encode = curve_read_encode,
+        .decode = curve_read_decode,
+        .ctx    = &t
+    };
+
+    if((err = pipeline_run(client, &p)))
+        return err;
+
+    *len  = t.len;
+    *last = t.last;
 
     return BSMP_SUCCESS;
 }
@@ -678,28 +1710,30 @@ enum bsmp_err bsmp_read_curve (bsmp_client_t *cli, struct bsmp_curve_info *cur,
     if(!curves_list_contains(&cli->curves, cur))
         return BSMP_ERR_PARAM_INVALID;
 
-    enum bsmp_err err;          // Error code
-    uint16_t      blk;          // Current block offset
-    uint8_t       *bufp = buf;  // Pointer to the current region of the buffer
-    uint16_t      blklen;       // Length of the last returned block
+    bool last;
+    enum bsmp_err err = curve_read_blocks(cli, cur, 0, cur->nblocks, buf, len,
+                                          &last);
+    if(err)
+        *len = 0;
 
-    // Iterate over blocks
-    *len = 0;
-    for(blk = 0; blk < cur->nblocks; ++blk)
-    {
-        if((err = bsmp_request_curve_block(cli, cur, blk, bufp, &blklen)))
-        {
-            *len = 0;
-            return err;
-        }
+    return err;
+}
+
+enum bsmp_err read_curve_csum (bsmp_client_t *client,
+                               struct bsmp_curve_info *curve, uint8_t *csum)
+{
+    struct bsmp_message response, request =
+        REQUEST(client, CMD_CURVE_QUERY_CSUM);
 
-        *len += blklen;
+    request.payload[0] = curve->id;
+    request.payload_size = 1;
 
-        if(blklen < cur->block_size)
-            break;
+    if(command(client, &request, &response) ||
+       response.code != CMD_CURVE_CSUM ||
+       response.payload_size != BSMP_CURVE_CSUM_SIZE)
+        return BSMP_ERR_COMM;
 
-        bufp += cur->block_size;
-    }
+    memcpy(csum, response.payload, BSMP_CURVE_CSUM_SIZE);
 
     return BSMP_SUCCESS;
 }
@@ -724,13 +1758,9 @@ enum bsmp_err bsmp_send_curve_block (bsmp_client_t *client,
     if(len > curve->block_size)
         return BSMP_ERR_PARAM_OUT_OF_RANGE;
 
-    struct bsmp_message response, request = {
-        .code = CMD_CURVE_BLOCK,
-        .payload = {curve->id, offset >> 8, offset},
-        .payload_size = len + BSMP_CURVE_BLOCK_INFO,
-    };
+    struct bsmp_message response, request = REQUEST(client, CMD_CURVE_BLOCK);
 
-    memcpy(request.payload + BSMP_CURVE_BLOCK_INFO, data, len);
+    curve_block_encode(curve, offset, data, len, false, &request);
 
     if(command(client, &request, &response) || response.code != CMD_OK)
         return BSMP_ERR_COMM;
@@ -738,6 +1768,86 @@ enum bsmp_err bsmp_send_curve_block (bsmp_client_t *client,
     return BSMP_SUCCESS;
 }
 
+// Send a block, compressed if the server takes it. Tells whether it was sent
+// compressed, which finds out if the server takes compressed blocks.
+static enum bsmp_err curve_block_send_lz(bsmp_client_t *client,
+                                         struct bsmp_curve_info *curve,
+                                         uint16_t offset, uint8_t *data,
+                                         uint16_t len, bool *compressed)
+{
+    struct bsmp_message response, request = REQUEST(client, CMD_CURVE_BLOCK);
+
+    curve_block_encode(curve, offset, data, len, client->curve_lz, &request);
+
+    *compressed = request.code == CMD_CURVE_BLOCK_LZ;
+
+    if(command(client, &request, &response))
+        return BSMP_ERR_COMM;
+
+    if(*compressed && response.code == CMD_ERR_OP_NOT_SUPPORTED)
+    {
+        client->curve_lz = false;
+        return bsmp_send_curve_block(client, curve, offset, data, len);
+    }
+
+    if(response.code != CMD_OK)
+        return BSMP_ERR_COMM;
+
+    return BSMP_SUCCESS;
+}
+
+enum bsmp_err bsmp_send_curve_block_lz (bsmp_client_t *client,
+                                        struct bsmp_curve_info *curve,
+                                        uint16_t offset, uint8_t *data,
+                                        uint16_t len)
+{
+    if(!client || !curve || !data)
+        return BSMP_ERR_PARAM_INVALID;
+
+    if(!curves_list_contains(&client->curves, curve))
+        return BSMP_ERR_PARAM_INVALID;
+
+    if(!curve->writable)
+        return BSMP_ERR_PARAM_INVALID;
+
+    if(offset >= curve->nblocks)
+        return BSMP_ERR_PARAM_OUT_OF_RANGE;
+
+    if(len > curve->block_size)
+        return BSMP_ERR_PARAM_OUT_OF_RANGE;
+
+    bool compressed;
+
+    return curve_block_send_lz(client, curve, offset, data, len, &compressed);
+}
+
+static enum bsmp_err curve_write_encode(bsmp_client_t *client,
+                                        struct pipeline *p, unsigned int i,
+                                        struct bsmp_message *request)
+{
+    (void) client;
+
+    struct curve_transfer *t = p->ctx;
+    uint32_t block_size = t->curve->block_size;
+    uint32_t start      = (t->first + i)*block_size;
+    uint32_t blklen     = t->len - start < block_size ? t->len - start
+                                                      : block_size;
+
+    curve_block_encode(t->curve, t->first + i, t->data + start, blklen,
+                       t->compress, request);
+
+    return BSMP_SUCCESS;
+}
+
+static enum bsmp_err curve_write_decode(bsmp_client_t *client,
+                                        struct pipeline *p, unsigned int i,
+                                        struct bsmp_message *response)
+{
+    (void) client; (void) p; (void) i;
+
+    return response->code == CMD_OK ? BSMP_SUCCESS : BSMP_ERR_COMM;
+}
+
 enum bsmp_err bsmp_write_curve (bsmp_client_t *cli, struct bsmp_curve_info *cur,
                                 uint8_t *buf, uint32_t len)
 {
@@ -749,24 +1859,47 @@ enum bsmp_err bsmp_write_curve (bsmp_client_t *cli, struct bsmp_curve_info *cur,
         return BSMP_ERR_PARAM_INVALID;
 
     enum bsmp_err err;          // Error code
-    uint16_t      blk;          // Current block offset
-    uint8_t       *bufp = buf;  // Pointer to the current region of the buffer
-    uint16_t      blklen;       // Length of the current block
+    uint32_t      nblocks;      // Number of blocks to be written
 
-    // Iterate over blocks
-    for(blk = 0; blk < cur->nblocks; ++blk)
+    // Don't write past the end of the data nor of the curve
+    nblocks = (len + cur->block_size - 1)/cur->block_size;
+
+    if(nblocks > cur->nblocks)
     {
-        blklen = len < cur->block_size ? len : cur->block_size;
+        nblocks = cur->nblocks;
+        len     = nblocks*cur->block_size;
+    }
 
-        if((err = bsmp_send_curve_block(cli, cur, blk, bufp, blklen)))
-            return err;
+    if(!nblocks)
+        return BSMP_SUCCESS;
 
-        len -= blklen;
+    // The first block also finds out whether the server takes compressed
+    // blocks, unless it didn't compress. The rest then go uncompressed, as a
+    // server that doesn't take them would refuse them all.
+    bool compressed;
 
-        bufp += blklen;
-    }
+    if((err = curve_block_send_lz(cli, cur, 0, buf,
+                                  len < cur->block_size ? len : cur->block_size,
+                                  &compressed)))
+        return err;
 
-    return BSMP_SUCCESS;
+    // Then the rest of them, pipelined
+    struct curve_transfer t = {
+        .curve    = cur,
+        .data     = buf,
+        .len      = len,
+        .first    = 1,
+        .compress = compressed && cli->curve_lz
+    };
+
+    struct pipeline p = {
+        .count  = nblocks - 1,
+        .encode = curve_write_encode,
+        .decode = curve_write_decode,
+        .ctx    = &t
+    };
+
+    return pipeline_run(cli, &p);
 }
 
 enum bsmp_err bsmp_recalc_checksum (bsmp_client_t *client,
@@ -778,11 +1911,11 @@ enum bsmp_err bsmp_recalc_checksum (bsmp_client_t *client,
     if(!curves_list_contains(&client->curves, curve))
         return BSMP_ERR_PARAM_INVALID;
 
-    struct bsmp_message response, request = {
-        .code = CMD_CURVE_RECALC_CSUM,
-        .payload = {curve->id},
-        .payload_size = 1
-    };
+    struct bsmp_message response, request =
+        REQUEST(client, CMD_CURVE_RECALC_CSUM);
+
+    request.payload[0] = curve->id;
+    request.payload_size = 1;
 
     if(command(client, &request, &response))
         return BSMP_ERR_COMM;
@@ -811,11 +1944,10 @@ enum bsmp_err bsmp_func_execute (bsmp_client_t *client,
     if(func->output_size && !output)
         return BSMP_ERR_PARAM_INVALID;
 
-    struct bsmp_message response, request = {
-        .code = CMD_FUNC_EXECUTE,
-        .payload = {func->id},
-        .payload_size = 1 + func->input_size
-    };
+    struct bsmp_message response, request = REQUEST(client, CMD_FUNC_EXECUTE);
+
+    request.payload[0] = func->id;
+    request.payload_size = 1 + func->input_size;
 
     if(func->input_size)
         memcpy(&request.payload[1], input, func->input_size);
@@ -823,14 +1955,15 @@ enum bsmp_err bsmp_func_execute (bsmp_client_t *client,
     if(command(client, &request, &response))
         return BSMP_ERR_COMM;
 
-    if(response.code == CMD_FUNC_RETURN)
+    if(response.code == CMD_FUNC_RETURN &&
+       response.payload_size == func->output_size)
     {
         *error = 0;
         if(func->output_size)
             memcpy(output, response.payload, func->output_size);
         return BSMP_SUCCESS;
     }
-    else if(response.code == CMD_FUNC_ERROR)
+    else if(response.code == CMD_FUNC_ERROR && response.payload_size == 1)
     {
         *error = response.payload[0];
         return BSMP_SUCCESS;
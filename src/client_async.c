@@ -0,0 +1,472 @@
+#include "bsmp_priv.h"
+#include "client_priv.h"
+#include "../include/client_async.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define PENDING(async, i)   (&(async)->pending[((async)->head + (i)) % \
+                                               BSMP_ASYNC_MAX_PENDING])
+
+// Wrap around safe comparison of times
+#define EXPIRED(now, deadline)  ((int32_t)((now) - (deadline)) >= 0)
+
+/* Decoders */
+
+static enum bsmp_err decode_ok (struct bsmp_async_pending *pending,
+                                uint8_t code, uint8_t *payload, uint16_t size)
+{
+    (void) pending; (void) payload; (void) size;
+
+    return code == CMD_OK ? BSMP_SUCCESS : BSMP_ERR_COMM;
+}
+
+static enum bsmp_err decode_var (struct bsmp_async_pending *pending,
+                                 uint8_t code, uint8_t *payload, uint16_t size)
+{
+    struct bsmp_var_info *var = pending->info;
+
+    if(code != CMD_VAR_VALUE || size != var->size)
+        return BSMP_ERR_COMM;
+
+    memcpy(pending->data, payload, size);
+    return BSMP_SUCCESS;
+}
+
+static enum bsmp_err decode_group (struct bsmp_async_pending *pending,
+                                   uint8_t code, uint8_t *payload,
+                                   uint16_t size)
+{
+    struct bsmp_group *grp = pending->info;
+
+    if(code != CMD_GROUP_VALUES || size != grp->size)
+        return BSMP_ERR_COMM;
+
+    memcpy(pending->data, payload, size);
+    return BSMP_SUCCESS;
+}
+
+static enum bsmp_err decode_curve_block (struct bsmp_async_pending *pending,
+                                         uint8_t code, uint8_t *payload,
+                                         uint16_t size)
+{
+    struct bsmp_message response = {
+        .code = code,
+        .payload_size = size,
+        .payload = payload
+    };
+
+    return curve_block_decode(pending->info, &response, pending->data,
+                              pending->len);
+}
+
+static enum bsmp_err decode_func (struct bsmp_async_pending *pending,
+                                  uint8_t code, uint8_t *payload, uint16_t size)
+{
+    struct bsmp_func_info *func = pending->info;
+
+    if(code == CMD_FUNC_RETURN && size == func->output_size)
+    {
+        *pending->error = 0;
+        if(size)
+            memcpy(pending->data, payload, size);
+        return BSMP_SUCCESS;
+    }
+    else if(code == CMD_FUNC_ERROR && size == 1)
+    {
+        *pending->error = payload[0];
+        return BSMP_SUCCESS;
+    }
+
+    return BSMP_ERR_COMM;
+}
+
+/* Queue */
+
+// Take the oldest request out of the queue. Its callback may submit new
+// requests.
+static void complete (bsmp_async_t *async, enum bsmp_err err)
+{
+    struct bsmp_async_pending done = *PENDING(async, 0);
+
+    async->head = (async->head + 1) % BSMP_ASYNC_MAX_PENDING;
+    --async->count;
+
+    if(done.cb)
+        done.cb(async, err, done.user);
+}
+
+static void fail_all (bsmp_async_t *async, enum bsmp_err err)
+{
+    unsigned int count = async->count;
+
+    // Callbacks may submit more requests: those are not failed
+    while(count--)
+        complete(async, err);
+
+    async->rx_len = 0;
+}
+
+// Send a request built with REQUEST and queue it
+static enum bsmp_err submit (bsmp_async_t *async, struct bsmp_message *request,
+                             struct bsmp_async_pending *pending)
+{
+    if(async->resync)
+        return BSMP_ERR_TIMEOUT;
+
+    if(async->count == BSMP_ASYNC_MAX_PENDING)
+        return BSMP_ERR_OUT_OF_MEMORY;
+
+    uint8_t *buf = async->client->buf;
+
+    request_flatten(request);
+
+    buf[0] = request->code;
+    buf[1] = request->payload_size >> 8;
+    buf[2] = request->payload_size;
+
+    if(async->send(async->ctx, buf, BSMP_HEADER_SIZE + request->payload_size))
+        return BSMP_ERR_COMM;
+
+    pending->deadline = async->now + async->timeout;
+
+    *PENDING(async, async->count++) = *pending;
+
+    return BSMP_SUCCESS;
+}
+
+enum bsmp_err bsmp_async_init (bsmp_async_t *async, bsmp_client_t *client,
+                               void *ctx, bsmp_async_send_t send,
+                               bsmp_async_read_t read, uint32_t timeout)
+{
+    if(!async || !client || !send || !read)
+        return BSMP_ERR_PARAM_INVALID;
+
+    async->client  = client;
+    async->ctx     = ctx;
+    async->send    = send;
+    async->read    = read;
+    async->timeout = timeout;
+    async->now     = 0;
+    async->head    = 0;
+    async->count   = 0;
+    async->rx_len  = 0;
+    async->resync  = false;
+
+    return BSMP_SUCCESS;
+}
+
+enum bsmp_err bsmp_async_readable (bsmp_async_t *async)
+{
+    if(!async)
+        return BSMP_ERR_PARAM_INVALID;
+
+    // Late responses, whose boundaries can't be trusted: drop whatever comes
+    while(async->resync)
+    {
+        int n = async->read(async->ctx, async->rx, sizeof(async->rx));
+
+        if(n < 0)
+            return BSMP_ERR_COMM;
+
+        if(!n)
+            return BSMP_SUCCESS;
+
+        async->quiet = async->now + async->timeout;
+    }
+
+    for(;;)
+    {
+        // Read the header first, then exactly the rest of the message
+        uint32_t want = BSMP_HEADER_SIZE;
+
+        if(async->rx_len >= BSMP_HEADER_SIZE)
+            want += (async->rx[1] << 8) + async->rx[2];
+
+        if(async->rx_len < want)
+        {
+            int n = async->read(async->ctx, async->rx + async->rx_len,
+                                want - async->rx_len);
+
+            if(n < 0)
+            {
+                fail_all(async, BSMP_ERR_COMM);
+                return BSMP_ERR_COMM;
+            }
+
+            if(!n)
+                return BSMP_SUCCESS;
+
+            async->rx_len += n;
+            continue;
+        }
+
+        async->rx_len = 0;
+
+        // Nobody asked for it
+        if(!async->count)
+            continue;
+
+        struct bsmp_async_pending *pending = PENDING(async, 0);
+
+        complete(async, pending->decode(pending, async->rx[0],
+                                        async->rx + BSMP_HEADER_SIZE,
+                                        want - BSMP_HEADER_SIZE));
+    }
+}
+
+enum bsmp_err bsmp_async_tick (bsmp_async_t *async, uint32_t now)
+{
+    if(!async)
+        return BSMP_ERR_PARAM_INVALID;
+
+    async->now = now;
+
+    // Nothing arrived for a whole timeout: the next data is a new response
+    if(async->resync && EXPIRED(now, async->quiet))
+        async->resync = false;
+
+    unsigned int i;
+    for(i = 0; i < async->count; ++i)
+    {
+        if(!EXPIRED(now, PENDING(async, i)->deadline))
+            continue;
+
+        // Its response may still come, and be taken for the response to the
+        // next request: give up on every request and drop what comes next
+        async->resync = true;
+        async->quiet  = now + async->timeout;
+        fail_all(async, BSMP_ERR_TIMEOUT);
+        break;
+    }
+
+    return BSMP_SUCCESS;
+}
+
+unsigned int bsmp_async_pending (bsmp_async_t *async)
+{
+    return async ? async->count : 0;
+}
+
+/* Requests */
+
+enum bsmp_err bsmp_async_read_var (bsmp_async_t *async,
+                                   struct bsmp_var_info *var, uint8_t *value,
+                                   bsmp_async_cb_t cb, void *user)
+{
+    if(!async || !var || !value)
+        return BSMP_ERR_PARAM_INVALID;
+
+    if(!vars_list_contains(&async->client->vars, var))
+        return BSMP_ERR_PARAM_INVALID;
+
+    struct bsmp_message request = REQUEST(async->client, CMD_VAR_READ);
+
+    request.payload[0] = var->id;
+    request.payload_size = 1;
+
+    struct bsmp_async_pending pending = {
+        .decode = decode_var,
+        .cb     = cb,
+        .user   = user,
+        .info   = var,
+        .data   = value
+    };
+
+    return submit(async, &request, &pending);
+}
+
+enum bsmp_err bsmp_async_write_var (bsmp_async_t *async,
+                                    struct bsmp_var_info *var, uint8_t *value,
+                                    bsmp_async_cb_t cb, void *user)
+{
+    if(!async || !var || !value)
+        return BSMP_ERR_PARAM_INVALID;
+
+    if(!vars_list_contains(&async->client->vars, var))
+        return BSMP_ERR_PARAM_INVALID;
+
+    if(!var->writable)
+        return BSMP_ERR_PARAM_INVALID;
+
+    struct bsmp_message request = REQUEST(async->client, CMD_VAR_WRITE);
+
+    request.payload[0] = var->id;
+    request.payload_size = 1 + var->size;
+
+    memcpy(&request.payload[1], value, var->size);
+
+    struct bsmp_async_pending pending = {
+        .decode = decode_ok,
+        .cb     = cb,
+        .user   = user,
+        .info   = var
+    };
+
+    return submit(async, &request, &pending);
+}
+
+enum bsmp_err bsmp_async_read_group (bsmp_async_t *async,
+                                     struct bsmp_group *grp, uint8_t *values,
+                                     bsmp_async_cb_t cb, void *user)
+{
+    if(!async || !grp || !values)
+        return BSMP_ERR_PARAM_INVALID;
+
+    if(!groups_list_contains(&async->client->groups, grp))
+        return BSMP_ERR_PARAM_INVALID;
+
+    struct bsmp_message request = REQUEST(async->client, CMD_GROUP_READ);
+
+    request.payload[0] = grp->id;
+    request.payload_size = 1;
+
+    struct bsmp_async_pending pending = {
+        .decode = decode_group,
+        .cb     = cb,
+        .user   = user,
+        .info   = grp,
+        .data   = values
+    };
+
+    return submit(async, &request, &pending);
+}
+
+enum bsmp_err bsmp_async_write_group (bsmp_async_t *async,
+                                      struct bsmp_group *grp, uint8_t *values,
+                                      bsmp_async_cb_t cb, void *user)
+{
+    if(!async || !grp || !values)
+        return BSMP_ERR_PARAM_INVALID;
+
+    if(!groups_list_contains(&async->client->groups, grp))
+        return BSMP_ERR_PARAM_INVALID;
+
+    if(!grp->writable)
+        return BSMP_ERR_PARAM_INVALID;
+
+    struct bsmp_message request = REQUEST(async->client, CMD_GROUP_WRITE);
+
+    request.payload[0] = grp->id;
+    request.payload_size = 1 + grp->size;
+
+    memcpy(&request.payload[1], values, grp->size);
+
+    struct bsmp_async_pending pending = {
+        .decode = decode_ok,
+        .cb     = cb,
+        .user   = user,
+        .info   = grp
+    };
+
+    return submit(async, &request, &pending);
+}
+
+enum bsmp_err bsmp_async_request_curve_block (bsmp_async_t *async,
+                                              struct bsmp_curve_info *curve,
+                                              uint16_t offset, uint8_t *data,
+                                              uint16_t *len, bsmp_async_cb_t cb,
+                                              void *user)
+{
+    if(!async || !curve || !data || !len)
+        return BSMP_ERR_PARAM_INVALID;
+
+    if(!curves_list_contains(&async->client->curves, curve))
+        return BSMP_ERR_PARAM_INVALID;
+
+    if(offset >= curve->nblocks)
+        return BSMP_ERR_PARAM_OUT_OF_RANGE;
+
+    struct bsmp_message request =
+        REQUEST(async->client, CMD_CURVE_BLOCK_REQUEST);
+
+    request.payload[0] = curve->id;
+    request.payload[1] = offset >> 8;
+    request.payload[2] = offset;
+    request.payload_size = BSMP_CURVE_BLOCK_INFO;
+
+    struct bsmp_async_pending pending = {
+        .decode = decode_curve_block,
+        .cb     = cb,
+        .user   = user,
+        .info   = curve,
+        .data   = data,
+        .len    = len
+    };
+
+    return submit(async, &request, &pending);
+}
+
+enum bsmp_err bsmp_async_send_curve_block (bsmp_async_t *async,
+                                           struct bsmp_curve_info *curve,
+                                           uint16_t offset, uint8_t *data,
+                                           uint16_t len, bsmp_async_cb_t cb,
+                                           void *user)
+{
+    if(!async || !curve || !data)
+        return BSMP_ERR_PARAM_INVALID;
+
+    if(!curves_list_contains(&async->client->curves, curve))
+        return BSMP_ERR_PARAM_INVALID;
+
+    if(!curve->writable)
+        return BSMP_ERR_PARAM_INVALID;
+
+    if(offset >= curve->nblocks)
+        return BSMP_ERR_PARAM_OUT_OF_RANGE;
+
+    if(len > curve->block_size)
+        return BSMP_ERR_PARAM_OUT_OF_RANGE;
+
+    struct bsmp_message request = REQUEST(async->client, CMD_CURVE_BLOCK);
+
+    curve_block_encode(curve, offset, data, len, false, &request);
+
+    struct bsmp_async_pending pending = {
+        .decode = decode_ok,
+        .cb     = cb,
+        .user   = user,
+        .info   = curve
+    };
+
+    return submit(async, &request, &pending);
+}
+
+enum bsmp_err bsmp_async_func_execute (bsmp_async_t *async,
+                                       struct bsmp_func_info *func,
+                                       uint8_t *error, uint8_t *input,
+                                       uint8_t *output, bsmp_async_cb_t cb,
+                                       void *user)
+{
+    if(!async || !func || !error)
+        return BSMP_ERR_PARAM_INVALID;
+
+    if(!funcs_list_contains(&async->client->funcs, func))
+        return BSMP_ERR_PARAM_INVALID;
+
+    if(func->input_size && !input)
+        return BSMP_ERR_PARAM_INVALID;
+
+    if(func->output_size && !output)
+        return BSMP_ERR_PARAM_INVALID;
+
+    struct bsmp_message request = REQUEST(async->client, CMD_FUNC_EXECUTE);
+
+    request.payload[0] = func->id;
+    request.payload_size = 1 + func->input_size;
+
+    if(func->input_size)
+        memcpy(&request.payload[1], input, func->input_size);
+
+    struct bsmp_async_pending pending = {
+        .decode = decode_func,
+        .cb     = cb,
+        .user   = user,
+        .info   = func,
+        .data   = output,
+        .error  = error
+    };
+
+    return submit(async, &request, &pending);
+}
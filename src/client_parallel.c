@@ -0,0 +1,159 @@
+#include "bsmp_priv.h"
+#include "client_priv.h"
+#include "md5/md5.h"
+#include "../include/client_parallel.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+
+// Range of blocks read by one client
+struct range
+{
+    bsmp_client_t           *client;
+    struct bsmp_curve_info  *curve;
+    unsigned int            first, count;
+    uint8_t                 *data;
+
+    enum bsmp_err           err;
+    uint32_t                len;
+    bool                    last;
+};
+
+static void *read_range (void *arg)
+{
+    struct range *r = arg;
+
+    r->err = curve_read_blocks(r->client, r->curve, r->first, r->count,
+                               r->data, &r->len, &r->last);
+    return NULL;
+}
+
+static bool verify_csum (bsmp_client_t *client, struct bsmp_curve_info *curve,
+                         uint8_t *data, uint32_t len, enum bsmp_err *err)
+{
+    uint8_t csum[BSMP_CURVE_CSUM_SIZE], expected[BSMP_CURVE_CSUM_SIZE];
+    MD5_CTX md5ctx;
+
+    if((*err = read_curve_csum(client, curve, expected)))
+        return false;
+
+    // One block at a time: a whole curve doesn't fit MD5Update's length
+    MD5Init(&md5ctx);
+    while(len)
+    {
+        unsigned int chunk = len < curve->block_size ? len : curve->block_size;
+
+        MD5Update(&md5ctx, data, chunk);
+        data += chunk;
+        len  -= chunk;
+    }
+    MD5Final(csum, &md5ctx);
+
+    if(memcmp(csum, expected, BSMP_CURVE_CSUM_SIZE))
+    {
+        *err = BSMP_ERR_CHECKSUM;
+        return false;
+    }
+
+    return true;
+}
+
+enum bsmp_err bsmp_read_curve_parallel (bsmp_client_t **clients,
+                                        unsigned int count,
+                                        struct bsmp_curve_info *curve,
+                                        uint8_t *data, uint32_t *len,
+                                        bool verify)
+{
+    if(!clients || !count || !curve || !data || !len)
+        return BSMP_ERR_PARAM_INVALID;
+
+    if(!clients[0] || !curves_list_contains(&clients[0]->curves, curve))
+        return BSMP_ERR_PARAM_INVALID;
+
+    if(count > BSMP_PARALLEL_MAX_CLIENTS)
+        return BSMP_ERR_PARAM_OUT_OF_RANGE;
+
+    // No more ranges than blocks
+    if(count > curve->nblocks)
+        count = curve->nblocks;
+
+    struct range ranges[BSMP_PARALLEL_MAX_CLIENTS];
+    pthread_t    threads[BSMP_PARALLEL_MAX_CLIENTS];
+
+    unsigned int i, first = 0;
+    for(i = 0; i < count; ++i)
+    {
+        bsmp_client_t *client = clients[i];
+
+        // Each client has its own copy of the list of curves
+        if(!client || client->curves.count <= curve->id)
+            return BSMP_ERR_PARAM_INVALID;
+
+        struct bsmp_curve_info *c = &client->curves.list[curve->id];
+
+        if(c->block_size != curve->block_size || c->nblocks != curve->nblocks)
+            return BSMP_ERR_PARAM_INVALID;
+
+        // Spread the remainder over the first ranges
+        unsigned int n = curve->nblocks/count + (i < curve->nblocks % count);
+
+        ranges[i] = (struct range) {
+            .client = client,
+            .curve  = c,
+            .first  = first,
+            .count  = n,
+            .data   = data
+        };
+
+        first += n;
+    }
+
+    // The first range is read by the calling thread
+    enum bsmp_err err = BSMP_SUCCESS;
+    unsigned int started;
+
+    for(started = 1; started < count; ++started)
+    {
+        if(pthread_create(&threads[started], NULL, read_range,
+                          &ranges[started]))
+        {
+            err = BSMP_ERR_OUT_OF_MEMORY;
+            break;
+        }
+    }
+
+    if(!err)
+        read_range(&ranges[0]);
+
+    for(i = 1; i < started; ++i)
+        pthread_join(threads[i], NULL);
+
+    if(err)
+        return err;
+
+    // Up to the first short block, in order
+    *len = 0;
+    for(i = 0; i < count; ++i)
+    {
+        if(ranges[i].err)
+        {
+            *len = 0;
+            return ranges[i].err;
+        }
+
+        *len += ranges[i].len;
+
+        if(ranges[i].last)
+            break;
+    }
+
+    if(verify && !verify_csum(clients[0], curve, data, *len, &err))
+    {
+        *len = 0;
+        return err;
+    }
+
+    return BSMP_SUCCESS;
+}
@@ -0,0 +1,377 @@
+#include "../include/client_poller.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+static uint64_t now_us (void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+// Queue the callback of a device to a worker
+static void push (bsmp_poller_t *p, struct bsmp_poll_worker *w,
+                  struct bsmp_poll_device *dev)
+{
+    pthread_mutex_lock(&w->lock);
+    w->jobs[w->tail++] = dev;
+    pthread_mutex_unlock(&w->lock);
+
+    pthread_mutex_lock(&p->lock);
+    ++p->queued;
+    pthread_cond_signal(&p->work);
+    pthread_mutex_unlock(&p->lock);
+}
+
+// The owner takes the newest job, thieves the oldest
+static struct bsmp_poll_device *take (struct bsmp_poll_worker *w, bool own)
+{
+    struct bsmp_poll_device *dev = NULL;
+
+    pthread_mutex_lock(&w->lock);
+    if(w->head != w->tail)
+        dev = own ? w->jobs[--w->tail] : w->jobs[w->head++];
+    pthread_mutex_unlock(&w->lock);
+
+    return dev;
+}
+
+static void *worker_thread (void *arg)
+{
+    struct bsmp_poll_worker *self = arg;
+    bsmp_poller_t *p = self->poller;
+    unsigned int id = self - p->workers;
+
+    pthread_mutex_lock(&p->lock);
+    for(;;)
+    {
+        while(!p->queued && !p->quit)
+            pthread_cond_wait(&p->work, &p->lock);
+
+        if(!p->queued)
+            break;
+
+        // One of the queued jobs is ours. Another worker may take it before
+        // we get there, but then the one it was after is still queued.
+        --p->queued;
+        pthread_mutex_unlock(&p->lock);
+
+        struct bsmp_poll_device *dev;
+        unsigned int i = 0;
+
+        while(!(dev = take(&p->workers[(id + i) % p->nworkers], !i)))
+            i = (i + 1) % p->nworkers;
+
+        if(dev->done)
+            dev->done(dev, dev->err, dev->user);
+
+        pthread_mutex_lock(&p->lock);
+
+        if(i)
+            ++p->stats.steals;
+
+        if(dev->err)
+            ++p->stats.errors;
+
+        if(!--p->pending)
+            pthread_cond_signal(&p->idle);
+    }
+    pthread_mutex_unlock(&p->lock);
+
+    return NULL;
+}
+
+static void *link_thread (void *arg)
+{
+    struct bsmp_poll_link *link = arg;
+    bsmp_poller_t *p = link->poller;
+    uint32_t seen = 0;
+
+    pthread_mutex_lock(&p->lock);
+    for(;;)
+    {
+        while(!p->quit && p->cycle == seen)
+            pthread_cond_wait(&p->start, &p->lock);
+
+        if(p->quit)
+            break;
+
+        seen = p->cycle;
+        pthread_mutex_unlock(&p->lock);
+
+        unsigned int i, j;
+        for(i = link->first; i < link->first + link->count; ++i)
+        {
+            struct bsmp_poll_device *dev = p->order[i];
+            uint64_t start = now_us();
+
+            // Go on after an error: each read has its own response
+            dev->err = BSMP_SUCCESS;
+            for(j = 0; j < dev->nreads; ++j)
+            {
+                enum bsmp_err err = !j && dev->ring ?
+                                    bsmp_ring_read(dev->ring, &dev->plan[j]) :
+                                    bsmp_prepared_exec(&dev->plan[j]);
+
+                if(err && !dev->err)
+                    dev->err = err;
+            }
+
+            dev->read_us = now_us() - start;
+
+            // Before its callback can end the cycle
+            if(i == link->first + link->count - 1)
+            {
+                pthread_mutex_lock(&p->lock);
+                if(++p->links_done == p->nlinks)
+                    p->acquired = now_us();
+                pthread_mutex_unlock(&p->lock);
+            }
+
+            push(p, &p->workers[link->worker], dev);
+        }
+
+        pthread_mutex_lock(&p->lock);
+    }
+    pthread_mutex_unlock(&p->lock);
+
+    return NULL;
+}
+
+static void *clock_thread (void *arg)
+{
+    bsmp_poller_t *p = arg;
+    uint64_t start = now_us();
+
+    pthread_mutex_lock(&p->lock);
+    while(!p->stop)
+    {
+        // Every queue was emptied by the previous cycle
+        unsigned int i;
+        for(i = 0; i < p->nworkers; ++i)
+        {
+            pthread_mutex_lock(&p->workers[i].lock);
+            p->workers[i].head = p->workers[i].tail = 0;
+            pthread_mutex_unlock(&p->workers[i].lock);
+        }
+
+        p->pending      = p->count;
+        p->links_done   = 0;
+        p->acquired     = start;
+        p->stats.errors = 0;
+        ++p->cycle;
+        pthread_cond_broadcast(&p->start);
+
+        while(p->pending)
+            pthread_cond_wait(&p->idle, &p->lock);
+
+        uint64_t end = now_us();
+
+        p->stats.cycle      = p->cycle - 1;
+        p->stats.acquire_us = p->acquired - start;
+        p->stats.cycle_us   = end - start;
+
+        // Slots of the period already gone are skipped
+        uint64_t slots = (end - start)/p->period_us + 1;
+        if(slots > 1)
+            ++p->stats.overruns;
+
+        struct bsmp_poll_stats stats = p->stats;
+
+        pthread_mutex_unlock(&p->lock);
+        if(p->stats_cb)
+            p->stats_cb(p, &stats, p->user);
+        pthread_mutex_lock(&p->lock);
+
+        start += slots*p->period_us;
+
+        struct timespec deadline = {
+            .tv_sec  = start/1000000,
+            .tv_nsec = start%1000000*1000
+        };
+
+        while(!p->stop && now_us() < start)
+            pthread_cond_timedwait(&p->start, &p->lock, &deadline);
+    }
+    pthread_mutex_unlock(&p->lock);
+
+    return NULL;
+}
+
+enum bsmp_err bsmp_poller_init (bsmp_poller_t *poller,
+                                struct bsmp_poll_device *devices,
+                                unsigned int count, unsigned int workers,
+                                uint32_t period_us, bsmp_poll_stats_t stats_cb,
+                                void *user)
+{
+    if(!poller || !devices)
+        return BSMP_ERR_PARAM_INVALID;
+
+    if(!count || count > BSMP_POLL_MAX_DEVICES || !workers ||
+       workers > BSMP_POLL_MAX_WORKERS || !period_us)
+        return BSMP_ERR_PARAM_OUT_OF_RANGE;
+
+    unsigned int i, l, per_link[BSMP_POLL_MAX_LINKS] = {0};
+    for(i = 0; i < count; ++i)
+    {
+        if(!devices[i].client || !devices[i].plan)
+            return BSMP_ERR_PARAM_INVALID;
+
+        bsmp_ring_t *ring = devices[i].ring;
+        if(ring && (!devices[i].nreads ||
+                    ring->size != devices[i].plan[0].size))
+            return BSMP_ERR_PARAM_INVALID;
+
+        if(devices[i].link >= BSMP_POLL_MAX_LINKS)
+            return BSMP_ERR_PARAM_OUT_OF_RANGE;
+
+        ++per_link[devices[i].link];
+    }
+
+    poller->devices   = devices;
+    poller->count     = count;
+    poller->period_us = period_us;
+    poller->stats_cb  = stats_cb;
+    poller->user      = user;
+    poller->running   = false;
+
+    // Sort the devices by link, keeping their order within each link
+    poller->nlinks = 0;
+    unsigned int first = 0;
+    for(l = 0; l < BSMP_POLL_MAX_LINKS; ++l)
+    {
+        if(!per_link[l])
+            continue;
+
+        struct bsmp_poll_link *link = &poller->links[poller->nlinks];
+
+        link->poller = poller;
+        link->first  = first;
+        link->count  = 0;
+        link->worker = poller->nlinks % workers;
+
+        for(i = 0; i < count; ++i)
+            if(devices[i].link == l)
+                poller->order[first + link->count++] = &devices[i];
+
+        first += link->count;
+        ++poller->nlinks;
+    }
+
+    poller->nworkers = workers;
+    for(i = 0; i < workers; ++i)
+    {
+        poller->workers[i].poller = poller;
+        poller->workers[i].head   = 0;
+        poller->workers[i].tail   = 0;
+        pthread_mutex_init(&poller->workers[i].lock, NULL);
+    }
+
+    // The clock sleeps on start until the next cycle
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+
+    pthread_mutex_init(&poller->lock, NULL);
+    pthread_cond_init(&poller->start, &attr);
+    pthread_cond_init(&poller->work, NULL);
+    pthread_cond_init(&poller->idle, NULL);
+
+    pthread_condattr_destroy(&attr);
+
+    return BSMP_SUCCESS;
+}
+
+// Finish the current cycle and join the threads started so far
+static void shutdown_threads (bsmp_poller_t *p, unsigned int workers,
+                              unsigned int links, bool clock)
+{
+    unsigned int i;
+
+    pthread_mutex_lock(&p->lock);
+    p->stop = true;
+    pthread_cond_broadcast(&p->start);
+    pthread_mutex_unlock(&p->lock);
+
+    if(clock)
+        pthread_join(p->clock, NULL);
+
+    pthread_mutex_lock(&p->lock);
+    p->quit = true;
+    pthread_cond_broadcast(&p->start);
+    pthread_cond_broadcast(&p->work);
+    pthread_mutex_unlock(&p->lock);
+
+    for(i = 0; i < links; ++i)
+        pthread_join(p->links[i].thread, NULL);
+
+    for(i = 0; i < workers; ++i)
+        pthread_join(p->workers[i].thread, NULL);
+}
+
+enum bsmp_err bsmp_poller_start (bsmp_poller_t *poller)
+{
+    if(!poller || poller->running)
+        return BSMP_ERR_PARAM_INVALID;
+
+    poller->stop    = false;
+    poller->quit    = false;
+    poller->cycle   = 0;
+    poller->queued  = 0;
+    poller->pending = 0;
+    memset(&poller->stats, 0, sizeof(poller->stats));
+
+    unsigned int w, l = 0;
+
+    for(w = 0; w < poller->nworkers; ++w)
+        if(pthread_create(&poller->workers[w].thread, NULL, worker_thread,
+                          &poller->workers[w]))
+            break;
+
+    if(w == poller->nworkers)
+        for(l = 0; l < poller->nlinks; ++l)
+            if(pthread_create(&poller->links[l].thread, NULL, link_thread,
+                              &poller->links[l]))
+                break;
+
+    // The clock goes last: the others wait for its first cycle
+    if(w == poller->nworkers && l == poller->nlinks &&
+       !pthread_create(&poller->clock, NULL, clock_thread, poller))
+    {
+        poller->running = true;
+        return BSMP_SUCCESS;
+    }
+
+    shutdown_threads(poller, w, l, false);
+    return BSMP_ERR_OUT_OF_MEMORY;
+}
+
+enum bsmp_err bsmp_poller_stop (bsmp_poller_t *poller)
+{
+    if(!poller || !poller->running)
+        return BSMP_ERR_PARAM_INVALID;
+
+    shutdown_threads(poller, poller->nworkers, poller->nlinks, true);
+    poller->running = false;
+
+    return BSMP_SUCCESS;
+}
+
+void bsmp_poller_destroy (bsmp_poller_t *poller)
+{
+    if(!poller)
+        return;
+
+    unsigned int i;
+    for(i = 0; i < poller->nworkers; ++i)
+        pthread_mutex_destroy(&poller->workers[i].lock);
+
+    pthread_mutex_destroy(&poller->lock);
+    pthread_cond_destroy(&poller->start);
+    pthread_cond_destroy(&poller->work);
+    pthread_cond_destroy(&poller->idle);
+}
@@ -0,0 +1,64 @@
+#ifndef BSMP_CLIENT_PRIV_H
+#define BSMP_CLIENT_PRIV_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "../include/bsmp.h"
+#include "../include/client.h"
+
+// Message in the buffer of the client. Requests are encoded in place, right
+// after the room for their header, and responses are received over them.
+struct bsmp_message
+{
+    uint8_t     code;
+    uint16_t    payload_size;
+    uint8_t     *payload;
+
+    // Requests only: data that follows the payload in the message. It's sent
+    // from where it is if the transport can send vectors, and copied after the
+    // payload otherwise.
+    uint8_t     *tail;
+    uint16_t    tail_size;
+};
+
+#define REQUEST(client, cmd)\
+    {\
+        .code = (cmd),\
+        .payload_size = 0,\
+        .payload = (client)->buf + BSMP_HEADER_SIZE\
+    }
+
+// Copy the tail of a request after its payload
+void request_flatten (struct bsmp_message *request);
+
+bool vars_list_contains   (struct bsmp_var_info_list *list,
+                           struct bsmp_var_info *item);
+bool groups_list_contains (struct bsmp_group_list *list,
+                           struct bsmp_group *item);
+bool curves_list_contains (struct bsmp_curve_info_list *list,
+                           struct bsmp_curve_info *item);
+bool funcs_list_contains  (struct bsmp_func_info_list *list,
+                           struct bsmp_func_info *item);
+
+// Decode a block, compressed or not
+enum bsmp_err curve_block_decode (struct bsmp_curve_info *curve,
+                                  struct bsmp_message *response,
+                                  uint8_t *data, uint16_t *len);
+
+// Encode a block write, compressed if asked to and if it pays off
+void curve_block_encode (struct bsmp_curve_info *curve, uint16_t offset,
+                         uint8_t *data, uint16_t len, bool compress,
+                         struct bsmp_message *request);
+
+// Read count blocks of a curve, from first on, each one to its place in data
+// (the buffer of the whole curve). Stops after a short block, setting last.
+enum bsmp_err curve_read_blocks (bsmp_client_t *client,
+                                 struct bsmp_curve_info *curve,
+                                 unsigned int first, unsigned int count,
+                                 uint8_t *data, uint32_t *len, bool *last);
+
+// Current checksum of a curve, as the server has it
+enum bsmp_err read_curve_csum (bsmp_client_t *client,
+                               struct bsmp_curve_info *curve, uint8_t *csum);
+
+#endif
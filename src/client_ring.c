@@ -0,0 +1,141 @@
+#include "../include/client_ring.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+// Each end is written by one thread only. It publishes its index with a
+// release store after touching the slots, the other end reads it with an
+// acquire load before touching them.
+#define LOAD(x)         __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define STORE(x, v)     __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+
+static uint64_t monotonic_us (void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+static uint8_t *slot (bsmp_ring_t *ring, uint32_t index)
+{
+    return ring->mem + (index & ring->mask)*ring->stride;
+}
+
+enum bsmp_err bsmp_ring_init (bsmp_ring_t *ring, uint16_t size, uint32_t slots,
+                              void *mem, uint32_t mem_size)
+{
+    if(!ring || !mem)
+        return BSMP_ERR_PARAM_INVALID;
+
+    if(!size || !slots || (slots & (slots - 1)) ||
+       slots > UINT32_MAX/BSMP_RING_STRIDE(size) ||
+       mem_size < BSMP_RING_MEM_SIZE(size, slots))
+        return BSMP_ERR_PARAM_OUT_OF_RANGE;
+
+    memset(ring, 0, sizeof(*ring));
+    ring->mem    = mem;
+    ring->size   = size;
+    ring->stride = BSMP_RING_STRIDE(size);
+    ring->mask   = slots - 1;
+
+    return BSMP_SUCCESS;
+}
+
+uint8_t *bsmp_ring_reserve (bsmp_ring_t *ring)
+{
+    // The tail is only read again when the ring looks full
+    if(ring->head - ring->tail_cache > ring->mask)
+    {
+        ring->tail_cache = LOAD(ring->tail);
+
+        if(ring->head - ring->tail_cache > ring->mask)
+            return NULL;
+    }
+
+    return slot(ring, ring->head) + 8;
+}
+
+void bsmp_ring_commit (bsmp_ring_t *ring, uint64_t time_us)
+{
+    memcpy(slot(ring, ring->head), &time_us, 8);
+    STORE(ring->head, ring->head + 1);
+}
+
+enum bsmp_err bsmp_ring_push (bsmp_ring_t *ring, uint64_t time_us,
+                              const uint8_t *data)
+{
+    if(!ring || !data)
+        return BSMP_ERR_PARAM_INVALID;
+
+    uint8_t *dest = bsmp_ring_reserve(ring);
+
+    if(!dest)
+    {
+        ++ring->dropped;
+        return BSMP_ERR_OUT_OF_MEMORY;
+    }
+
+    memcpy(dest, data, ring->size);
+    bsmp_ring_commit(ring, time_us);
+
+    return BSMP_SUCCESS;
+}
+
+enum bsmp_err bsmp_ring_read (bsmp_ring_t *ring, struct bsmp_prepared *read)
+{
+    if(!ring || !read || read->size != ring->size)
+        return BSMP_ERR_PARAM_INVALID;
+
+    uint8_t *dest = bsmp_ring_reserve(ring);
+
+    if(!dest)
+    {
+        ++ring->dropped;
+        return bsmp_prepared_exec(read);
+    }
+
+    // Only the destination of the read changes
+    struct bsmp_prepared into = *read;
+    into.dest = dest;
+
+    uint64_t time_us = monotonic_us();
+    enum bsmp_err err = bsmp_prepared_exec(&into);
+
+    if(!err)
+        bsmp_ring_commit(ring, time_us);
+
+    return err;
+}
+
+const uint8_t *bsmp_ring_peek (bsmp_ring_t *ring, uint64_t *time_us)
+{
+    if(ring->tail == ring->head_cache)
+    {
+        ring->head_cache = LOAD(ring->head);
+
+        if(ring->tail == ring->head_cache)
+            return NULL;
+    }
+
+    uint8_t *s = slot(ring, ring->tail);
+
+    if(time_us)
+        memcpy(time_us, s, 8);
+
+    return s + 8;
+}
+
+void bsmp_ring_release (bsmp_ring_t *ring)
+{
+    STORE(ring->tail, ring->tail + 1);
+}
+
+uint32_t bsmp_ring_count (bsmp_ring_t *ring)
+{
+    // Tail first: it only moves up to the head, so a head loaded after it is
+    // never behind it and the count can't wrap around
+    uint32_t tail = LOAD(ring->tail);
+    return LOAD(ring->head) - tail;
+}
@@ -0,0 +1,248 @@
+#include "../include/client_sched.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+// Bytes of a prepared read on the wire, besides the value
+#define READ_OVERHEAD       (2*BSMP_HEADER_SIZE + 1)
+
+// A new sample weighs 1/RTT_WEIGHT of the round trip time
+#define RTT_WEIGHT          8
+
+static uint64_t monotonic_us (void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+// Time a read of the task takes on the link, in us
+static uint32_t read_cost (bsmp_sched_t *sched, struct bsmp_sched_task *task)
+{
+    uint64_t bytes = READ_OVERHEAD + task->read.size;
+    return sched->rtt_us + bytes*sched->byte_ns/1000;
+}
+
+static uint64_t period (struct bsmp_sched_task *task)
+{
+    return (uint64_t) task->period_us << task->shift;
+}
+
+// An implicit deadline follows the period when the task is degraded
+static uint64_t deadline (struct bsmp_sched_task *task)
+{
+    return task->release + (task->deadline_us ? task->deadline_us :
+                                                period(task));
+}
+
+// Share of the link a task takes, in ppm
+static uint64_t task_load (bsmp_sched_t *sched, struct bsmp_sched_task *task)
+{
+    return (uint64_t) read_cost(sched, task)*1000000/period(task);
+}
+
+// Double the periods of the least important tasks until all of them fit in
+// the budget. Starts over every time, so that tasks are restored as soon as
+// the link allows.
+static void degrade (bsmp_sched_t *sched)
+{
+    uint64_t total = 0;
+    unsigned int i;
+
+    for(i = 0; i < sched->count; ++i)
+    {
+        sched->tasks[i]->shift = 0;
+        total += task_load(sched, sched->tasks[i]);
+    }
+
+    while(total > sched->budget_ppm)
+    {
+        struct bsmp_sched_task *victim = NULL;
+
+        for(i = 0; i < sched->count; ++i)
+        {
+            struct bsmp_sched_task *t = sched->tasks[i];
+
+            if(t->shift == BSMP_SCHED_MAX_SHIFT)
+                continue;
+
+            if(!victim || t->priority > victim->priority ||
+               (t->priority == victim->priority &&
+                task_load(sched, t) > task_load(sched, victim)))
+                victim = t;
+        }
+
+        // Nothing left to degrade: deadlines will be missed
+        if(!victim)
+            break;
+
+        total -= task_load(sched, victim);
+        ++victim->shift;
+        total += task_load(sched, victim);
+    }
+}
+
+static unsigned int jitter_bin (uint64_t late)
+{
+    unsigned int bin = 0;
+
+    while(late && bin < BSMP_SCHED_HIST_BINS - 1)
+    {
+        late >>= 1;
+        ++bin;
+    }
+
+    return bin;
+}
+
+enum bsmp_err bsmp_sched_init (bsmp_sched_t *sched, bsmp_client_t *client,
+                               uint32_t byte_ns, unsigned int budget_pct,
+                               bsmp_sched_clock_t clock)
+{
+    if(!sched || !client)
+        return BSMP_ERR_PARAM_INVALID;
+
+    if(!budget_pct || budget_pct > 100)
+        return BSMP_ERR_PARAM_OUT_OF_RANGE;
+
+    sched->client     = client;
+    sched->clock      = clock ? clock : monotonic_us;
+    sched->byte_ns    = byte_ns;
+    sched->budget_ppm = budget_pct*10000;
+    sched->rtt_us     = 0;
+    sched->count      = 0;
+
+    return BSMP_SUCCESS;
+}
+
+enum bsmp_err bsmp_sched_add (bsmp_sched_t *sched,
+                              struct bsmp_sched_task *task)
+{
+    if(!sched || !task || task->read.client != sched->client)
+        return BSMP_ERR_PARAM_INVALID;
+
+    if(task->ring && task->ring->size != task->read.size)
+        return BSMP_ERR_PARAM_INVALID;
+
+    if(!task->period_us || task->deadline_us > task->period_us)
+        return BSMP_ERR_PARAM_OUT_OF_RANGE;
+
+    if(sched->count == BSMP_SCHED_MAX_TASKS)
+        return BSMP_ERR_OUT_OF_MEMORY;
+
+    unsigned int i;
+    for(i = 0; i < sched->count; ++i)
+        if(sched->tasks[i] == task)
+            return BSMP_ERR_DUPLICATE;
+
+    task->release = sched->clock();
+    task->shift   = 0;
+    task->runs    = 0;
+    task->misses  = 0;
+    task->skipped = 0;
+    memset(task->jitter, 0, sizeof(task->jitter));
+
+    sched->tasks[sched->count++] = task;
+    degrade(sched);
+
+    return BSMP_SUCCESS;
+}
+
+enum bsmp_err bsmp_sched_run (bsmp_sched_t *sched, uint32_t *wait_us)
+{
+    if(!sched || !wait_us)
+        return BSMP_ERR_PARAM_INVALID;
+
+    uint64_t now = sched->clock();
+    struct bsmp_sched_task *next = NULL;
+    unsigned int i;
+
+    // Earliest deadline among the released tasks
+    for(i = 0; i < sched->count; ++i)
+    {
+        struct bsmp_sched_task *t = sched->tasks[i];
+
+        if(t->release <= now && (!next || deadline(t) < deadline(next)))
+            next = t;
+    }
+
+    if(next)
+    {
+        ++next->jitter[jitter_bin(now - next->release)];
+
+        enum bsmp_err err = next->ring ?
+                            bsmp_ring_read(next->ring, &next->read) :
+                            bsmp_prepared_exec(&next->read);
+        uint64_t end = sched->clock();
+
+        // What the transfer of the bytes doesn't explain is round trip
+        if(!err)
+        {
+            uint64_t took = end - now;
+            uint64_t xfer = (uint64_t)(READ_OVERHEAD + next->read.size)*
+                            sched->byte_ns/1000;
+            uint32_t rtt  = took > xfer ? took - xfer : 0;
+
+            if(!sched->rtt_us)
+                sched->rtt_us = rtt;
+            else
+                sched->rtt_us += ((int64_t) rtt - sched->rtt_us)/RTT_WEIGHT;
+
+            degrade(sched);
+        }
+
+        ++next->runs;
+        if(end > deadline(next))
+            ++next->misses;
+
+        // Drop the releases already gone
+        next->release += period(next);
+        if(next->release + period(next) <= end)
+        {
+            uint64_t gone = (end - next->release)/period(next);
+
+            next->release += gone*period(next);
+            next->skipped += gone;
+        }
+
+        if(next->done)
+            next->done(next, err, next->user);
+
+        now = sched->clock();
+    }
+
+    // Until the next release
+    uint64_t wait = UINT32_MAX;
+    for(i = 0; i < sched->count; ++i)
+    {
+        struct bsmp_sched_task *t = sched->tasks[i];
+
+        if(t->release <= now)
+        {
+            wait = 0;
+            break;
+        }
+
+        if(t->release - now < wait)
+            wait = t->release - now;
+    }
+
+    *wait_us = wait;
+    return BSMP_SUCCESS;
+}
+
+uint32_t bsmp_sched_load (bsmp_sched_t *sched)
+{
+    uint64_t total = 0;
+
+    if(!sched)
+        return 0;
+
+    unsigned int i;
+    for(i = 0; i < sched->count; ++i)
+        total += task_load(sched, sched->tasks[i]);
+
+    return total > UINT32_MAX ? UINT32_MAX : total;
+}
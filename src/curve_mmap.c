@@ -0,0 +1,211 @@
+#include "../include/curve_mmap.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define CURVE_MMAP(curve)   ((struct bsmp_curve_mmap *)(curve))
+
+// msync needs a page aligned start address
+static bool sync_range (struct bsmp_curve_mmap *mc, size_t offset, size_t len)
+{
+    size_t page  = (size_t) sysconf(_SC_PAGESIZE);
+    size_t start = offset - (offset % page);
+
+    return !msync(mc->map + start, offset + len - start, MS_SYNC);
+}
+
+static bool curve_mmap_ptr (struct bsmp_curve *curve, uint16_t block,
+                            uint8_t **data, uint16_t *len)
+{
+    struct bsmp_curve_mmap *mc = CURVE_MMAP(curve);
+    size_t offset = (size_t) block * curve->info.block_size;
+
+    // Blocks past the end of a short read-only file are empty
+    if(offset >= mc->data_len)
+    {
+        *data = mc->map;
+        *len  = 0;
+        return true;
+    }
+
+    size_t remaining = mc->data_len - offset;
+    *data = mc->map + offset;
+    *len  = remaining < curve->info.block_size ? remaining
+                                               : curve->info.block_size;
+    return true;
+}
+
+static bool curve_mmap_read (struct bsmp_curve *curve, uint16_t block,
+                             uint8_t *data, uint16_t *len)
+{
+    uint8_t *block_data;
+
+    curve_mmap_ptr(curve, block, &block_data, len);
+    memcpy(data, block_data, *len);
+    return true;
+}
+
+static bool curve_mmap_write (struct bsmp_curve *curve, uint16_t block,
+                              uint8_t *data, uint16_t len)
+{
+    struct bsmp_curve_mmap *mc = CURVE_MMAP(curve);
+    size_t offset = (size_t) block * curve->info.block_size;
+
+    memcpy(mc->map + offset, data, len);
+
+    if(!sync_range(mc, offset, len))
+        return false;
+
+    // The server zeroes the checksum of a written curve. Don't let a stale one
+    // survive in the file.
+    if(mc->csum)
+    {
+        memset(mc->csum, 0, BSMP_CURVE_CSUM_SIZE);
+        if(!sync_range(mc, mc->csum - mc->map, BSMP_CURVE_CSUM_SIZE))
+            return false;
+    }
+
+    return true;
+}
+
+enum bsmp_err bsmp_curve_mmap_open (struct bsmp_curve_mmap *mc,
+                                    const char *path, uint16_t block_size,
+                                    uint32_t nblocks, bool writable,
+                                    bool persist_csum)
+{
+    if(!mc || !path)
+        return BSMP_ERR_PARAM_INVALID;
+
+    if(!block_size || block_size > BSMP_CURVE_BLOCK_MAX_SIZE)
+        return BSMP_ERR_PARAM_OUT_OF_RANGE;
+
+    if(nblocks > BSMP_CURVE_MAX_BLOCKS || (writable && !nblocks))
+        return BSMP_ERR_PARAM_OUT_OF_RANGE;
+
+    memset(mc, 0, sizeof(*mc));
+
+    mc->fd = open(path, writable ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+    if(mc->fd < 0)
+        return BSMP_ERR_IO;
+
+    struct stat st;
+    if(fstat(mc->fd, &st))
+        goto err;
+
+    size_t file_len  = (size_t) st.st_size;
+    size_t csum_len  = persist_csum ? BSMP_CURVE_CSUM_SIZE : 0;
+
+    if(!nblocks)
+    {
+        if(file_len <= csum_len)
+            goto err;
+
+        size_t data_len = file_len - csum_len;
+        nblocks = (data_len + block_size - 1) / block_size;
+
+        if(nblocks > BSMP_CURVE_MAX_BLOCKS)
+        {
+            close(mc->fd);
+            return BSMP_ERR_PARAM_OUT_OF_RANGE;
+        }
+    }
+
+    uint64_t full_len = (uint64_t) nblocks * block_size;
+
+    if(full_len + csum_len > SIZE_MAX)
+    {
+        close(mc->fd);
+        return BSMP_ERR_PARAM_OUT_OF_RANGE;
+    }
+
+    if(writable)
+    {
+        // Grow the file so that every block is backed by it
+        if(file_len < full_len + csum_len &&
+           ftruncate(mc->fd, (off_t)(full_len + csum_len)))
+            goto err;
+
+        mc->map_len  = full_len + csum_len;
+        mc->data_len = full_len;
+    }
+    else
+    {
+        // Don't map past the end of the file: touching it would raise SIGBUS
+        mc->map_len  = file_len < full_len + csum_len ? file_len
+                                                      : full_len + csum_len;
+        mc->data_len = file_len < full_len ? file_len : full_len;
+    }
+
+    if(mc->map_len)
+    {
+        int prot = PROT_READ | (writable ? PROT_WRITE : 0);
+
+        mc->map = mmap(NULL, mc->map_len, prot, MAP_SHARED, mc->fd, 0);
+        if(mc->map == MAP_FAILED)
+        {
+            mc->map = NULL;
+            goto err;
+        }
+    }
+
+    // Only a complete curve has its checksum stored after the last block
+    if(persist_csum && mc->map_len == full_len + csum_len)
+    {
+        mc->csum = mc->map + full_len;
+        memcpy(mc->curve.info.checksum, mc->csum, BSMP_CURVE_CSUM_SIZE);
+    }
+
+    mc->curve.info.nblocks    = nblocks;
+    mc->curve.info.block_size = block_size;
+    mc->curve.info.writable   = writable;
+    mc->curve.read_block      = curve_mmap_read;
+    mc->curve.get_block_ptr   = curve_mmap_ptr;
+    mc->curve.write_block     = writable ? curve_mmap_write : NULL;
+
+    return BSMP_SUCCESS;
+
+err:
+    close(mc->fd);
+    mc->fd = -1;
+    return BSMP_ERR_IO;
+}
+
+enum bsmp_err bsmp_curve_mmap_sync (struct bsmp_curve_mmap *mc)
+{
+    if(!mc || mc->fd < 0)
+        return BSMP_ERR_PARAM_INVALID;
+
+    if(!mc->map)
+        return BSMP_SUCCESS;
+
+    if(mc->csum && mc->curve.info.writable)
+        memcpy(mc->csum, mc->curve.info.checksum, BSMP_CURVE_CSUM_SIZE);
+
+    if(mc->curve.info.writable && msync(mc->map, mc->map_len, MS_SYNC))
+        return BSMP_ERR_IO;
+
+    return BSMP_SUCCESS;
+}
+
+enum bsmp_err bsmp_curve_mmap_close (struct bsmp_curve_mmap *mc)
+{
+    enum bsmp_err err;
+
+    if((err = bsmp_curve_mmap_sync(mc)) == BSMP_ERR_PARAM_INVALID)
+        return err;
+
+    if(mc->map)
+        munmap(mc->map, mc->map_len);
+
+    close(mc->fd);
+
+    mc->fd   = -1;
+    mc->map  = NULL;
+    mc->csum = NULL;
+
+    return err;
+}
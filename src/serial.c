@@ -0,0 +1,421 @@
+#include "bsmp_priv.h"
+#include "../include/serial.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+
+#ifdef __linux__
+#include <linux/serial.h>
+#endif
+
+#define FRAME_HEADER    (1 + BSMP_HEADER_SIZE)
+
+// Words summed into the 16-bit lanes before they could overflow
+#define LANE_WORDS      128
+
+// Sums len bytes modulo 256. Eight bytes at a time go into four 16-bit lanes,
+// even bytes and odd bytes added separately.
+static uint8_t sum_bytes (const uint8_t *data, uint32_t len)
+{
+    const uint64_t even = 0x00FF00FF00FF00FFull;
+    uint32_t sum = 0;
+
+    while(len >= 8)
+    {
+        uint64_t lanes = 0, w;
+        unsigned int n = len/8 < LANE_WORDS ? len/8 : LANE_WORDS;
+
+        len -= n*8;
+        while(n--)
+        {
+            memcpy(&w, data, 8);
+            data += 8;
+            lanes += (w & even) + ((w >> 8) & even);
+        }
+
+        sum += (lanes & 0xFFFF) + ((lanes >> 16) & 0xFFFF) +
+               ((lanes >> 32) & 0xFFFF) + (lanes >> 48);
+    }
+
+    while(len--)
+        sum += *data++;
+
+    return sum;
+}
+
+static speed_t baud_speed (uint32_t baud)
+{
+    switch(baud)
+    {
+    case 9600:      return B9600;
+    case 19200:     return B19200;
+    case 38400:     return B38400;
+    case 57600:     return B57600;
+    case 115200:    return B115200;
+    case 230400:    return B230400;
+#ifdef B460800
+    case 460800:    return B460800;
+    case 500000:    return B500000;
+    case 921600:    return B921600;
+    case 1000000:   return B1000000;
+    case 2000000:   return B2000000;
+    case 3000000:   return B3000000;
+    case 4000000:   return B4000000;
+#endif
+    default:        return B0;
+    }
+}
+
+enum bsmp_err bsmp_serial_attach (bsmp_serial_t *serial, int fd, uint32_t baud,
+                                  uint8_t address)
+{
+    if(!serial || fd < 0)
+        return BSMP_ERR_PARAM_INVALID;
+
+    speed_t speed = baud_speed(baud);
+
+    if(baud && speed == B0)
+        return BSMP_ERR_PARAM_OUT_OF_RANGE;
+
+    struct termios tio;
+
+    if(tcgetattr(fd, &tio))
+        return BSMP_ERR_IO;
+
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cflag &= ~(CSTOPB | PARENB | CRTSCTS);
+    tio.c_iflag &= ~(IXON | IXOFF | IXANY);
+
+    // No inter-byte timer. Reads are non-blocking and return whatever is
+    // there, the waiting is done by poll. With VMIN = 0, an empty line would
+    // read as end of file rather than EAGAIN.
+    tio.c_cc[VMIN]  = 1;
+    tio.c_cc[VTIME] = 0;
+
+    if(baud && (cfsetispeed(&tio, speed) || cfsetospeed(&tio, speed)))
+        return BSMP_ERR_IO;
+
+    if(tcsetattr(fd, TCSANOW, &tio))
+        return BSMP_ERR_IO;
+
+#ifdef __linux__
+    // Not all drivers have it, pseudo terminals don't
+    struct serial_struct ss;
+    if(!ioctl(fd, TIOCGSERIAL, &ss))
+    {
+        ss.flags |= ASYNC_LOW_LATENCY;
+        ioctl(fd, TIOCSSERIAL, &ss);
+    }
+#endif
+
+    int flags = fcntl(fd, F_GETFL);
+    if(flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK))
+        return BSMP_ERR_IO;
+
+    tcflush(fd, TCIOFLUSH);
+
+    serial->fd         = fd;
+    serial->address    = address;
+    serial->timeout_ms = 1000;
+    serial->gap_ms     = 20;
+    serial->errors     = 0;
+    serial->rx_start   = 0;
+    serial->rx_end     = 0;
+    serial->rx_frame   = 0;
+
+    return BSMP_SUCCESS;
+}
+
+enum bsmp_err bsmp_serial_open (bsmp_serial_t *serial, const char *path,
+                                uint32_t baud, uint8_t address)
+{
+    if(!serial || !path)
+        return BSMP_ERR_PARAM_INVALID;
+
+    if(baud && baud_speed(baud) == B0)
+        return BSMP_ERR_PARAM_OUT_OF_RANGE;
+
+    int fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+
+    if(fd < 0)
+        return BSMP_ERR_IO;
+
+    enum bsmp_err err = bsmp_serial_attach(serial, fd, baud, address);
+
+    if(err)
+        close(fd);
+
+    return err;
+}
+
+void bsmp_serial_close (bsmp_serial_t *serial)
+{
+    if(serial && serial->fd >= 0)
+    {
+        close(serial->fd);
+        serial->fd = -1;
+    }
+}
+
+// Writes the regions of a frame, in a single call unless the line is busy
+static int write_frame (bsmp_serial_t *serial, struct iovec *iov, int iovcnt)
+{
+    while(iovcnt)
+    {
+        ssize_t ret = writev(serial->fd, iov, iovcnt);
+
+        if(ret < 0)
+        {
+            if(errno == EINTR)
+                continue;
+
+            struct pollfd pfd = {.fd = serial->fd, .events = POLLOUT};
+
+            if(errno != EAGAIN || poll(&pfd, 1, serial->timeout_ms) <= 0)
+                return -1;
+
+            continue;
+        }
+
+        while(iovcnt && (size_t) ret >= iov->iov_len)
+        {
+            ret -= iov->iov_len;
+            ++iov;
+            --iovcnt;
+        }
+
+        if(iovcnt)
+        {
+            iov->iov_base = (uint8_t*) iov->iov_base + ret;
+            iov->iov_len -= ret;
+        }
+    }
+
+    return 0;
+}
+
+// Address, regions of the message and checksum, in one write
+int bsmp_serial_send_to (bsmp_serial_t *serial, uint8_t address,
+                         struct bsmp_iov *msg, unsigned int count)
+{
+    struct iovec iov[BSMP_SERIAL_MAX_REGIONS + 2];
+    uint8_t sum = address;
+    unsigned int i;
+
+    if(count > BSMP_SERIAL_MAX_REGIONS)
+        return -1;
+
+    iov[0].iov_base = &address;
+    iov[0].iov_len  = 1;
+
+    for(i = 0; i < count; ++i)
+    {
+        iov[i + 1].iov_base = msg[i].base;
+        iov[i + 1].iov_len  = msg[i].len;
+        sum += sum_bytes(msg[i].base, msg[i].len);
+    }
+
+    uint8_t csum = -sum;
+    iov[count + 1].iov_base = &csum;
+    iov[count + 1].iov_len  = 1;
+
+    return write_frame(serial, iov, count + 2);
+}
+
+int bsmp_serial_send (bsmp_serial_t *serial, uint8_t *data, uint32_t len)
+{
+    struct bsmp_iov msg = {data, len};
+    return bsmp_serial_send_to(serial, serial->address, &msg, 1);
+}
+
+// Looks for a whole, valid frame at the start of the buffer. Garbage is
+// dropped a byte at a time, so that the next frame is found again.
+static bool parse_frame (bsmp_serial_t *serial)
+{
+    while(serial->rx_end - serial->rx_start >= FRAME_HEADER)
+    {
+        uint8_t *f = serial->rx + serial->rx_start;
+        uint32_t size = FRAME_HEADER + ((f[2] << 8) | f[3]) + 1;
+
+        if(serial->rx_end - serial->rx_start < size)
+            return false;
+
+        if(!sum_bytes(f, size))
+        {
+            serial->rx_frame = size;
+            return true;
+        }
+
+        ++serial->rx_start;
+        ++serial->errors;
+    }
+
+    return false;
+}
+
+// The line went quiet in the middle of a frame, which must have been garbage:
+// drop bytes until a whole frame is found in what's left
+static void resync (bsmp_serial_t *serial)
+{
+    while(serial->rx_start < serial->rx_end)
+    {
+        ++serial->rx_start;
+        ++serial->errors;
+
+        if(parse_frame(serial))
+            break;
+    }
+}
+
+static enum bsmp_err receive (bsmp_serial_t *serial, uint8_t *address,
+                              uint8_t **data, uint32_t *len)
+{
+    // The previous frame is done with
+    serial->rx_start += serial->rx_frame;
+    serial->rx_frame  = 0;
+
+    while(!parse_frame(serial))
+    {
+        // Make room for the rest of the frame
+        if(serial->rx_start && serial->rx_end == sizeof(serial->rx))
+        {
+            memmove(serial->rx, serial->rx + serial->rx_start,
+                    serial->rx_end - serial->rx_start);
+            serial->rx_end  -= serial->rx_start;
+            serial->rx_start = 0;
+        }
+        else if(serial->rx_start == serial->rx_end)
+            serial->rx_start = serial->rx_end = 0;
+
+        // As many bytes, and frames, as there are
+        ssize_t ret = read(serial->fd, serial->rx + serial->rx_end,
+                           sizeof(serial->rx) - serial->rx_end);
+
+        if(ret > 0)
+        {
+            serial->rx_end += ret;
+            continue;
+        }
+
+        if(!ret || (errno != EAGAIN && errno != EINTR))
+            return BSMP_ERR_COMM;
+
+        bool partial = serial->rx_end > serial->rx_start;
+
+        struct pollfd pfd = {.fd = serial->fd, .events = POLLIN};
+        int ready = poll(&pfd, 1, partial ? serial->gap_ms :
+                                            serial->timeout_ms);
+
+        if(!ready)
+        {
+            if(!partial)
+                return BSMP_ERR_TIMEOUT;
+
+            resync(serial);
+            continue;
+        }
+
+        if(ready < 0 && errno != EINTR)
+            return BSMP_ERR_COMM;
+    }
+
+    uint8_t *f = serial->rx + serial->rx_start;
+
+    if(address)
+        *address = f[0];
+
+    *data = f + 1;
+    *len  = serial->rx_frame - BSMP_SERIAL_WRAP_SIZE;
+
+    return BSMP_SUCCESS;
+}
+
+int bsmp_serial_recv (bsmp_serial_t *serial, uint8_t *address, uint8_t **data,
+                      uint32_t *len)
+{
+    return receive(serial, address, data, len) != BSMP_SUCCESS;
+}
+
+enum bsmp_err bsmp_serial_serve (bsmp_serial_t *serial, bsmp_server_t *server)
+{
+    if(!serial || !server)
+        return BSMP_ERR_PARAM_INVALID;
+
+    uint8_t address, *data;
+    uint32_t len;
+    enum bsmp_err err;
+
+    for(;;)
+    {
+        if((err = receive(serial, &address, &data, &len)))
+            return err;
+
+        if(len > UINT16_MAX)
+            continue;
+
+        if(address == serial->address)
+            break;
+
+        // Only writes and latches are broadcast, and they aren't answered
+        if(address == BSMP_SERIAL_BROADCAST && len &&
+           (data[0] == CMD_VAR_WRITE || data[0] == CMD_GROUP_WRITE ||
+            data[0] == CMD_GROUP_LATCH))
+            break;
+    }
+
+    // The answer is written in place, between its address and its checksum
+    struct bsmp_raw_packet request  = {data, len};
+    struct bsmp_raw_packet response = {serial->tx + 1, 0};
+
+    if(bsmp_process_packet(server, &request, &response))
+        return BSMP_ERR_COMM;
+
+    if(address == BSMP_SERIAL_BROADCAST)
+        return BSMP_SUCCESS;
+
+    serial->tx[0] = serial->address;
+    uint8_t sum = sum_bytes(serial->tx, response.len + 1);
+    serial->tx[response.len + 1] = -sum;
+
+    struct iovec iov = {serial->tx, response.len + BSMP_SERIAL_WRAP_SIZE};
+
+    return write_frame(serial, &iov, 1) ? BSMP_ERR_COMM : BSMP_SUCCESS;
+}
+
+// Transport
+
+static int transport_send (void *ctx, uint8_t *data, uint32_t len)
+{
+    return bsmp_serial_send(ctx, data, len);
+}
+
+static int transport_sendv (void *ctx, struct bsmp_iov *iov,
+                            unsigned int iovcnt)
+{
+    bsmp_serial_t *serial = ctx;
+    return bsmp_serial_send_to(serial, serial->address, iov, iovcnt);
+}
+
+static int transport_recv (void *ctx, uint8_t **data, uint32_t *len)
+{
+    return bsmp_serial_recv(ctx, NULL, data, len);
+}
+
+void bsmp_serial_transport (bsmp_serial_t *serial,
+                            struct bsmp_transport *transport)
+{
+    memset(transport, 0, sizeof(*transport));
+    transport->ctx     = serial;
+    transport->send    = transport_send;
+    transport->sendv   = transport_sendv;
+    transport->recv_zc = transport_recv;
+}
@@ -0,0 +1,392 @@
+#include "bsmp_priv.h"
+#include "../include/serial_bus.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <termios.h>
+
+static uint64_t now_us (void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+// Wait for the line to have been quiet long enough since the last frame
+static void turnaround (bsmp_bus_t *bus, uint64_t last)
+{
+    uint64_t until = last + bus->gap_us;
+
+    struct timespec ts = {
+        .tv_sec  = until/1000000,
+        .tv_nsec = until%1000000*1000
+    };
+
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL))
+        ;
+}
+
+static void stray (bsmp_bus_t *bus)
+{
+    pthread_mutex_lock(&bus->lock);
+    ++bus->stats.strays;
+    pthread_mutex_unlock(&bus->lock);
+}
+
+// Drop the frames from a device that timed out, until it's too late for them
+// to be the answer it still owed
+static void drain (bsmp_bus_t *bus, struct bsmp_bus_port *port)
+{
+    int timeout_ms = bus->serial->timeout_ms;
+    uint8_t address, *data;
+    uint32_t len;
+    uint64_t now;
+
+    while((now = now_us()) < port->stale_us)
+    {
+        bus->serial->timeout_ms = (port->stale_us - now + 999)/1000;
+        if(bsmp_serial_recv(bus->serial, &address, &data, &len))
+            break;
+
+        stray(bus);
+    }
+
+    bus->serial->timeout_ms = timeout_ms;
+    port->stale_us = 0;
+}
+
+// One transaction: the request out, then frames in until the device asked
+// answers. The others came late from devices already given up on.
+static int transact (bsmp_bus_t *bus, struct bsmp_bus_port *port)
+{
+    uint8_t address, *data;
+    uint32_t len;
+
+    if(port->stale_us)
+        drain(bus, port);
+
+    if(bsmp_serial_send_to(bus->serial, port->address, port->request,
+                           port->nregions))
+        return -1;
+
+    // Nothing comes back, the line is free once the frame is out
+    if(port->address == BSMP_SERIAL_BROADCAST)
+        return tcdrain(bus->serial->fd);
+
+    for(;;)
+    {
+        if(bsmp_serial_recv(bus->serial, &address, &data, &len))
+        {
+            if(bus->serial->timeout_ms >= 0)
+                port->stale_us = now_us() +
+                                 (uint64_t) bus->serial->timeout_ms*1000;
+
+            pthread_mutex_lock(&bus->lock);
+            ++bus->stats.timeouts;
+            pthread_mutex_unlock(&bus->lock);
+            return -1;
+        }
+
+        if(address == port->address)
+            break;
+
+        stray(bus);
+    }
+
+    if(len > BSMP_MAX_MESSAGE)
+        return -1;
+
+    memcpy(port->answer, data, len);
+    port->len = len;
+
+    return 0;
+}
+
+static void *bus_thread (void *arg)
+{
+    bsmp_bus_t *bus = arg;
+    uint64_t last = 0;
+
+    pthread_mutex_lock(&bus->lock);
+    for(;;)
+    {
+        while(!bus->count && !bus->quit)
+            pthread_cond_wait(&bus->work, &bus->lock);
+
+        if(!bus->count)
+            break;
+
+        struct bsmp_bus_port *port = bus->queue[bus->head];
+        bus->head = (bus->head + 1) % 256;
+        --bus->count;
+        pthread_mutex_unlock(&bus->lock);
+
+        turnaround(bus, last);
+
+        uint64_t start = now_us();
+        int err = transact(bus, port);
+        last = now_us();
+
+        pthread_mutex_lock(&bus->lock);
+        ++bus->stats.transactions;
+        bus->stats.busy_us += last - start;
+
+        port->err    = err;
+        port->queued = false;
+        pthread_cond_signal(&port->done);
+    }
+    pthread_mutex_unlock(&bus->lock);
+
+    return NULL;
+}
+
+// Transport of a port. Requests are only queued when the client waits for
+// their answer, which then goes straight to its buffer.
+
+static int port_sendv (void *ctx, struct bsmp_iov *iov, unsigned int iovcnt)
+{
+    struct bsmp_bus_port *port = ctx;
+
+    if(port->ready || iovcnt > 2)
+        return -1;
+
+    memcpy(port->request, iov, iovcnt*sizeof(*iov));
+    port->nregions = iovcnt;
+    port->ready    = true;
+
+    return 0;
+}
+
+static int port_send (void *ctx, uint8_t *data, uint32_t len)
+{
+    struct bsmp_iov iov = {data, len};
+    return port_sendv(ctx, &iov, 1);
+}
+
+// Queue the request of a port and wait until it's done
+static int submit (bsmp_bus_t *bus, struct bsmp_bus_port *port)
+{
+    pthread_mutex_lock(&bus->lock);
+
+    if(!bus->running || bus->quit)
+    {
+        pthread_mutex_unlock(&bus->lock);
+        return -1;
+    }
+
+    port->queued = true;
+    bus->queue[(bus->head + bus->count++) % 256] = port;
+    pthread_cond_signal(&bus->work);
+
+    while(port->queued)
+        pthread_cond_wait(&port->done, &bus->lock);
+
+    pthread_mutex_unlock(&bus->lock);
+
+    return port->err;
+}
+
+static int port_recv (void *ctx, uint8_t *data, uint32_t *len)
+{
+    struct bsmp_bus_port *port = ctx;
+
+    if(!port->ready)
+        return -1;
+
+    port->ready  = false;
+    port->answer = data;
+
+    if(submit(port->bus, port))
+        return -1;
+
+    *len = port->len;
+    return 0;
+}
+
+// Send a write of id to every device, the value from the caller's buffer
+static enum bsmp_err broadcast (bsmp_bus_t *bus, uint8_t code, uint8_t id,
+                                uint8_t *value, uint16_t size)
+{
+    struct bsmp_bus_port *port = &bus->ports[BSMP_SERIAL_BROADCAST];
+    uint16_t payload_size = size + 1;
+    uint8_t header[BSMP_HEADER_SIZE + 1] = {
+        code, payload_size >> 8, payload_size, id
+    };
+
+    pthread_mutex_lock(&bus->bcast);
+
+    port->request[0].base = header;
+    port->request[0].len  = sizeof(header);
+    port->request[1].base = value;
+    port->request[1].len  = size;
+    port->nregions        = size ? 2 : 1;
+
+    int err = submit(bus, port);
+
+    pthread_mutex_unlock(&bus->bcast);
+
+    return err ? BSMP_ERR_COMM : BSMP_SUCCESS;
+}
+
+enum bsmp_err bsmp_bus_write_var_all (bsmp_bus_t *bus,
+                                      struct bsmp_var_info *var,
+                                      uint8_t *value)
+{
+    if(!bus || !var || !value || !var->writable)
+        return BSMP_ERR_PARAM_INVALID;
+
+    return broadcast(bus, CMD_VAR_WRITE, var->id, value, var->size);
+}
+
+enum bsmp_err bsmp_bus_write_group_all (bsmp_bus_t *bus,
+                                        struct bsmp_group *grp,
+                                        uint8_t *values)
+{
+    if(!bus || !grp || !values || !grp->writable)
+        return BSMP_ERR_PARAM_INVALID;
+
+    return broadcast(bus, CMD_GROUP_WRITE, grp->id, values, grp->size);
+}
+
+enum bsmp_err bsmp_bus_latch_group_all (bsmp_bus_t *bus,
+                                        struct bsmp_group *grp)
+{
+    if(!bus || !grp)
+        return BSMP_ERR_PARAM_INVALID;
+
+    return broadcast(bus, CMD_GROUP_LATCH, grp->id, NULL, 0);
+}
+
+enum bsmp_err bsmp_bus_sweep_var (bsmp_client_t **clients, unsigned int count,
+                                  struct bsmp_var_info *var, uint8_t *value,
+                                  bool *ok)
+{
+    if(!clients || !var || !value)
+        return BSMP_ERR_PARAM_INVALID;
+
+    enum bsmp_err err = BSMP_SUCCESS;
+    uint8_t read[BSMP_VAR_MAX_SIZE];
+    unsigned int i;
+
+    for(i = 0; i < count; ++i)
+    {
+        bsmp_client_t *client = clients[i];
+        bool same = false;
+
+        // Its own description of the variable
+        if(var->id < client->vars.count &&
+           client->vars.list[var->id].size == var->size)
+            same = !bsmp_read_var(client, &client->vars.list[var->id], read) &&
+                   !memcmp(read, value, var->size);
+
+        if(!same)
+            err = BSMP_ERR_COMM;
+
+        if(ok)
+            ok[i] = same;
+    }
+
+    return err;
+}
+
+enum bsmp_err bsmp_bus_init (bsmp_bus_t *bus, bsmp_serial_t *serial,
+                             uint32_t gap_us)
+{
+    if(!bus || !serial)
+        return BSMP_ERR_PARAM_INVALID;
+
+    memset(bus, 0, sizeof(*bus));
+    bus->serial = serial;
+    bus->gap_us = gap_us;
+
+    unsigned int i;
+    for(i = 0; i < 256; ++i)
+    {
+        bus->ports[i].bus     = bus;
+        bus->ports[i].address = i;
+        pthread_cond_init(&bus->ports[i].done, NULL);
+    }
+
+    pthread_mutex_init(&bus->lock, NULL);
+    pthread_mutex_init(&bus->bcast, NULL);
+    pthread_cond_init(&bus->work, NULL);
+
+    return BSMP_SUCCESS;
+}
+
+void bsmp_bus_transport (bsmp_bus_t *bus, uint8_t address,
+                         struct bsmp_transport *transport)
+{
+    memset(transport, 0, sizeof(*transport));
+    transport->ctx   = &bus->ports[address];
+    transport->send  = port_send;
+    transport->sendv = port_sendv;
+    transport->recv  = port_recv;
+}
+
+enum bsmp_err bsmp_bus_start (bsmp_bus_t *bus)
+{
+    if(!bus || bus->running)
+        return BSMP_ERR_PARAM_INVALID;
+
+    bus->quit    = false;
+    bus->head    = 0;
+    bus->count   = 0;
+    bus->started = now_us();
+    memset(&bus->stats, 0, sizeof(bus->stats));
+
+    if(pthread_create(&bus->thread, NULL, bus_thread, bus))
+        return BSMP_ERR_OUT_OF_MEMORY;
+
+    pthread_mutex_lock(&bus->lock);
+    bus->running = true;
+    pthread_mutex_unlock(&bus->lock);
+
+    return BSMP_SUCCESS;
+}
+
+enum bsmp_err bsmp_bus_stop (bsmp_bus_t *bus)
+{
+    if(!bus || !bus->running)
+        return BSMP_ERR_PARAM_INVALID;
+
+    pthread_mutex_lock(&bus->lock);
+    bus->quit = true;
+    pthread_cond_signal(&bus->work);
+    pthread_mutex_unlock(&bus->lock);
+
+    pthread_join(bus->thread, NULL);
+
+    pthread_mutex_lock(&bus->lock);
+    bus->running = false;
+    bus->stats.elapsed_us = now_us() - bus->started;
+    pthread_mutex_unlock(&bus->lock);
+
+    return BSMP_SUCCESS;
+}
+
+void bsmp_bus_stats (bsmp_bus_t *bus, struct bsmp_bus_stats *stats)
+{
+    pthread_mutex_lock(&bus->lock);
+    *stats = bus->stats;
+    if(bus->running)
+        stats->elapsed_us = now_us() - bus->started;
+    pthread_mutex_unlock(&bus->lock);
+}
+
+void bsmp_bus_destroy (bsmp_bus_t *bus)
+{
+    if(!bus)
+        return;
+
+    unsigned int i;
+    for(i = 0; i < 256; ++i)
+        pthread_cond_destroy(&bus->ports[i].done);
+
+    pthread_mutex_destroy(&bus->lock);
+    pthread_mutex_destroy(&bus->bcast);
+    pthread_cond_destroy(&bus->work);
+}
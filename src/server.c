@@ -6,6 +6,11 @@
 #include <string.h>
 #include <stdbool.h>
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <time.h>
+#include <unistd.h>
+#endif
+
 enum bsmp_err bsmp_server_init (struct bsmp_server *server)
 {
     if(!server)
@@ -19,6 +24,13 @@ enum bsmp_err bsmp_server_init (struct bsmp_server *server)
 
     server->groups.count = GROUP_STANDARD_COUNT;
 
+#if defined(__unix__) || defined(__APPLE__)
+    // Different for each run, even two started in the same second
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    server->epoch = ts.tv_sec ^ ts.tv_nsec ^ ((uint32_t) getpid() << 16);
+#endif
+
     return BSMP_SUCCESS;
 }
 
@@ -41,6 +53,9 @@ enum bsmp_err bsmp_register_variable (bsmp_server_t *server,
 {
     SERVER_REGISTER(var, BSMP_MAX_VARIABLES);
 
+    // Newly registered variables are news to every client
+    var_changed(server, var);
+
     // Add to the group containing all variables
     group_add_var(&server->groups.list[GROUP_ALL_ID], var);
 
@@ -77,6 +92,47 @@ enum bsmp_err bsmp_register_hook(bsmp_server_t* server, bsmp_hook_t hook)
     return BSMP_SUCCESS;
 }
 
+enum bsmp_err bsmp_register_delta_memory (bsmp_server_t *server, uint8_t *mem,
+                                          uint32_t size)
+{
+    if(!server || !mem)
+        return BSMP_ERR_PARAM_INVALID;
+
+    server->delta_mem      = mem;
+    server->delta_mem_size = size;
+    server->delta_mem_used = 0;
+    memset(server->deltas, 0, sizeof(server->deltas));
+
+    return BSMP_SUCCESS;
+}
+
+enum bsmp_err bsmp_register_latch_memory (bsmp_server_t *server, uint8_t *mem,
+                                          uint32_t size)
+{
+    if(!server || !mem)
+        return BSMP_ERR_PARAM_INVALID;
+
+    server->latch_mem      = mem;
+    server->latch_mem_size = size;
+    server->latched        = NULL;
+
+    return BSMP_SUCCESS;
+}
+
+enum bsmp_err bsmp_var_changed (bsmp_server_t *server, struct bsmp_var *var)
+{
+    if(!server || !var)
+        return BSMP_ERR_PARAM_INVALID;
+
+    if(var->info.id >= server->vars.count ||
+       server->vars.list[var->info.id] != var)
+        return BSMP_ERR_PARAM_INVALID;
+
+    var_changed(server, var);
+
+    return BSMP_SUCCESS;
+}
+
 enum bsmp_err bsmp_register_md5(bsmp_server_t *server, bsmp_custom_md5_t md5)
 {
     if(!server || !md5)
@@ -97,6 +153,7 @@ struct raw_message
 static command_function_t command[256] =
 {
     [CMD_QUERY_VERSION]         = query_version,
+    [CMD_SCHEMA_QUERY]          = schema_query,
 
     // Variable's functions
     [CMD_VAR_QUERY_LIST]        = var_query_list,
@@ -109,10 +166,14 @@ static command_function_t command[256] =
     [CMD_GROUP_QUERY_LIST]      = group_query_list,
     [CMD_GROUP_QUERY]           = group_query,
     [CMD_GROUP_READ]            = group_read,
+    [CMD_GROUP_READ_CHANGED]    = group_read_changed,
+    [CMD_GROUP_READ_DELTA]      = group_read_delta,
     [CMD_GROUP_WRITE]           = group_write,
     [CMD_GROUP_BIN_OP]          = group_bin_op,
+    [CMD_GROUP_BIN_OP_BCAST]    = group_bin_op_bcast,
     [CMD_GROUP_CREATE]          = group_create,
     [CMD_GROUP_REMOVE_ALL]      = group_remove_all,
+    [CMD_GROUP_LATCH]           = group_latch,
 
     // Curve's functions
     [CMD_CURVE_QUERY_LIST]      = curve_query_list,
@@ -120,31 +181,30 @@ static command_function_t command[256] =
     [CMD_CURVE_BLOCK_REQUEST]   = curve_block_request,
     [CMD_CURVE_BLOCK]           = curve_block,
     [CMD_CURVE_RECALC_CSUM]     = curve_recalc_csum,
+    [CMD_CURVE_BLOCK_REQUEST_LZ] = curve_block_request_lz,
+    [CMD_CURVE_BLOCK_LZ]        = curve_block_lz,
 
     // Function's functions
     [CMD_FUNC_QUERY_LIST]       = func_query_list,
     [CMD_FUNC_EXECUTE]          = func_execute
 };
 
-enum bsmp_err bsmp_process_packet (bsmp_server_t *server,
-                                    struct bsmp_raw_packet *request,
-                                    struct bsmp_raw_packet *response)
+static void process (bsmp_server_t *server, struct bsmp_raw_packet *request,
+                     struct bsmp_raw_packet *response, struct message *send_msg)
 {
-    if(!server || !request || !response)
-        return BSMP_ERR_PARAM_INVALID;
-
     // Interpret packet payload as a message
     struct raw_message *recv_raw_msg = (struct raw_message *) request->data;
     struct raw_message *send_raw_msg = (struct raw_message *) response->data;
 
-    // Create proper messages from the raw messages
-    struct message recv_msg, send_msg;
+    // Create a proper message from the raw message
+    struct message recv_msg;
 
     recv_msg.command_code = (enum command_code) recv_raw_msg->command_code;
     recv_msg.payload      = recv_raw_msg->payload;
     recv_msg.payload_size = (recv_raw_msg->size[0] << 8)+recv_raw_msg->size[1];
 
-    send_msg.payload = send_raw_msg->payload;
+    send_msg->payload = send_raw_msg->payload;
+    send_msg->pending = response->data;
 
     server->modified_list[0] = NULL;
 
@@ -152,19 +212,64 @@ enum bsmp_err bsmp_process_packet (bsmp_server_t *server,
     // specified in the message header
     if(request->len < BSMP_HEADER_SIZE ||
        request->len != recv_msg.payload_size + BSMP_HEADER_SIZE)
-        MESSAGE_SET_ANSWER(&send_msg, CMD_ERR_MALFORMED_MESSAGE);
+        MESSAGE_SET_ANSWER(send_msg, CMD_ERR_MALFORMED_MESSAGE);
     // Check existence of the requested command
     else if(!command[recv_msg.command_code])
-        MESSAGE_SET_ANSWER(&send_msg, CMD_ERR_OP_NOT_SUPPORTED);
+        MESSAGE_SET_ANSWER(send_msg, CMD_ERR_OP_NOT_SUPPORTED);
     else
-        command[recv_msg.command_code](server, &recv_msg, &send_msg);
+        command[recv_msg.command_code](server, &recv_msg, send_msg);
+
+    send_raw_msg->command_code = send_msg->command_code;
+
+    send_raw_msg->size[0] = send_msg->payload_size >> 8;
+    send_raw_msg->size[1] = send_msg->payload_size;
+
+    response->len = send_msg->payload_size + BSMP_HEADER_SIZE;
+}
+
+enum bsmp_err bsmp_process_packet (bsmp_server_t *server,
+                                    struct bsmp_raw_packet *request,
+                                    struct bsmp_raw_packet *response)
+{
+    if(!server || !request || !response)
+        return BSMP_ERR_PARAM_INVALID;
+
+    struct message send_msg = {.iov = NULL};
+
+    process(server, request, response, &send_msg);
+
+    return BSMP_SUCCESS;
+}
+
+enum bsmp_err bsmp_process_packet_iov (bsmp_server_t *server,
+                                       struct bsmp_raw_packet *request,
+                                       struct bsmp_raw_packet *response,
+                                       struct bsmp_iov *iov,
+                                       unsigned int *iovcnt)
+{
+    if(!server || !request || !response || !iov || !iovcnt)
+        return BSMP_ERR_PARAM_INVALID;
+
+    if(!*iovcnt)
+        return BSMP_ERR_PARAM_OUT_OF_RANGE;
+
+    struct message send_msg = {
+        .iov    = iov,
+        .iovmax = *iovcnt
+    };
+
+    process(server, request, response, &send_msg);
 
-    send_raw_msg->command_code = send_msg.command_code;
+    // Whatever was written after the last borrowed region
+    uint8_t *end = send_msg.payload + send_msg.payload_size;
 
-    send_raw_msg->size[0] = send_msg.payload_size >> 8;
-    send_raw_msg->size[1] = send_msg.payload_size;
+    if(end > send_msg.pending)
+    {
+        iov[send_msg.iovcnt].base  = send_msg.pending;
+        iov[send_msg.iovcnt++].len = end - send_msg.pending;
+    }
 
-    response->len = send_msg.payload_size + BSMP_HEADER_SIZE;
+    *iovcnt = send_msg.iovcnt;
 
     return BSMP_SUCCESS;
 }
@@ -34,7 +34,7 @@ enum bsmp_err curve_check(struct bsmp_curve *curve)
     if(curve->info.block_size > BSMP_CURVE_BLOCK_MAX_SIZE)
         return BSMP_ERR_PARAM_INVALID;
 
-    if(!curve->read_block)
+    if(!curve->read_block && !curve->get_block_ptr)
         return BSMP_ERR_PARAM_INVALID;
 
     if(curve->info.writable && !curve->write_block)
@@ -60,6 +60,66 @@ enum bsmp_err func_check(struct bsmp_func *func)
     return BSMP_SUCCESS;
 }
 
+/* Helper Message functions */
+
+// Put len bytes of data at the position 'at' of the payload of msg. If the
+// answer is scatter/gather and there is room left in its iov, the data is
+// referenced instead of copied. Data adjacent to the previously referenced
+// region extends it.
+//
+// Returns the position right after the data.
+uint8_t *message_borrow (struct message *msg, uint8_t *at, uint8_t *data,
+                         uint16_t len)
+{
+    if(!msg->iov)
+    {
+        memcpy(at, data, len);
+        return at + len;
+    }
+
+    bool gap = at > msg->pending;
+
+    // Nothing was copied since the last region and data continues it
+    if(!gap && msg->iovcnt)
+    {
+        struct bsmp_iov *last = &msg->iov[msg->iovcnt - 1];
+
+        if((uint8_t *) last->base + last->len == data)
+        {
+            last->len   += len;
+            msg->pending = at + len;
+            return at + len;
+        }
+    }
+
+    // Room for the data copied so far, the borrowed data and the trailing data
+    if(msg->iovcnt + gap + 2 > msg->iovmax)
+    {
+        memcpy(at, data, len);
+        return at + len;
+    }
+
+    if(gap)
+    {
+        msg->iov[msg->iovcnt].base  = msg->pending;
+        msg->iov[msg->iovcnt++].len = at - msg->pending;
+    }
+
+    msg->iov[msg->iovcnt].base  = data;
+    msg->iov[msg->iovcnt++].len = len;
+
+    // Skip the hole left in the payload
+    msg->pending = at + len;
+    return at + len;
+}
+
+/* Helper Variable functions */
+
+void var_changed (bsmp_server_t *server, struct bsmp_var *var)
+{
+    server->vars_generation[var->info.id] = ++server->generation;
+}
+
 /* Helper Group functions */
 
 void group_init (struct bsmp_group *grp, uint8_t id)
@@ -105,6 +165,102 @@ SERVER_CMD_FUNCTION (query_version)
     send_msg->payload[2] = REVISION;
 }
 
+/* Schema */
+
+// Hash the schema image without building it (see bsmp_priv.h)
+static uint64_t schema_fingerprint (bsmp_server_t *server)
+{
+    uint64_t hash = SCHEMA_HASH_INIT;
+    uint8_t  b[BSMP_CURVE_LIST_INFO];
+    unsigned int i, j;
+
+    b[0] = server->vars.count;
+    hash = schema_hash(hash, b, 1);
+
+    for(i = 0; i < server->vars.count; ++i)
+    {
+        struct bsmp_var_info *var = &server->vars.list[i]->info;
+
+        b[0] = (var->size & SIZE_MASK) | (var->writable ? WRITABLE : READ_ONLY);
+        hash = schema_hash(hash, b, 1);
+    }
+
+    b[0] = server->groups.count;
+    hash = schema_hash(hash, b, 1);
+
+    for(i = 0; i < server->groups.count; ++i)
+    {
+        struct bsmp_group *grp = &server->groups.list[i];
+
+        b[0] = (grp->writable ? WRITABLE : READ_ONLY) + grp->vars.count;
+        hash = schema_hash(hash, b, 1);
+    }
+
+    for(i = 0; i < server->groups.count; ++i)
+    {
+        struct bsmp_group *grp = &server->groups.list[i];
+
+        for(j = 0; j < grp->vars.count; ++j)
+        {
+            b[0] = grp->vars.list[j]->id;
+            hash = schema_hash(hash, b, 1);
+        }
+    }
+
+    b[0] = server->curves.count;
+    hash = schema_hash(hash, b, 1);
+
+    for(i = 0; i < server->curves.count; ++i)
+    {
+        struct bsmp_curve_info *curve = &server->curves.list[i]->info;
+
+        b[0] = curve->writable;
+        b[1] = curve->block_size >> 8;
+        b[2] = curve->block_size;
+        b[3] = curve->nblocks >> 8;
+        b[4] = curve->nblocks;
+        hash = schema_hash(hash, b, BSMP_CURVE_LIST_INFO);
+    }
+
+    for(i = 0; i < server->curves.count; ++i)
+        hash = schema_hash(hash, server->curves.list[i]->info.checksum,
+                           BSMP_CURVE_CSUM_SIZE);
+
+    b[0] = server->funcs.count;
+    hash = schema_hash(hash, b, 1);
+
+    for(i = 0; i < server->funcs.count; ++i)
+    {
+        struct bsmp_func_info *func = &server->funcs.list[i]->info;
+
+        b[0] = (func->input_size << 4) | (func->output_size & 0x0F);
+        hash = schema_hash(hash, b, 1);
+    }
+
+    return hash;
+}
+
+SERVER_CMD_FUNCTION (schema_query)
+{
+    // Payload must be zero
+    if(recv_msg->payload_size != 0)
+        MESSAGE_SET_ANSWER_RET(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
+
+    MESSAGE_SET_ANSWER(send_msg, CMD_SCHEMA);
+
+    send_msg->payload[0] = VERSION;
+    send_msg->payload[1] = SUBVERSION;
+    send_msg->payload[2] = REVISION;
+
+    uint64_t hash = schema_fingerprint(server);
+
+    unsigned int i;
+    for(i = 0; i < 8; ++i)
+        send_msg->payload[3 + i] = hash >> (56 - 8*i);
+
+    send_msg->payload_size = SCHEMA_ANSWER_SIZE;
+}
+
 /* Variables */
 
 SERVER_CMD_FUNCTION (var_query_list)
@@ -155,7 +311,7 @@ SERVER_CMD_FUNCTION (var_read)
     // Set answer
     MESSAGE_SET_ANSWER(send_msg, CMD_VAR_VALUE);
     send_msg->payload_size = var->info.size;
-    memcpy(send_msg->payload, var->data, var->info.size);
+    message_borrow(send_msg, send_msg->payload, var->data, var->info.size);
 }
 
 SERVER_CMD_FUNCTION (var_write)
@@ -187,6 +343,7 @@ SERVER_CMD_FUNCTION (var_write)
 
     // Everything is OK, perform operation
     memcpy(var->data, recv_msg->payload + 1, var->info.size);
+    var_changed(server, var);
 
     // Call hook
     if(server->hook)
@@ -231,6 +388,7 @@ SERVER_CMD_FUNCTION (var_write_read)
 
     // Everything is OK, perform WRITE operation
     memcpy(var_wr->data, recv_msg->payload + 2, var_wr->info.size);
+    var_changed(server, var_wr);
 
     // Call hooks
     if(server->hook)
@@ -247,7 +405,8 @@ SERVER_CMD_FUNCTION (var_write_read)
     // Now perform READ operation
     MESSAGE_SET_ANSWER(send_msg, CMD_VAR_VALUE);
     send_msg->payload_size = var_rd->info.size;
-    memcpy(send_msg->payload, var_rd->data, var_rd->info.size);
+    message_borrow(send_msg, send_msg->payload, var_rd->data,
+                   var_rd->info.size);
 }
 
 SERVER_CMD_FUNCTION (var_bin_op)
@@ -269,7 +428,7 @@ SERVER_CMD_FUNCTION (var_bin_op)
     unsigned char operation = recv_msg->payload[1];
 
     // Check operation
-    if(!bin_op[operation])
+    if(!bin_op_wide[operation])
         MESSAGE_SET_ANSWER_RET(send_msg, CMD_ERR_OP_NOT_SUPPORTED);
 
     // Check payload size
@@ -281,7 +440,8 @@ SERVER_CMD_FUNCTION (var_bin_op)
         MESSAGE_SET_ANSWER_RET(send_msg, CMD_ERR_READ_ONLY);
 
     // Everything is OK, perform operation
-    bin_op[operation](var->data, recv_msg->payload + 2, var->info.size);
+    bin_op_wide[operation](var->data, recv_msg->payload + 2, var->info.size);
+    var_changed(server, var);
 
     // Call hook
     if(server->hook)
@@ -358,6 +518,16 @@ SERVER_CMD_FUNCTION (group_read)
     // Get desired group
     struct bsmp_group *grp = &server->groups.list[group_id];
 
+    // Values of the latch, as they were when it was taken
+    if(grp == server->latched)
+    {
+        MESSAGE_SET_ANSWER(send_msg, CMD_GROUP_VALUES);
+        message_borrow(send_msg, send_msg->payload, server->latch_mem,
+                       grp->size);
+        send_msg->payload_size = grp->size;
+        return;
+    }
+
     // Call hook
     if(server->hook)
     {
@@ -374,12 +544,225 @@ SERVER_CMD_FUNCTION (group_read)
     for(i = 0; i < grp->vars.count; ++i)
     {
         var = server->vars.list[grp->vars.list[i]->id];
-        memcpy(payloadp, var->data, var->info.size);
-        payloadp += var->info.size;
+        payloadp = message_borrow(send_msg, payloadp, var->data,
+                                  var->info.size);
     }
     send_msg->payload_size = grp->size;
 }
 
+SERVER_CMD_FUNCTION (group_read_changed)
+{
+    // Payload size must be 1 (ID) plus the generation of the client
+    if(recv_msg->payload_size != 1 + GENERATION_SIZE)
+        MESSAGE_SET_ANSWER_RET(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
+
+    uint8_t *payloadp = send_msg->payload;
+
+    // Check group ID
+    uint8_t group_id = recv_msg->payload[0];
+
+    if(group_id >= server->groups.count)
+        MESSAGE_SET_ANSWER_RET(send_msg, CMD_ERR_INVALID_ID);
+
+    // Get desired group
+    struct bsmp_group *grp = &server->groups.list[group_id];
+
+    uint32_t since = ((uint32_t)recv_msg->payload[1] << 24) +
+                     (recv_msg->payload[2] << 16) +
+                     (recv_msg->payload[3] << 8)  +
+                      recv_msg->payload[4];
+
+    // Epoch and generation first, then ID and value of each changed variable
+    MESSAGE_SET_ANSWER(send_msg, CMD_GROUP_CHANGED);
+
+    *(payloadp++) = server->epoch >> 24;
+    *(payloadp++) = server->epoch >> 16;
+    *(payloadp++) = server->epoch >> 8;
+    *(payloadp++) = server->epoch;
+
+    struct bsmp_var *var;
+    unsigned int i;
+
+    // The snapshot, whole, as of the generation it was taken at. Changes
+    // after it are sent once the latch is released.
+    if(grp == server->latched)
+    {
+        uint32_t gen = server->latch_generation;
+        uint8_t *latchp = server->latch_mem;
+
+        *(payloadp++) = gen >> 24;
+        *(payloadp++) = gen >> 16;
+        *(payloadp++) = gen >> 8;
+        *(payloadp++) = gen;
+
+        for(i = 0; i < grp->vars.count; ++i)
+        {
+            var = server->vars.list[grp->vars.list[i]->id];
+            *(payloadp++) = var->info.id;
+            payloadp = message_borrow(send_msg, payloadp, latchp,
+                                      var->info.size);
+            latchp += var->info.size;
+        }
+        send_msg->payload_size = payloadp - send_msg->payload;
+        return;
+    }
+
+    // Call hook. It might change (and bump) some variables.
+    if(server->hook)
+    {
+        group_to_mod_list(server, grp);
+        server->hook(BSMP_OP_READ, server->modified_list);
+    }
+
+    *(payloadp++) = server->generation >> 24;
+    *(payloadp++) = server->generation >> 16;
+    *(payloadp++) = server->generation >> 8;
+    *(payloadp++) = server->generation;
+
+    for(i = 0; i < grp->vars.count; ++i)
+    {
+        var = server->vars.list[grp->vars.list[i]->id];
+
+        if(server->vars_generation[var->info.id] <= since)
+            continue;
+
+        *(payloadp++) = var->info.id;
+        payloadp = message_borrow(send_msg, payloadp, var->data,
+                                  var->info.size);
+    }
+    send_msg->payload_size = payloadp - send_msg->payload;
+}
+
+SERVER_CMD_FUNCTION (group_read_delta)
+{
+    // Payload size must be 1 (ID) plus the sequence number of the client
+    if(recv_msg->payload_size != 1 + DELTA_SEQ_SIZE)
+        MESSAGE_SET_ANSWER_RET(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
+
+    // No memory to remember what was sent
+    if(!server->delta_mem)
+        MESSAGE_SET_ANSWER_RET(send_msg, CMD_ERR_OP_NOT_SUPPORTED);
+
+    // Check group ID
+    uint8_t group_id = recv_msg->payload[0];
+
+    if(group_id >= server->groups.count)
+        MESSAGE_SET_ANSWER_RET(send_msg, CMD_ERR_INVALID_ID);
+
+    // Get desired group
+    struct bsmp_group *grp = &server->groups.list[group_id];
+    struct bsmp_group_delta *delta = &server->deltas[group_id];
+    struct bsmp_delta_session *session = NULL, *s;
+
+    uint16_t seq = (recv_msg->payload[1] << 8) + recv_msg->payload[2];
+
+    // The session of the client, by the last sequence number it got
+    for(s = delta->sessions; seq && s < delta->sessions + BSMP_DELTA_SESSIONS;
+        ++s)
+        if(s->shadow && s->seq == seq)
+            session = s;
+
+    // A client without one gets everything, in a free session or in the least
+    // recently served
+    bool full = !session;
+
+    if(!session)
+    {
+        session = delta->sessions;
+        for(s = delta->sessions; s < delta->sessions + BSMP_DELTA_SESSIONS;
+            ++s)
+            if(!s->shadow || (session->shadow && s->used < session->used))
+                session = s;
+    }
+
+    // The group has grown since the shadow was allocated
+    if(session->capacity < grp->size)
+    {
+        uint8_t *end = server->delta_mem + server->delta_mem_used;
+        uint32_t room = server->delta_mem_size - server->delta_mem_used;
+
+        // Grow the last shadow allocated in place, take a new one otherwise
+        if(session->shadow && session->shadow + session->capacity == end)
+        {
+            if(room < (uint32_t) grp->size - session->capacity)
+                MESSAGE_SET_ANSWER_RET(send_msg, CMD_ERR_INSUFFICIENT_MEMORY);
+
+            server->delta_mem_used += grp->size - session->capacity;
+        }
+        else
+        {
+            if(room < grp->size)
+                MESSAGE_SET_ANSWER_RET(send_msg, CMD_ERR_INSUFFICIENT_MEMORY);
+
+            session->shadow = end;
+            server->delta_mem_used += grp->size;
+        }
+        session->capacity = grp->size;
+    }
+
+    if(session->size != grp->size)
+    {
+        session->size = grp->size;
+        full = true;
+    }
+
+    // Values of the latch, as they were when it was taken, if latched
+    uint8_t *latchp = grp == server->latched ? server->latch_mem : NULL;
+
+    // Call hook
+    if(!latchp && server->hook)
+    {
+        group_to_mod_list(server, grp);
+        server->hook(BSMP_OP_READ, server->modified_list);
+    }
+
+    // Sequence number 0 is reserved for clients without a previous delta.
+    // Once numbers wrap around, a stale session mustn't be mistaken for this
+    // one.
+    if(!++delta->seq)
+        ++delta->seq;
+
+    for(s = delta->sessions; s < delta->sessions + BSMP_DELTA_SESSIONS; ++s)
+        if(s->seq == delta->seq)
+            s->seq = 0;
+
+    session->seq  = delta->seq;
+    session->used = ++delta->clock;
+
+    // Sequence number, bitmap of changed variables and their values
+    MESSAGE_SET_ANSWER(send_msg, CMD_GROUP_DELTA);
+
+    uint8_t *bitmap   = send_msg->payload + DELTA_SEQ_SIZE;
+    uint8_t *payloadp = bitmap + DELTA_BITMAP_SIZE(grp->vars.count);
+    uint8_t *shadowp  = session->shadow;
+
+    send_msg->payload[0] = session->seq >> 8;
+    send_msg->payload[1] = session->seq;
+    memset(bitmap, 0, DELTA_BITMAP_SIZE(grp->vars.count));
+
+    struct bsmp_var *var;
+    unsigned int i;
+    for(i = 0; i < grp->vars.count; ++i)
+    {
+        var = server->vars.list[grp->vars.list[i]->id];
+
+        uint8_t *value = latchp ? latchp : var->data;
+
+        if(full || memcmp(shadowp, value, var->info.size))
+        {
+            memcpy(shadowp, value, var->info.size);
+            bitmap[i/8] |= 1 << (i % 8);
+            payloadp = message_borrow(send_msg, payloadp, shadowp,
+                                      var->info.size);
+        }
+        shadowp += var->info.size;
+
+        if(latchp)
+            latchp += var->info.size;
+    }
+    send_msg->payload_size = payloadp - send_msg->payload;
+}
+
 SERVER_CMD_FUNCTION (group_write)
 {
     // Check if body has at least 2 bytes (ID + 1 byte of data)
@@ -417,7 +800,10 @@ SERVER_CMD_FUNCTION (group_write)
         if(var->value_ok && !var->value_ok(var, payloadp))
             check_failed = true;
         else
+        {
             memcpy(var->data, payloadp, var->info.size);
+            var_changed(server, var);
+        }
         payloadp += var->info.size;
     }
 
@@ -450,7 +836,7 @@ SERVER_CMD_FUNCTION (group_bin_op)
     unsigned char operation = recv_msg->payload[1];
 
     // Check operation
-    if(!bin_op[operation])
+    if(!bin_op_wide[operation])
         MESSAGE_SET_ANSWER_RET(send_msg, CMD_ERR_OP_NOT_SUPPORTED);
 
     // Check payload size
@@ -461,18 +847,91 @@ SERVER_CMD_FUNCTION (group_bin_op)
     if(!grp->writable)
         MESSAGE_SET_ANSWER_RET(send_msg, CMD_ERR_READ_ONLY);
 
-    // Everything is OK, iterate
+    // Everything is OK, iterate. Variables whose values are contiguous in
+    // memory are operated on in a single run. The mask is contiguous anyway.
     struct bsmp_var *var;
     uint8_t *payloadp = recv_msg->payload + 2;
+    uint8_t *run = NULL, *run_mask = NULL;
+    uint16_t run_size = 0;
 
     unsigned int i;
     for(i = 0; i < grp->vars.count; ++i)
     {
         var = server->vars.list[grp->vars.list[i]->id];
-        bin_op[operation](var->data, payloadp, var->info.size);
+        var_changed(server, var);
+
+        if(run && run + run_size == var->data)
+            run_size += var->info.size;
+        else
+        {
+            if(run)
+                bin_op_wide[operation](run, run_mask, run_size);
+
+            run      = var->data;
+            run_mask = payloadp;
+            run_size = var->info.size;
+        }
         payloadp += var->info.size;
     }
 
+    if(run)
+        bin_op_wide[operation](run, run_mask, run_size);
+
+    // Call hook
+    if(server->hook)
+    {
+        group_to_mod_list(server, grp);
+        server->hook(BSMP_OP_WRITE, server->modified_list);
+    }
+
+    MESSAGE_SET_ANSWER(send_msg, CMD_OK);
+}
+
+SERVER_CMD_FUNCTION (group_bin_op_bcast)
+{
+    // Check if body has at least 3 bytes (ID + binary operation + 1 mask byte)
+    if(recv_msg->payload_size < 3)
+        MESSAGE_SET_ANSWER_RET(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
+
+    // Check ID
+    uint8_t group_id = recv_msg->payload[0];
+
+    if(group_id >= server->groups.count)
+        MESSAGE_SET_ANSWER_RET(send_msg, CMD_ERR_INVALID_ID);
+
+    // Get desired group
+    struct bsmp_group *grp = &server->groups.list[group_id];
+
+    // Get operation
+    unsigned char operation = recv_msg->payload[1];
+
+    // Check operation
+    if(!bin_op_wide[operation])
+        MESSAGE_SET_ANSWER_RET(send_msg, CMD_ERR_OP_NOT_SUPPORTED);
+
+    // The mask is applied to every variable: all of them must be its size
+    uint16_t mask_size = recv_msg->payload_size - 2;
+    unsigned int i;
+
+    for(i = 0; i < grp->vars.count; ++i)
+        if(grp->vars.list[i]->size != mask_size)
+            MESSAGE_SET_ANSWER_RET(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
+
+    // Check write permission
+    if(!grp->writable)
+        MESSAGE_SET_ANSWER_RET(send_msg, CMD_ERR_READ_ONLY);
+
+    // Everything is OK, iterate
+    struct bsmp_var *var;
+    uint8_t *mask = recv_msg->payload + 2;
+
+    for(i = 0; i < grp->vars.count; ++i)
+    {
+        var = server->vars.list[grp->vars.list[i]->id];
+        bin_op_wide[operation](var->data, mask, mask_size);
+        var_changed(server, var);
+    }
+
     // Call hook
     if(server->hook)
     {
@@ -530,6 +989,65 @@ SERVER_CMD_FUNCTION (group_remove_all)
         MESSAGE_SET_ANSWER_RET(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
 
     server->groups.count = GROUP_STANDARD_COUNT;
+
+    // Give back the memory of the delta shadows. Standard groups get a fresh
+    // shadow (and a full answer) on their next delta read.
+    server->delta_mem_used = 0;
+    memset(server->deltas, 0, sizeof(server->deltas));
+
+    server->latched = NULL;
+
+    MESSAGE_SET_ANSWER(send_msg, CMD_OK);
+}
+
+SERVER_CMD_FUNCTION (group_latch)
+{
+    // No payload releases the latch
+    if(!recv_msg->payload_size)
+    {
+        server->latched = NULL;
+        MESSAGE_SET_ANSWER_RET(send_msg, CMD_OK);
+    }
+
+    // Payload size must be 1 (ID)
+    if(recv_msg->payload_size != 1)
+        MESSAGE_SET_ANSWER_RET(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
+
+    // No memory for the snapshot
+    if(!server->latch_mem)
+        MESSAGE_SET_ANSWER_RET(send_msg, CMD_ERR_OP_NOT_SUPPORTED);
+
+    // Check group ID
+    uint8_t group_id = recv_msg->payload[0];
+
+    if(group_id >= server->groups.count)
+        MESSAGE_SET_ANSWER_RET(send_msg, CMD_ERR_INVALID_ID);
+
+    // Get desired group
+    struct bsmp_group *grp = &server->groups.list[group_id];
+
+    if(grp->size > server->latch_mem_size)
+        MESSAGE_SET_ANSWER_RET(send_msg, CMD_ERR_INSUFFICIENT_MEMORY);
+
+    // Call hook
+    if(server->hook)
+    {
+        group_to_mod_list(server, grp);
+        server->hook(BSMP_OP_READ, server->modified_list);
+    }
+
+    struct bsmp_var *var;
+    uint8_t *latchp = server->latch_mem;
+    unsigned int i;
+    for(i = 0; i < grp->vars.count; ++i)
+    {
+        var = server->vars.list[grp->vars.list[i]->id];
+        memcpy(latchp, var->data, var->info.size);
+        latchp += var->info.size;
+    }
+    server->latched          = grp;
+    server->latch_generation = server->generation;
+
     MESSAGE_SET_ANSWER(send_msg, CMD_OK);
 }
 
@@ -579,7 +1097,9 @@ SERVER_CMD_FUNCTION (curve_query_csum)
     send_msg->payload_size = BSMP_CURVE_CSUM_SIZE;
 }
 
-SERVER_CMD_FUNCTION (curve_block_request)
+// Answer a block request, compressed if asked to and if it pays off
+static void curve_block_answer (bsmp_server_t *server, struct message *recv_msg,
+                                struct message *send_msg, bool compress)
 {
     // Payload size must be equal to BSMP_CURVE_BLOCK_INFO
     if(recv_msg->payload_size != BSMP_CURVE_BLOCK_INFO)
@@ -604,17 +1124,63 @@ SERVER_CMD_FUNCTION (curve_block_request)
     send_msg->payload[1] = recv_msg->payload[1];    // Offset (most sig.)
     send_msg->payload[2] = recv_msg->payload[2];    // Offset (less sig.)
 
-    bool ok = curve->read_block(curve, block_offset,
-                                send_msg->payload + BSMP_CURVE_BLOCK_INFO,
-                                &send_msg->payload_size);
+    uint8_t  *data  = send_msg->payload + BSMP_CURVE_BLOCK_INFO;
+    uint8_t  *block = data;
+    uint16_t len;
+    bool ok;
+
+    // A block to be compressed is read at the end of the answer and compressed
+    // towards its start
+    uint16_t at = compress ? BSMP_MAX_PAYLOAD - BSMP_CURVE_BLOCK_INFO -
+                             curve->info.block_size : 0;
+
+    // Block already in memory: avoid copying it, if possible
+    if(curve->get_block_ptr)
+        ok = curve->get_block_ptr(curve, block_offset, &block, &len);
+    else
+        ok = curve->read_block(curve, block_offset, block += at, &len);
 
     if(!ok)
         MESSAGE_SET_ANSWER_RET(send_msg, CMD_ERR_RESOURCE_BUSY);
 
-    send_msg->payload_size += BSMP_CURVE_BLOCK_INFO;
+    if(compress && len > 1)
+    {
+        uint16_t lz_len = curve->get_block_ptr ?
+                          lz_compress(block, len, data, len - 1) :
+                          lz_compress_in_place(data, at, len, len - 1);
+
+        if(lz_len)
+        {
+            send_msg->command_code = CMD_CURVE_BLOCK_LZ;
+            send_msg->payload_size = BSMP_CURVE_BLOCK_INFO + lz_len;
+            return;
+        }
+    }
+
+    if(block != data)
+    {
+        if(curve->get_block_ptr)
+            message_borrow(send_msg, data, block, len);
+        else
+            memmove(data, block, len);
+    }
+
+    send_msg->payload_size = BSMP_CURVE_BLOCK_INFO + len;
 }
 
-SERVER_CMD_FUNCTION (curve_block)
+SERVER_CMD_FUNCTION (curve_block_request)
+{
+    curve_block_answer(server, recv_msg, send_msg, false);
+}
+
+SERVER_CMD_FUNCTION (curve_block_request_lz)
+{
+    curve_block_answer(server, recv_msg, send_msg, true);
+}
+
+// Write a block, decompressing it first if needed
+static void curve_block_write (bsmp_server_t *server, struct message *recv_msg,
+                               struct message *send_msg, bool compressed)
 {
     // Payload must contain, at least, 4 bytes (1 for ID, 2 for offset, 1 for
     // data)
@@ -630,8 +1196,12 @@ SERVER_CMD_FUNCTION (curve_block)
     // Get curve
     struct bsmp_curve *curve = server->curves.list[curve_id];
 
+    if(!curve->info.writable)
+        MESSAGE_SET_ANSWER_RET(send_msg, CMD_ERR_READ_ONLY);
+
     // Check block size
-    if(recv_msg->payload_size > curve->info.block_size + BSMP_CURVE_BLOCK_INFO)
+    if(!compressed &&
+       recv_msg->payload_size > curve->info.block_size + BSMP_CURVE_BLOCK_INFO)
         MESSAGE_SET_ANSWER_RET(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
 
     // Check offset
@@ -639,18 +1209,37 @@ SERVER_CMD_FUNCTION (curve_block)
     if(block_offset >= curve->info.nblocks)
         MESSAGE_SET_ANSWER_RET(send_msg, CMD_ERR_INVALID_VALUE);
 
-    // Everything ok, write block
-    bool ok = curve->write_block(curve, block_offset,
-                                 recv_msg->payload + BSMP_CURVE_BLOCK_INFO,
-                                 recv_msg->payload_size - BSMP_CURVE_BLOCK_INFO);
+    uint8_t  *block = recv_msg->payload + BSMP_CURVE_BLOCK_INFO;
+    uint16_t len    = recv_msg->payload_size - BSMP_CURVE_BLOCK_INFO;
 
-    if(!ok)
+    // The answer carries no payload: decompress to its buffer
+    if(compressed)
+    {
+        if(!lz_decompress(block, len, send_msg->payload, curve->info.block_size,
+                          &len) || !len)
+            MESSAGE_SET_ANSWER_RET(send_msg, CMD_ERR_INVALID_VALUE);
+
+        block = send_msg->payload;
+    }
+
+    // Everything ok, write block
+    if(!curve->write_block(curve, block_offset, block, len))
         MESSAGE_SET_ANSWER_RET(send_msg, CMD_ERR_RESOURCE_BUSY);
 
     memset(curve->info.checksum, 0, sizeof(curve->info.checksum));
     MESSAGE_SET_ANSWER(send_msg, CMD_OK);
 }
 
+SERVER_CMD_FUNCTION (curve_block)
+{
+    curve_block_write(server, recv_msg, send_msg, false);
+}
+
+SERVER_CMD_FUNCTION (curve_block_lz)
+{
+    curve_block_write(server, recv_msg, send_msg, true);
+}
+
 SERVER_CMD_FUNCTION (curve_recalc_csum)
 {
     // Payload must contain Curve ID only
@@ -672,6 +1261,23 @@ SERVER_CMD_FUNCTION (curve_recalc_csum)
         if(!server->custom_md5(curve, curve->info.checksum))
             MESSAGE_SET_ANSWER_RET(send_msg, CMD_ERR_RESOURCE_BUSY);
     }
+    else if(curve->get_block_ptr)
+    {
+        uint8_t *block;
+        MD5_CTX md5ctx;
+
+        MD5Init(&md5ctx);
+
+        unsigned int i;
+        for(i = 0; i < curve->info.nblocks; ++i)
+        {
+            uint16_t read_bytes = 0;
+            if(!curve->get_block_ptr(curve, (uint16_t)i, &block, &read_bytes))
+                MESSAGE_SET_ANSWER_RET(send_msg, CMD_ERR_RESOURCE_BUSY);
+            MD5Update(&md5ctx, block, read_bytes);
+        }
+        MD5Final(curve->info.checksum, &md5ctx);
+    }
     else
     {
         uint8_t block[curve->info.block_size];
@@ -13,12 +13,13 @@
     do {\
         (msg)->command_code = (code);\
         (msg)->payload_size = 0;\
+        (msg)->iovcnt = 0;\
+        (msg)->pending = (msg)->payload - BSMP_HEADER_SIZE;\
     }while(0)
 
 #define MESSAGE_SET_ANSWER_RET(msg, code)\
     do {\
-        (msg)->command_code = (code);\
-        (msg)->payload_size = 0;\
+        MESSAGE_SET_ANSWER(msg, code);\
         return;\
     }while(0)
 
@@ -27,6 +28,12 @@ struct message
     uint8_t  command_code;
     uint16_t payload_size;
     uint8_t  *payload;
+
+    // Scatter/gather answer. iov is NULL if the whole answer is to be copied
+    // to payload.
+    struct bsmp_iov *iov;
+    unsigned int    iovcnt, iovmax;
+    uint8_t         *pending;       // Start of the data not yet in iov
 };
 
 struct generic_list
@@ -46,10 +53,16 @@ enum bsmp_err var_check     (struct bsmp_var *var);
 enum bsmp_err curve_check   (struct bsmp_curve *curve);
 enum bsmp_err func_check    (struct bsmp_func *func);
 
+uint8_t       *message_borrow (struct message *msg, uint8_t *at,
+                               uint8_t *data, uint16_t len);
+
+void          var_changed   (bsmp_server_t *server, struct bsmp_var *var);
+
 void          group_init    (struct bsmp_group *grp, uint8_t id);
 void          group_add_var (struct bsmp_group *grp, struct bsmp_var *var);
 
 SERVER_CMD_FUNCTION (query_version);
+SERVER_CMD_FUNCTION (schema_query);
 SERVER_CMD_FUNCTION (var_query_list);
 SERVER_CMD_FUNCTION (var_read);
 SERVER_CMD_FUNCTION (var_write);
@@ -58,14 +71,20 @@ SERVER_CMD_FUNCTION (var_bin_op);
 SERVER_CMD_FUNCTION (group_query_list);
 SERVER_CMD_FUNCTION (group_query);
 SERVER_CMD_FUNCTION (group_read);
+SERVER_CMD_FUNCTION (group_read_changed);
+SERVER_CMD_FUNCTION (group_read_delta);
 SERVER_CMD_FUNCTION (group_write);
 SERVER_CMD_FUNCTION (group_bin_op);
+SERVER_CMD_FUNCTION (group_bin_op_bcast);
 SERVER_CMD_FUNCTION (group_create);
 SERVER_CMD_FUNCTION (group_remove_all);
+SERVER_CMD_FUNCTION (group_latch);
 SERVER_CMD_FUNCTION (curve_query_list);
 SERVER_CMD_FUNCTION (curve_query_csum);
 SERVER_CMD_FUNCTION (curve_block_request);
 SERVER_CMD_FUNCTION (curve_block);
+SERVER_CMD_FUNCTION (curve_block_request_lz);
+SERVER_CMD_FUNCTION (curve_block_lz);
 SERVER_CMD_FUNCTION (curve_recalc_csum);
 SERVER_CMD_FUNCTION (func_query_list);
 SERVER_CMD_FUNCTION (func_execute);
@@ -0,0 +1,417 @@
+#define _GNU_SOURCE     // memfd_create
+
+#include "bsmp_priv.h"
+#include "../include/shm.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#if (BSMP_SHM_RING_SIZE & (BSMP_SHM_RING_SIZE - 1)) || \
+    BSMP_SHM_RING_SIZE < 2*(BSMP_MAX_MESSAGE + 8)
+#error "BSMP_SHM_RING_SIZE must be a power of two, room for two messages"
+#endif
+
+#define SHM_MAGIC       0x504D5342      // "BSMP"
+
+#define RING_MASK       (BSMP_SHM_RING_SIZE - 1)
+
+// Messages are stored after their size, 4 bytes aligned. A size of WRAP means
+// the next message is at the start of the ring.
+#define RECORD(len)     ((4 + (len) + 3) & ~3u)
+#define WRAP            UINT32_MAX
+
+static uint64_t now_ns (void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+static void cpu_relax (void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+// Sleeps while *word is old, up to ns. Without futexes, just naps.
+static void sleep_on (uint32_t *word, uint32_t old, uint64_t ns)
+{
+    struct timespec ts = {
+        .tv_sec  = ns/1000000000,
+        .tv_nsec = ns%1000000000
+    };
+
+#ifdef __linux__
+    // Not private: the other end is usually another process
+    syscall(SYS_futex, word, FUTEX_WAIT, old, &ts, NULL, 0);
+#else
+    (void) word;
+    (void) old;
+
+    if(ns > 100000)
+        ts.tv_sec = 0, ts.tv_nsec = 100000;
+
+    nanosleep(&ts, NULL);
+#endif
+}
+
+static void wake (uint32_t *word)
+{
+#ifdef __linux__
+    syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#else
+    (void) word;
+#endif
+}
+
+// Waits for the other end to move *word from old, spinning for spin_us first.
+// Sleepers raise *waiters before checking *word a last time, and the other
+// end stores *word before checking *waiters, so no wake up is missed.
+static int wait_change (bsmp_shm_t *shm, uint32_t *word, uint32_t *waiters,
+                        uint32_t old)
+{
+    uint64_t start   = now_ns();
+    uint64_t spin    = (uint64_t) shm->spin_us*1000;
+    uint64_t timeout = (uint64_t) shm->timeout_ms*1000000;
+
+    while(__atomic_load_n(word, __ATOMIC_ACQUIRE) == old)
+    {
+        uint64_t elapsed = now_ns() - start;
+
+        if(elapsed < spin)
+        {
+            cpu_relax();
+            continue;
+        }
+
+        if(shm->timeout_ms >= 0 && elapsed >= timeout)
+            return -1;
+
+        __atomic_store_n(waiters, 1, __ATOMIC_SEQ_CST);
+
+        if(__atomic_load_n(word, __ATOMIC_SEQ_CST) == old)
+            sleep_on(word, old, shm->timeout_ms >= 0 ? timeout - elapsed
+                                                     : 1000000000);
+
+        __atomic_store_n(waiters, 0, __ATOMIC_RELAXED);
+    }
+
+    return 0;
+}
+
+static void publish (uint32_t *word, uint32_t *waiters, uint32_t value)
+{
+    __atomic_store_n(word, value, __ATOMIC_SEQ_CST);
+
+    if(__atomic_load_n(waiters, __ATOMIC_SEQ_CST))
+        wake(word);
+}
+
+// Producer side. Returns where a message of up to max bytes is to be written,
+// contiguous in the ring, or NULL if the consumer didn't make room in time.
+static uint8_t *reserve (bsmp_shm_t *shm, uint32_t max)
+{
+    struct bsmp_shm_ring *ring = shm->tx;
+    uint32_t head = ring->head;
+    uint32_t pos  = head & RING_MASK;
+    uint32_t left = BSMP_SHM_RING_SIZE - pos;
+    uint32_t need = RECORD(max) <= left ? RECORD(max) : left + RECORD(max);
+
+    for(;;)
+    {
+        uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+        if(BSMP_SHM_RING_SIZE - (head - tail) >= need)
+            break;
+
+        if(wait_change(shm, &ring->tail, &ring->tail_waiters, tail))
+            return NULL;
+    }
+
+    // Not enough room before the end of the ring
+    if(RECORD(max) > left)
+    {
+        memcpy(ring->data + pos, &(uint32_t){WRAP}, 4);
+        head += left;
+        pos   = 0;
+    }
+
+    shm->tx_head = head;
+
+    return ring->data + pos + 4;
+}
+
+// Publishes the message written at the place returned by reserve
+static void commit (bsmp_shm_t *shm, uint32_t len)
+{
+    struct bsmp_shm_ring *ring = shm->tx;
+
+    memcpy(ring->data + (shm->tx_head & RING_MASK), &len, 4);
+    publish(&ring->head, &ring->head_waiters, shm->tx_head + RECORD(len));
+}
+
+// Consumer side. Gives the room of the messages received back to the producer.
+static void release (bsmp_shm_t *shm)
+{
+    struct bsmp_shm_ring *ring = shm->rx;
+
+    if(ring->tail != shm->rx_tail)
+        publish(&ring->tail, &ring->tail_waiters, shm->rx_tail);
+}
+
+int bsmp_shm_send (bsmp_shm_t *shm, struct bsmp_iov *iov, unsigned int count)
+{
+    uint32_t len = 0;
+    unsigned int i;
+
+    for(i = 0; i < count; ++i)
+        len += iov[i].len;
+
+    if(len > BSMP_MAX_MESSAGE)
+        return -1;
+
+    uint8_t *p = reserve(shm, len);
+
+    if(!p)
+        return -1;
+
+    for(i = 0; i < count; ++i)
+    {
+        memcpy(p, iov[i].base, iov[i].len);
+        p += iov[i].len;
+    }
+
+    commit(shm, len);
+
+    return 0;
+}
+
+int bsmp_shm_recv (bsmp_shm_t *shm, uint8_t **data, uint32_t *len)
+{
+    struct bsmp_shm_ring *ring = shm->rx;
+    uint32_t tail = shm->rx_tail;
+    uint32_t size;
+
+    // The previous message is done with
+    release(shm);
+
+    for(;;)
+    {
+        uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+        if(head == tail)
+        {
+            if(wait_change(shm, &ring->head, &ring->head_waiters, head))
+                return -1;
+            continue;
+        }
+
+        memcpy(&size, ring->data + (tail & RING_MASK), 4);
+
+        if(size != WRAP)
+            break;
+
+        tail += BSMP_SHM_RING_SIZE - (tail & RING_MASK);
+    }
+
+    if(size > BSMP_MAX_MESSAGE)
+        return -1;
+
+    *data = ring->data + (tail & RING_MASK) + 4;
+    *len  = size;
+    shm->rx_tail = tail + RECORD(size);
+
+    return 0;
+}
+
+enum bsmp_err bsmp_shm_serve (bsmp_shm_t *shm, bsmp_server_t *server)
+{
+    if(!shm || !server)
+        return BSMP_ERR_PARAM_INVALID;
+
+    uint8_t *data;
+    uint32_t len;
+
+    if(bsmp_shm_recv(shm, &data, &len))
+        return BSMP_ERR_TIMEOUT;
+
+    uint8_t *answer = len <= UINT16_MAX ? reserve(shm, BSMP_MAX_MESSAGE) : NULL;
+
+    if(!answer)
+    {
+        release(shm);
+        return BSMP_ERR_COMM;
+    }
+
+    struct bsmp_raw_packet request  = {data, len};
+    struct bsmp_raw_packet response = {answer, 0};
+
+    if(bsmp_process_packet(server, &request, &response))
+        response.len = 0;
+
+    commit(shm, response.len);
+    release(shm);
+
+    return BSMP_SUCCESS;
+}
+
+// Segments
+
+static enum bsmp_err map (bsmp_shm_t *shm, int fd, bool server)
+{
+    void *mem = mmap(NULL, sizeof(struct bsmp_shm_segment),
+                     PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if(mem == MAP_FAILED)
+        return BSMP_ERR_IO;
+
+    shm->fd         = fd;
+    shm->seg        = mem;
+    shm->tx         = server ? &shm->seg->answers  : &shm->seg->requests;
+    shm->rx         = server ? &shm->seg->requests : &shm->seg->answers;
+    shm->timeout_ms = 1000;
+
+    // Spinning only helps when the other end runs on another CPU meanwhile
+    shm->spin_us    = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? 50 : 0;
+    shm->tx_head    = shm->tx->head;
+    shm->rx_tail    = shm->rx->tail;
+
+    return BSMP_SUCCESS;
+}
+
+enum bsmp_err bsmp_shm_create (bsmp_shm_t *shm, const char *name)
+{
+    if(!shm || (name && strlen(name) >= sizeof(shm->name)))
+        return BSMP_ERR_PARAM_INVALID;
+
+#ifdef __linux__
+    int fd = name ? shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0600)
+                  : memfd_create("bsmp", MFD_CLOEXEC);
+#else
+    if(!name)
+        return BSMP_ERR_PARAM_INVALID;
+
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0600);
+#endif
+
+    if(fd < 0)
+        return BSMP_ERR_IO;
+
+    // Fresh pages are zeroed: both rings start empty
+    if(ftruncate(fd, sizeof(struct bsmp_shm_segment)) ||
+       map(shm, fd, true))
+    {
+        close(fd);
+        if(name)
+            shm_unlink(name);
+        return BSMP_ERR_IO;
+    }
+
+    shm->seg->ring_size = BSMP_SHM_RING_SIZE;
+    __atomic_store_n(&shm->seg->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+
+    snprintf(shm->name, sizeof(shm->name), "%s", name ? name : "");
+
+    return BSMP_SUCCESS;
+}
+
+enum bsmp_err bsmp_shm_attach (bsmp_shm_t *shm, int fd)
+{
+    if(!shm || fd < 0)
+        return BSMP_ERR_PARAM_INVALID;
+
+    struct stat st;
+
+    if(fstat(fd, &st) || st.st_size != sizeof(struct bsmp_shm_segment) ||
+       map(shm, fd, false))
+        return BSMP_ERR_IO;
+
+    if(__atomic_load_n(&shm->seg->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC ||
+       shm->seg->ring_size != BSMP_SHM_RING_SIZE)
+    {
+        munmap(shm->seg, sizeof(struct bsmp_shm_segment));
+        return BSMP_ERR_IO;
+    }
+
+    shm->name[0] = '\0';
+
+    return BSMP_SUCCESS;
+}
+
+enum bsmp_err bsmp_shm_open (bsmp_shm_t *shm, const char *name)
+{
+    if(!shm || !name)
+        return BSMP_ERR_PARAM_INVALID;
+
+    int fd = shm_open(name, O_RDWR, 0);
+
+    if(fd < 0)
+        return BSMP_ERR_IO;
+
+    enum bsmp_err err = bsmp_shm_attach(shm, fd);
+
+    if(err)
+        close(fd);
+
+    return err;
+}
+
+void bsmp_shm_close (bsmp_shm_t *shm)
+{
+    if(!shm || !shm->seg)
+        return;
+
+    munmap(shm->seg, sizeof(struct bsmp_shm_segment));
+    close(shm->fd);
+
+    if(shm->name[0])
+        shm_unlink(shm->name);
+
+    shm->seg = NULL;
+    shm->fd  = -1;
+}
+
+// Transport
+
+static int transport_send (void *ctx, uint8_t *data, uint32_t len)
+{
+    struct bsmp_iov iov = {data, len};
+    return bsmp_shm_send(ctx, &iov, 1);
+}
+
+static int transport_sendv (void *ctx, struct bsmp_iov *iov,
+                            unsigned int iovcnt)
+{
+    return bsmp_shm_send(ctx, iov, iovcnt);
+}
+
+static int transport_recv (void *ctx, uint8_t **data, uint32_t *len)
+{
+    return bsmp_shm_recv(ctx, data, len);
+}
+
+void bsmp_shm_transport (bsmp_shm_t *shm, struct bsmp_transport *transport)
+{
+    memset(transport, 0, sizeof(*transport));
+    transport->ctx     = shm;
+    transport->send    = transport_send;
+    transport->sendv   = transport_sendv;
+    transport->recv_zc = transport_recv;
+}
@@ -0,0 +1,635 @@
+#include "bsmp_priv.h"
+#include "../include/tcp.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#if BSMP_TCP_RX_SIZE < BSMP_MAX_MESSAGE
+#error "BSMP_TCP_RX_SIZE must hold at least one message"
+#endif
+
+// Regions of a message sent at once
+#define MAX_REGIONS     16
+
+static uint64_t now_ms (void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+static void conn_reset (struct bsmp_tcp_conn *conn, int fd)
+{
+    conn->fd       = fd;
+    conn->rx_start = 0;
+    conn->rx_end   = 0;
+}
+
+static void conn_close (struct bsmp_tcp_conn *conn)
+{
+    if(conn->fd >= 0)
+        close(conn->fd);
+
+    conn_reset(conn, -1);
+}
+
+static void tune (int fd)
+{
+    int one = 1;
+
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+#ifdef TCP_QUICKACK
+    setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &one, sizeof(one));
+#endif
+}
+
+// Looks for a whole message at the start of the buffer and consumes it. It
+// stays there until the next read.
+static bool take (struct bsmp_tcp_conn *conn, uint8_t **msg, uint32_t *len)
+{
+    uint32_t avail = conn->rx_end - conn->rx_start;
+    uint8_t *m = conn->rx + conn->rx_start;
+
+    if(avail < BSMP_HEADER_SIZE)
+        return false;
+
+    uint32_t size = BSMP_HEADER_SIZE + ((m[1] << 8) | m[2]);
+
+    if(avail < size)
+        return false;
+
+    conn->rx_start += size;
+    *msg = m;
+    *len = size;
+
+    return true;
+}
+
+// Reads as many bytes, and messages, as there are, in a single call. Returns
+// what recv returns.
+static ssize_t fill (struct bsmp_tcp_conn *conn)
+{
+    // Make room for the rest of the message
+    if(conn->rx_start == conn->rx_end)
+        conn->rx_start = conn->rx_end = 0;
+    else if(conn->rx_end == sizeof(conn->rx))
+    {
+        memmove(conn->rx, conn->rx + conn->rx_start,
+                conn->rx_end - conn->rx_start);
+        conn->rx_end  -= conn->rx_start;
+        conn->rx_start = 0;
+    }
+
+    ssize_t ret;
+
+    do
+        ret = recv(conn->fd, conn->rx + conn->rx_end,
+                   sizeof(conn->rx) - conn->rx_end, 0);
+    while(ret < 0 && errno == EINTR);
+
+    if(ret > 0)
+        conn->rx_end += ret;
+
+    return ret;
+}
+
+// Sends the regions of a message, in a single call unless the socket is full
+static int send_msg (int fd, struct bsmp_iov *regions, unsigned int count,
+                     int timeout_ms)
+{
+    struct iovec iov[MAX_REGIONS];
+    struct msghdr hdr = {.msg_iov = iov, .msg_iovlen = count};
+    unsigned int i;
+
+    if(count > MAX_REGIONS)
+        return -1;
+
+    for(i = 0; i < count; ++i)
+    {
+        iov[i].iov_base = regions[i].base;
+        iov[i].iov_len  = regions[i].len;
+    }
+
+    while(hdr.msg_iovlen)
+    {
+        ssize_t ret = sendmsg(fd, &hdr, MSG_NOSIGNAL);
+
+        if(ret < 0)
+        {
+            if(errno == EINTR)
+                continue;
+
+            struct pollfd pfd = {.fd = fd, .events = POLLOUT};
+
+            if(errno != EAGAIN || poll(&pfd, 1, timeout_ms) <= 0)
+                return -1;
+
+            continue;
+        }
+
+        while(hdr.msg_iovlen && (size_t) ret >= hdr.msg_iov->iov_len)
+        {
+            ret -= hdr.msg_iov->iov_len;
+            ++hdr.msg_iov;
+            --hdr.msg_iovlen;
+        }
+
+        if(hdr.msg_iovlen)
+        {
+            hdr.msg_iov->iov_base = (uint8_t*) hdr.msg_iov->iov_base + ret;
+            hdr.msg_iov->iov_len -= ret;
+        }
+    }
+
+    return 0;
+}
+
+// Client side
+
+static int dial (bsmp_tcp_pool_t *pool)
+{
+    int fd = socket(pool->addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if(fd < 0)
+        return -1;
+
+    // Blocking, so that each send and receive is a single call. The timeouts
+    // also bound the connect.
+    if(pool->timeout_ms >= 0)
+    {
+        struct timeval tv = {
+            .tv_sec  = pool->timeout_ms/1000,
+            .tv_usec = pool->timeout_ms%1000*1000
+        };
+
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    }
+
+    if(connect(fd, (struct sockaddr*) &pool->addr, pool->addrlen))
+    {
+        close(fd);
+        return -1;
+    }
+
+    tune(fd);
+
+    return fd;
+}
+
+// Waits up to ms for a connection to be freed
+static void wait_freed (bsmp_tcp_pool_t *pool, uint64_t ms)
+{
+    struct timespec ts;
+
+    // The condition variable goes by the realtime clock
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec  += ms/1000;
+    ts.tv_nsec += (ms % 1000)*1000000;
+
+    if(ts.tv_nsec >= 1000000000)
+    {
+        ++ts.tv_sec;
+        ts.tv_nsec -= 1000000000;
+    }
+
+    pthread_cond_timedwait(&pool->freed, &pool->lock, &ts);
+}
+
+// Takes a connection: an idle one if there is, otherwise connects a closed one
+// not backing off. Waits for one to be freed, or to be done backing off, if
+// some are busy.
+static struct bsmp_tcp_conn *acquire (bsmp_tcp_pool_t *pool)
+{
+    struct bsmp_tcp_conn *conn;
+    bool waited = false;
+
+    pthread_mutex_lock(&pool->lock);
+    for(;;)
+    {
+        struct bsmp_tcp_conn *closed = NULL;
+        bool busy = false;
+        uint64_t now = now_ms();
+        uint64_t retry = 0;         // Earliest end of a backoff
+        unsigned int i;
+
+        conn = NULL;
+        for(i = 0; i < pool->size && !conn; ++i)
+        {
+            struct bsmp_tcp_conn *c = &pool->conns[i];
+
+            if(c->busy)
+                busy = true;
+            else if(c->fd >= 0)
+                conn = c;
+            else if(now < c->retry_ms)
+            {
+                if(!retry || c->retry_ms < retry)
+                    retry = c->retry_ms;
+            }
+            else if(!closed)
+                closed = c;
+        }
+
+        if(!conn)
+            conn = closed;
+
+        if(conn)
+            break;
+
+        // Every connection is backing off: fail fast rather than wait it out
+        if(!busy)
+        {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+
+        if(!waited)
+        {
+            ++pool->stats.waits;
+            waited = true;
+        }
+
+        if(retry)
+            wait_freed(pool, retry - now);
+        else
+            pthread_cond_wait(&pool->freed, &pool->lock);
+    }
+
+    conn->busy = true;
+    pthread_mutex_unlock(&pool->lock);
+
+    if(conn->fd >= 0)
+        return conn;
+
+    int fd = dial(pool);
+
+    pthread_mutex_lock(&pool->lock);
+    if(fd < 0)
+    {
+        conn->backoff_ms = conn->backoff_ms ? 2*conn->backoff_ms :
+                                              pool->backoff_min_ms;
+        if(conn->backoff_ms > pool->backoff_max_ms)
+            conn->backoff_ms = pool->backoff_max_ms;
+
+        conn->retry_ms = now_ms() + conn->backoff_ms;
+        conn->busy     = false;
+        ++pool->stats.failures;
+        pthread_cond_broadcast(&pool->freed);
+        conn = NULL;
+    }
+    else
+    {
+        conn_reset(conn, fd);
+        conn->backoff_ms = 0;
+        ++pool->stats.connects;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return conn;
+}
+
+// Gives the connection of a link back to the pool, closing it if broken: what
+// comes next on it can't be matched to requests anymore
+static void release (struct bsmp_tcp_link *link, bool broken)
+{
+    bsmp_tcp_pool_t *pool = link->pool;
+
+    pthread_mutex_lock(&pool->lock);
+    if(broken)
+    {
+        conn_close(link->conn);
+        ++pool->stats.failures;
+    }
+    link->conn->busy = false;
+    pthread_cond_signal(&pool->freed);
+    pthread_mutex_unlock(&pool->lock);
+
+    link->conn     = NULL;
+    link->inflight = 0;
+}
+
+static int link_sendv (void *ctx, struct bsmp_iov *iov, unsigned int iovcnt)
+{
+    struct bsmp_tcp_link *link = ctx;
+
+    if(!link->conn && !(link->conn = acquire(link->pool)))
+        return -1;
+
+    if(send_msg(link->conn->fd, iov, iovcnt, link->pool->timeout_ms))
+    {
+        release(link, true);
+        return -1;
+    }
+
+    ++link->inflight;
+    return 0;
+}
+
+static int link_send (void *ctx, uint8_t *data, uint32_t len)
+{
+    struct bsmp_iov iov = {data, len};
+    return link_sendv(ctx, &iov, 1);
+}
+
+// Answers are copied out, so that the connection can be handed to another
+// client as soon as the last one is in
+static int link_recv (void *ctx, uint8_t *data, uint32_t *len)
+{
+    struct bsmp_tcp_link *link = ctx;
+    uint8_t *msg;
+    uint32_t size;
+
+    if(!link->conn || !link->inflight)
+        return -1;
+
+    while(!take(link->conn, &msg, &size))
+    {
+        if(fill(link->conn) <= 0)
+        {
+            release(link, true);
+            return -1;
+        }
+    }
+
+    if(size > BSMP_MAX_MESSAGE)
+    {
+        release(link, true);
+        return -1;
+    }
+
+    memcpy(data, msg, size);
+    *len = size;
+
+    if(!--link->inflight)
+        release(link, false);
+
+    return 0;
+}
+
+enum bsmp_err bsmp_tcp_pool_init (bsmp_tcp_pool_t *pool, const char *host,
+                                  uint16_t port, unsigned int size)
+{
+    if(!pool || !host)
+        return BSMP_ERR_PARAM_INVALID;
+
+    if(!size || size > BSMP_TCP_MAX_POOL)
+        return BSMP_ERR_PARAM_OUT_OF_RANGE;
+
+    struct addrinfo hints = {
+        .ai_family   = AF_UNSPEC,
+        .ai_socktype = SOCK_STREAM
+    }, *res;
+    char service[6];
+
+    snprintf(service, sizeof(service), "%u", port);
+
+    if(getaddrinfo(host, service, &hints, &res))
+        return BSMP_ERR_IO;
+
+    memset(pool, 0, sizeof(*pool));
+    memcpy(&pool->addr, res->ai_addr, res->ai_addrlen);
+    pool->addrlen = res->ai_addrlen;
+    freeaddrinfo(res);
+
+    pool->size           = size;
+    pool->timeout_ms     = 1000;
+    pool->backoff_min_ms = 50;
+    pool->backoff_max_ms = 5000;
+
+    unsigned int i;
+    for(i = 0; i < BSMP_TCP_MAX_POOL; ++i)
+        conn_reset(&pool->conns[i], -1);
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->freed, NULL);
+
+    return BSMP_SUCCESS;
+}
+
+void bsmp_tcp_transport (bsmp_tcp_pool_t *pool, struct bsmp_tcp_link *link,
+                         struct bsmp_transport *transport)
+{
+    link->pool     = pool;
+    link->conn     = NULL;
+    link->inflight = 0;
+
+    memset(transport, 0, sizeof(*transport));
+    transport->ctx   = link;
+    transport->send  = link_send;
+    transport->sendv = link_sendv;
+    transport->recv  = link_recv;
+}
+
+void bsmp_tcp_pool_stats (bsmp_tcp_pool_t *pool, struct bsmp_tcp_stats *stats)
+{
+    pthread_mutex_lock(&pool->lock);
+    *stats = pool->stats;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void bsmp_tcp_pool_destroy (bsmp_tcp_pool_t *pool)
+{
+    if(!pool)
+        return;
+
+    unsigned int i;
+    for(i = 0; i < BSMP_TCP_MAX_POOL; ++i)
+        conn_close(&pool->conns[i]);
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->freed);
+}
+
+// Server side
+
+enum bsmp_err bsmp_tcp_listen (bsmp_tcp_server_t *tcp, bsmp_server_t *server,
+                               const char *host, uint16_t port)
+{
+    if(!tcp || !server)
+        return BSMP_ERR_PARAM_INVALID;
+
+    struct addrinfo hints = {
+        .ai_family   = AF_UNSPEC,
+        .ai_socktype = SOCK_STREAM,
+        .ai_flags    = AI_PASSIVE
+    }, *res, *ai;
+    char service[6];
+    int fd = -1, one = 1;
+
+    snprintf(service, sizeof(service), "%u", port);
+
+    if(getaddrinfo(host, service, &hints, &res))
+        return BSMP_ERR_IO;
+
+    for(ai = res; ai; ai = ai->ai_next)
+    {
+        fd = socket(ai->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+        if(fd < 0)
+            continue;
+
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        if(!bind(fd, ai->ai_addr, ai->ai_addrlen) &&
+           !listen(fd, BSMP_TCP_MAX_CONNS) &&
+           !fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK))
+            break;
+
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+
+    if(fd < 0)
+        return BSMP_ERR_IO;
+
+    struct sockaddr_storage addr;
+    socklen_t addrlen = sizeof(addr);
+
+    if(getsockname(fd, (struct sockaddr*) &addr, &addrlen))
+    {
+        close(fd);
+        return BSMP_ERR_IO;
+    }
+
+    tcp->server     = server;
+    tcp->fd         = fd;
+    tcp->timeout_ms = 1000;
+    tcp->port       = ntohs(addr.ss_family == AF_INET6 ?
+                            ((struct sockaddr_in6*) &addr)->sin6_port :
+                            ((struct sockaddr_in*) &addr)->sin_port);
+
+    unsigned int i;
+    for(i = 0; i < BSMP_TCP_MAX_CONNS; ++i)
+        conn_reset(&tcp->conns[i], -1);
+
+    return BSMP_SUCCESS;
+}
+
+static void accept_conns (bsmp_tcp_server_t *tcp)
+{
+    int fd;
+
+    while((fd = accept(tcp->fd, NULL, NULL)) >= 0)
+    {
+        unsigned int i;
+
+        for(i = 0; i < BSMP_TCP_MAX_CONNS && tcp->conns[i].fd >= 0; ++i)
+            ;
+
+        if(i == BSMP_TCP_MAX_CONNS ||
+           fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK))
+        {
+            close(fd);
+            continue;
+        }
+
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        tune(fd);
+        conn_reset(&tcp->conns[i], fd);
+    }
+}
+
+// Answers the requests of a client that are in, the whole lot from one read
+static int serve_conn (bsmp_tcp_server_t *tcp, struct bsmp_tcp_conn *conn)
+{
+    ssize_t ret = fill(conn);
+
+    if(!ret)
+        return -1;
+
+    if(ret < 0)
+        return errno == EAGAIN ? 0 : -1;
+
+    uint8_t *msg;
+    uint32_t len;
+
+    while(take(conn, &msg, &len))
+    {
+        if(len > UINT16_MAX)
+            return -1;
+
+        struct bsmp_raw_packet request  = {msg, len};
+        struct bsmp_raw_packet response = {tcp->tx, 0};
+        struct bsmp_iov regions[MAX_REGIONS];
+        unsigned int count = MAX_REGIONS;
+
+        if(bsmp_process_packet_iov(tcp->server, &request, &response, regions,
+                                   &count))
+            return -1;
+
+        if(send_msg(conn->fd, regions, count, tcp->timeout_ms))
+            return -1;
+    }
+
+    return 0;
+}
+
+enum bsmp_err bsmp_tcp_serve (bsmp_tcp_server_t *tcp, int timeout_ms)
+{
+    if(!tcp)
+        return BSMP_ERR_PARAM_INVALID;
+
+    struct pollfd pfd[1 + BSMP_TCP_MAX_CONNS];
+    struct bsmp_tcp_conn *conns[1 + BSMP_TCP_MAX_CONNS];
+    unsigned int i, n = 1;
+
+    pfd[0].fd     = tcp->fd;
+    pfd[0].events = POLLIN;
+
+    for(i = 0; i < BSMP_TCP_MAX_CONNS; ++i)
+    {
+        if(tcp->conns[i].fd < 0)
+            continue;
+
+        pfd[n].fd     = tcp->conns[i].fd;
+        pfd[n].events = POLLIN;
+        conns[n++]    = &tcp->conns[i];
+    }
+
+    int ready = poll(pfd, n, timeout_ms);
+
+    if(!ready)
+        return BSMP_ERR_TIMEOUT;
+
+    if(ready < 0)
+        return errno == EINTR ? BSMP_ERR_TIMEOUT : BSMP_ERR_COMM;
+
+    for(i = 1; i < n; ++i)
+        if(pfd[i].revents && serve_conn(tcp, conns[i]))
+            conn_close(conns[i]);
+
+    if(pfd[0].revents & POLLIN)
+        accept_conns(tcp);
+    else if(pfd[0].revents)
+        return BSMP_ERR_COMM;
+
+    return BSMP_SUCCESS;
+}
+
+void bsmp_tcp_close (bsmp_tcp_server_t *tcp)
+{
+    if(!tcp || tcp->fd < 0)
+        return;
+
+    unsigned int i;
+    for(i = 0; i < BSMP_TCP_MAX_CONNS; ++i)
+        conn_close(&tcp->conns[i]);
+
+    close(tcp->fd);
+    tcp->fd = -1;
+}